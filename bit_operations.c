@@ -8,8 +8,13 @@
  */
 
 #include <limits.h>
+#include <string.h>
 #include "bit_operations.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #if CLICK
 #include <click/config.h>
 #endif
@@ -59,7 +64,7 @@ uint32_t get_bits(const uint8_t A[], uint32_t pos, uint8_t len) {
 
 	for(i = pos; i < (len + pos); i++) {
 		uint8_t bit = A[i / 8] & 128 >> (i % 8);
-		number |= (!!bit << j);
+		number |= ((uint32_t) !!bit << j);
 		j--;
 	}
 
@@ -82,11 +87,67 @@ void clear_bits(uint8_t A[], uint32_t pos, uint32_t len) {
 	}
 }
 
+/*
+ * load 8 consecutive bytes as a big endian word
+ *
+ * @param p				pointer to the first byte
+ *
+ */
+static inline uint64_t load_be64(const uint8_t* p) {
+	return ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) |
+			((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32) |
+			((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) |
+			((uint64_t) p[6] << 8) | ((uint64_t) p[7]);
+}
+
+/*
+ * store a word as 8 consecutive big endian bytes
+ *
+ * @param p				pointer to the first byte
+ * @param w				the word to store
+ *
+ */
+static inline void store_be64(uint8_t* p, uint64_t w) {
+	p[0] = (uint8_t) (w >> 56); p[1] = (uint8_t) (w >> 48);
+	p[2] = (uint8_t) (w >> 40); p[3] = (uint8_t) (w >> 32);
+	p[4] = (uint8_t) (w >> 24); p[5] = (uint8_t) (w >> 16);
+	p[6] = (uint8_t) (w >> 8);  p[7] = (uint8_t) (w);
+}
+
+/*
+ * read up to 8 bits at a certain position in a bit array,
+ * only touching the bytes that hold these bits
+ *
+ * @param SRC			the array to read from
+ * @param pos			the bit to start from
+ * @param len			the number of bits to read (1 - 8)
+ *
+ * @return 	the bits, right aligned
+ *
+ */
+static inline uint8_t read_bits8(const uint8_t SRC[], uint32_t pos, uint8_t len) {
+	const uint8_t* p = SRC + (pos / 8);
+	uint8_t shift = pos % 8;
+	uint16_t value = (uint16_t) (p[0] << 8);
+
+	if ((shift + len) > 8) {
+		value |= p[1];
+	}
+
+	return (uint8_t) ((value >> (16 - shift - len)) & (0xFF >> (8 - len)));
+}
+
 /**
  * copy bits to a certain position in a bit array
  * from another array
  * big endian
  *
+ * the bits are OR'ed into the destination, bits that are
+ * not set in the source do not clear the destination
+ *
+ * the copy runs on 64-bit words: once the destination is byte aligned,
+ * the source is shifted into place a word at a time
+ *
  * @param DST			the array to copy to
  * @param dst_pos		which bit to start from
  * @param SRC			the array to copy from
@@ -96,19 +157,178 @@ void clear_bits(uint8_t A[], uint32_t pos, uint32_t len) {
  */
 void copy_bits(uint8_t DST[], uint32_t dst_pos, const uint8_t SRC[], uint32_t src_pos,
 		uint32_t len) {
-	uint32_t i;
-	uint32_t k = 0;
+	uint8_t head = dst_pos % 8;
+	uint8_t shift; uint32_t bytes;
+
+	if (!len) {
+		return;
+	}
 
-	for(i = 0; i < len; i++) { // for each bit
-		uint8_t src_val = ((128 >> ( (k + src_pos) % 8)) & SRC[((k + src_pos) / 8)]);
-		if(src_val) {
-			// DEBUG_PRINTF("set bits for %d at position %d len is %d \n", DST[i+dst_pos], i+dst_pos, len);
-			set_bits(DST, i + dst_pos, 1);
+	if (head) { // fill up the first, partial destination byte
+		uint8_t n = 8 - head;
+		if (n > len) {
+			n = len;
 		}
-		k++;
+		DST[dst_pos / 8] |= (uint8_t) (read_bits8(SRC, src_pos, n) << (8 - head - n));
+		dst_pos += n; src_pos += n; len -= n;
+	}
+
+	DST += (dst_pos / 8); // the destination is byte aligned from here on
+	SRC += (src_pos / 8);
+	shift = src_pos % 8;
+	bytes = len / 8;
+
+	if (!shift) { // both byte aligned
+		while (bytes >= 8) {
+			store_be64(DST, load_be64(DST) | load_be64(SRC));
+			DST += 8; SRC += 8; bytes -= 8;
+		}
+		while (bytes--) {
+			*DST++ |= *SRC++;
+		}
+	} else {
+		/* a word at src_pos spans 9 source bytes,
+		 * the 9th byte is always within the requested bits */
+		while (bytes >= 8) {
+			uint64_t w = (load_be64(SRC) << shift) | (SRC[8] >> (8 - shift));
+			store_be64(DST, load_be64(DST) | w);
+			DST += 8; SRC += 8; bytes -= 8;
+		}
+		while (bytes--) {
+			*DST++ |= (uint8_t) ((SRC[0] << shift) | (SRC[1] >> (8 - shift)));
+			SRC++;
+		}
+	}
+
+	if (len % 8) { // remaining bits of the last byte
+		*DST |= (uint8_t) (read_bits8(SRC, shift, len % 8) << (8 - (len % 8)));
 	}
 }
 
+/**
+ * copy bits to a byte aligned position in a bit array
+ * and add the resulting bytes to a one's complement sum
+ * big endian
+ *
+ * the bits are OR'ed into the destination, like copy_bits(),
+ * and the sum is taken over the destination bytes after the copy,
+ * as 16-bit words starting at DST; a trailing partial byte is zero padded
+ *
+ * @param DST			the array to copy to, byte aligned
+ * @param SRC			the array to copy from
+ * @param src_pos		which bit to start from
+ * @param len			the number of consecutive bits to copy
+ * @param sum			the running sum, not folded
+ *
+ * @return 	the running sum, fold to 16 bits before use
+ *
+ */
+uint64_t copy_bits_chksum(uint8_t DST[], const uint8_t SRC[], uint32_t src_pos, uint32_t len,
+		uint64_t sum) {
+	uint8_t shift = src_pos % 8;
+	uint32_t i, bytes = len / 8;
+
+	SRC += (src_pos / 8);
+
+	while (bytes >= 8) {
+		uint64_t w = load_be64(SRC);
+		if (shift) { // the 9th byte is always within the requested bits
+			w = (w << shift) | (SRC[8] >> (8 - shift));
+		}
+		w |= load_be64(DST);
+		store_be64(DST, w);
+		sum += (w >> 32) + (w & 0xFFFFFFFF);
+		DST += 8; SRC += 8; bytes -= 8;
+	}
+
+	for (i = 0; i < bytes; i++) {
+		DST[i] |= (uint8_t) (shift ? ((SRC[i] << shift) | (SRC[i + 1] >> (8 - shift))) : SRC[i]);
+		sum += (i % 2) ? DST[i] : ((uint32_t) DST[i] << 8);
+	}
+
+	if (len % 8) { // remaining bits of the last byte
+		DST[i] |= (uint8_t) (read_bits8(SRC + i, shift, len % 8) << (8 - (len % 8)));
+		sum += (i % 2) ? DST[i] : ((uint32_t) DST[i] << 8);
+	}
+
+	return sum;
+}
+
+/*
+ * read a byte at a certain bit offset
+ *
+ * @param p				pointer to the first byte
+ * @param shift			the bit offset in the first byte (0 - 7)
+ *
+ */
+static inline uint8_t read_byte(const uint8_t* p, uint8_t shift) {
+	if (!shift) {
+		return p[0];
+	}
+	return (uint8_t) ((p[0] << shift) | (p[1] >> (8 - shift)));
+}
+
+/*
+ * read a 64-bit lane at a certain bit offset
+ *
+ * @param p				pointer to the first byte
+ * @param shift			the bit offset in the first byte (0 - 7)
+ *
+ */
+static inline uint64_t read_lane(const uint8_t* p, uint8_t shift) {
+	if (!shift) {
+		return load_be64(p);
+	}
+	return (load_be64(p) << shift) | (p[8] >> (8 - shift));
+}
+
+/*
+ * compare two bit sequences, 64 bits at a time
+ * without copying the operands
+ *
+ * @param 	s1			the first byte of the first sequence
+ * @param	shift1		the bit offset in the first byte of s1 (0 - 7)
+ * @param 	s2			the first byte of the second sequence
+ * @param	shift2		the bit offset in the first byte of s2 (0 - 7)
+ * @param 	len			the number of consecutive bits to compare
+ *
+ * @return	1			both sequences match
+ * 			0			the sequences differ
+ *
+ */
+static uint8_t compare_lanes(const uint8_t* s1, uint8_t shift1,
+		const uint8_t* s2, uint8_t shift2, uint32_t len) {
+#if defined(__SSE2__)
+	if (!shift1 && !shift2) { // byte aligned, e.g. IPv6 addresses
+		while (len >= 128) {
+			__m128i a = _mm_loadu_si128((const __m128i*) s1);
+			__m128i b = _mm_loadu_si128((const __m128i*) s2);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF) {
+				return 0;
+			}
+			s1 += 16; s2 += 16; len -= 128;
+		}
+	}
+#endif
+	while (len >= 64) {
+		if (read_lane(s1, shift1) != read_lane(s2, shift2)) {
+			return 0;
+		}
+		s1 += 8; s2 += 8; len -= 64;
+	}
+	while (len >= 8) {
+		if (read_byte(s1, shift1) != read_byte(s2, shift2)) {
+			return 0;
+		}
+		s1++; s2++; len -= 8;
+	}
+	if (len) {
+		return (read_bits8(s1, shift1, len) == read_bits8(s2, shift2, len));
+	}
+
+	return 1;
+}
+
 /**
  * compare two bit arrays
  *
@@ -121,15 +341,7 @@ void copy_bits(uint8_t DST[], uint32_t dst_pos, const uint8_t SRC[], uint32_t sr
  *
  */
 uint8_t compare_bits(const uint8_t SRC1[], const uint8_t SRC2[], uint32_t len) {
-	uint32_t i;
-
-	for (i = 0; i < len; i++) {
-		if ( (SRC1[i / 8] & (128 >> (i % 8) )) != (SRC2[i / 8] & (128 >> (i % 8) )) ) {
-			return 0;
-		}
-	}
-
-	return 1;
+	return compare_lanes(SRC1, 0, SRC2, 0, len);
 }
 
 /**
@@ -147,20 +359,9 @@ uint8_t compare_bits(const uint8_t SRC1[], const uint8_t SRC2[], uint32_t len) {
  */
 uint8_t compare_bits_aligned(const uint8_t SRC1[], uint16_t pos1,
 		const uint8_t SRC2[], uint16_t pos2, uint32_t len) {
-	uint8_t shift1, shift2;
-
-	shift1 = pos1 % 8;
-	shift2 = pos2 % 8;
-
-	// todo no copy
-	uint8_t SRC1_copy[MAX_FIELD_LENGTH] = { 0 };
-	uint8_t SRC2_copy[MAX_FIELD_LENGTH] = { 0 };
-
-	copy_bits(SRC1_copy, 0, SRC1, shift1, len);
-	copy_bits(SRC2_copy, 0, SRC2, shift2, len);
-
-	return compare_bits(SRC1_copy, SRC2_copy, len);
+	return compare_lanes(SRC1 + (pos1 / 8), pos1 % 8, SRC2 + (pos2 / 8), pos2 % 8, len);
 }
+
 /* do_compare()
  *
  * Does the actual comparison, but has some preconditions on parameters to
@@ -268,49 +469,416 @@ uint8_t compare_bits_little_endian(uint8_t* SRC1, uint8_t* SRC2, uint32_t len) {
 	return 1;
 }
 
+/*
+ * read up to 32 bits at a certain position in a bit array,
+ * only touching the bytes that hold these bits
+ *
+ * @param SRC			the array to read from
+ * @param pos			the bit to start from
+ * @param len			the number of bits to read (1 - 32)
+ *
+ * @return 	the bits, right aligned
+ *
+ */
+static inline uint32_t read_bits32(const uint8_t SRC[], uint32_t pos, uint8_t len) {
+	const uint8_t* p = SRC + (pos / 8);
+	uint8_t shift = pos % 8;
+	uint8_t i, bytes = (shift + len + 7) / 8;
+	uint64_t value = 0;
+
+	for (i = 0; i < bytes; i++) {
+		value = (value << 8) | p[i];
+	}
+
+	return (uint32_t) ((value >> ((bytes * 8) - shift - len)) & (UINT32_MAX >> (32 - len)));
+}
+
+/*
+ * OR a right aligned value of up to 32 bits
+ * into a bit array at a certain position
+ *
+ * @param DST			the array to write to
+ * @param pos			the bit to start from
+ * @param value			the bits to write, right aligned
+ * @param len			the number of bits to write (1 - 32)
+ *
+ */
+static inline void or_bits32(uint8_t DST[], uint32_t pos, uint32_t value, uint8_t len) {
+	uint8_t* p = DST + (pos / 8);
+	uint8_t shift = pos % 8;
+	uint8_t i, bytes = (shift + len + 7) / 8;
+	uint64_t w = (uint64_t) value << (64 - shift - len);
+
+	for (i = 0; i < bytes; i++) {
+		p[i] |= (uint8_t) (w >> (56 - (i * 8)));
+	}
+}
+
+/*
+ * write the accumulator of a bit writer to its bit array
+ * and advance to the next word
+ *
+ * @param w				the bit writer
+ *
+ */
+static void bitwriter_store_word(schc_bitwriter_t* w) {
+	uint8_t* p = w->arr->ptr + w->byte;
+	uint8_t i;
+
+	if ((w->byte + 8) <= w->arr->len) {
+		store_be64(p, load_be64(p) | w->acc);
+	} else {
+		for (i = 0; i < 8; i++) {
+			if ((w->byte + i) >= w->arr->len) {
+				w->overflow = 1;
+				break;
+			}
+			p[i] |= (uint8_t) (w->acc >> (56 - (i * 8)));
+		}
+	}
+	w->byte += 8;
+}
+
+/**
+ * start writing bits to a bit array at its current offset
+ *
+ * the bits are OR'ed into the array, like copy_bits(),
+ * and are buffered in a 64-bit accumulator which is stored
+ * a word at a time; bitwriter_flush() stores the remaining bits
+ * and updates the offset of the bit array
+ *
+ * @param w				the bit writer
+ * @param arr			the bit array to write to, bounded by arr->len bytes
+ *
+ */
+void bitwriter_init(schc_bitwriter_t* w, schc_bitarray_t* arr) {
+	w->arr = arr;
+	w->acc = 0;
+	w->acc_len = arr->offset % 8; // the bits in front are already in the array
+	w->byte = arr->offset / 8;
+	w->overflow = 0;
+}
+
+/**
+ * append a value to a bit writer
+ *
+ * @param w				the bit writer
+ * @param value			the bits to write, right aligned
+ * @param len			the number of bits to write (0 - 32)
+ *
+ */
+void bitwriter_put_bits(schc_bitwriter_t* w, uint32_t value, uint8_t len) {
+	uint64_t v; uint8_t free, rest;
+
+	if (!len) {
+		return;
+	}
+
+	v = value & (UINT32_MAX >> (32 - len));
+	free = 64 - w->acc_len;
+	if (len < free) {
+		w->acc |= v << (free - len);
+		w->acc_len += len;
+		return;
+	}
+
+	rest = len - free; // bits that do not fit in the current word
+	w->acc |= v >> rest;
+	bitwriter_store_word(w);
+	w->acc = rest ? (v << (64 - rest)) : 0;
+	w->acc_len = rest;
+}
+
+/**
+ * append a number of bits from an array to a bit writer
+ *
+ * @param w				the bit writer
+ * @param SRC			the array to copy from
+ * @param src_pos		which bit to start from
+ * @param len			the number of consecutive bits to copy
+ *
+ */
+void bitwriter_put_array(schc_bitwriter_t* w, const uint8_t SRC[], uint32_t src_pos,
+		uint32_t len) {
+	while (len) {
+		uint8_t n = (len > 32) ? 32 : len;
+		bitwriter_put_bits(w, read_bits32(SRC, src_pos, n), n);
+		src_pos += n; len -= n;
+	}
+}
+
+/**
+ * append a number of bytes to a bit writer
+ *
+ * @param w				the bit writer
+ * @param SRC			the bytes to copy
+ * @param len			the number of bytes
+ *
+ */
+void bitwriter_put_bytes(schc_bitwriter_t* w, const uint8_t SRC[], uint16_t len) {
+	bitwriter_put_array(w, SRC, 0, BYTES_TO_BITS((uint32_t) len));
+}
+
+/**
+ * get the bit offset a bit writer has reached in its array
+ *
+ * @param w				the bit writer
+ *
+ * @return 	the offset in bits
+ *
+ */
+uint32_t bitwriter_offset(const schc_bitwriter_t* w) {
+	return BYTES_TO_BITS(w->byte) + w->acc_len;
+}
+
+/**
+ * store the buffered bits of a bit writer and set
+ * the offset of the bit array to the end of the written bits
+ * writing can continue after flushing
+ *
+ * @param w				the bit writer
+ *
+ * @return 	1			all bits fitted in the array
+ * 			0			bits beyond arr->len were dropped
+ *
+ */
+uint8_t bitwriter_flush(schc_bitwriter_t* w) {
+	uint8_t* p = w->arr->ptr + w->byte;
+	uint8_t i, bytes = (w->acc_len + 7) / 8;
+
+	for (i = 0; i < bytes; i++) {
+		if ((w->byte + i) >= w->arr->len) {
+			w->overflow = 1;
+			break;
+		}
+		p[i] |= (uint8_t) (w->acc >> (56 - (i * 8)));
+	}
+	w->arr->offset = bitwriter_offset(w);
+
+	return !w->overflow;
+}
+
+/*
+ * load as many whole bytes as fit in the accumulator of a bit reader
+ *
+ * @param r				the bit reader
+ *
+ */
+static void bitreader_refill(schc_bitreader_t* r) {
+	uint8_t bytes = (64 - r->acc_len) / 8;
+
+	if (!bytes) {
+		return;
+	}
+
+	if ((r->byte + 8) <= r->arr->len) {
+		uint64_t v = load_be64(r->arr->ptr + r->byte);
+		if (bytes < 8) {
+			v &= ~(UINT64_MAX >> (bytes * 8));
+		}
+		r->acc |= v >> r->acc_len;
+		r->acc_len += bytes * 8;
+		r->byte += bytes;
+	} else {
+		while (bytes-- && (r->byte < r->arr->len)) {
+			r->acc |= (uint64_t) r->arr->ptr[r->byte++] << (56 - r->acc_len);
+			r->acc_len += 8;
+		}
+	}
+}
+
+/**
+ * start reading bits from a bit array at its current offset
+ *
+ * bytes are loaded into a 64-bit accumulator a word at a time;
+ * bitreader_sync() stores the offset reached back into the bit array
+ *
+ * @param r				the bit reader
+ * @param arr			the bit array to read from, bounded by arr->len bytes
+ *
+ */
+void bitreader_init(schc_bitreader_t* r, schc_bitarray_t* arr) {
+	uint8_t shift = arr->offset % 8;
+
+	r->arr = arr;
+	r->acc = 0;
+	r->acc_len = 0;
+	r->byte = arr->offset / 8;
+	r->pos = arr->offset;
+	r->overflow = 0;
+
+	bitreader_refill(r);
+	if (r->acc_len < shift) {
+		r->overflow = 1;
+		r->acc = 0;
+		r->acc_len = 0;
+	} else {
+		r->acc <<= shift;
+		r->acc_len -= shift;
+	}
+}
+
+/**
+ * read a value from a bit reader
+ * bits beyond arr->len are read as 0 and flag an overflow
+ *
+ * @param r				the bit reader
+ * @param len			the number of bits to read (0 - 32)
+ *
+ * @return 	the bits, right aligned
+ *
+ */
+uint32_t bitreader_get_bits(schc_bitreader_t* r, uint8_t len) {
+	uint32_t value;
+
+	if (!len) {
+		return 0;
+	}
+
+	if (r->acc_len < len) {
+		bitreader_refill(r);
+	}
+
+	value = (uint32_t) (r->acc >> (64 - len));
+	r->acc <<= len;
+	if (r->acc_len < len) {
+		r->overflow = 1;
+		r->acc_len = 0;
+	} else {
+		r->acc_len -= len;
+	}
+	r->pos += len;
+
+	return value;
+}
+
+/**
+ * read a number of bits from a bit reader
+ * into an array at a certain position
+ * the bits are OR'ed into the destination, like copy_bits()
+ *
+ * @param r				the bit reader
+ * @param DST			the array to copy to
+ * @param dst_pos		which bit to start from
+ * @param len			the number of consecutive bits to copy
+ *
+ */
+void bitreader_get_array(schc_bitreader_t* r, uint8_t DST[], uint32_t dst_pos, uint32_t len) {
+	while (len) {
+		uint8_t n = (len > 32) ? 32 : len;
+		or_bits32(DST, dst_pos, bitreader_get_bits(r, n), n);
+		dst_pos += n; len -= n;
+	}
+}
+
 /**
- * shift a number of bits to the left
+ * get the bit offset a bit reader has reached in its array
+ *
+ * @param r				the bit reader
+ *
+ * @return 	the offset in bits
+ *
+ */
+uint32_t bitreader_offset(const schc_bitreader_t* r) {
+	return r->pos;
+}
+
+/**
+ * set the offset of the bit array to the bits consumed by a bit reader
+ *
+ * @param r				the bit reader
+ *
+ * @return 	1			all bits were read from within the array
+ * 			0			bits beyond arr->len were read
+ *
+ */
+uint8_t bitreader_sync(schc_bitreader_t* r) {
+	r->arr->offset = r->pos;
+
+	return !r->overflow;
+}
+
+/*
+ * read the byte at a position in an array of len bytes,
+ * bytes outside the array read as zero
+ *
+ */
+static inline uint8_t byte_or_zero(const uint8_t SRC[], int32_t i, uint16_t len) {
+	return ((i >= 0) && (i < len)) ? SRC[i] : 0;
+}
+
+/**
+ * shift a number of bits to the left, towards the first bit,
+ * in place and filled up with zeros
  *
  * @param 	SRC			the array to shift
- * @param	len			the length of the array
+ * @param	len			the length of the array in bytes
  * @param 	shift		the number of consecutive bits to shift
  *
  */
 void shift_bits_left(uint8_t SRC[], uint16_t len, uint32_t shift) {
-	uint32_t i = 0; uint32_t j = 0;
+	uint32_t i = 0;
 
-	uint8_t start = shift / 8;
+	if (shift >= BYTES_TO_BITS((uint32_t) len)) {
+		memset(SRC, 0, len);
+		return;
+	}
+
+	uint32_t start = shift / 8;
 	uint8_t rest = shift % 8;
+	uint32_t words = (len - start - (rest ? 1 : 0)) / 8; // words with all source bytes in the array
 
-	for(i = start; i < len; i++) {
-		uint8_t value = (SRC[i] << rest) | (SRC[i + 1] >> (8 - rest));
-		SRC[j] = value;
-		j++;
+	/* the source is always ahead of the destination,
+	 * so every word is read before it is overwritten */
+	for (; i < (words * 8); i += 8) {
+		uint64_t w = load_be64(SRC + i + start);
+		if (rest) {
+			w = (w << rest) | (SRC[i + start + 8] >> (8 - rest));
+		}
+		store_be64(SRC + i, w);
 	}
 
+	for (; i < len; i++) {
+		SRC[i] = (uint8_t) ((byte_or_zero(SRC, i + start, len) << rest)
+				| (byte_or_zero(SRC, i + start + 1, len) >> (8 - rest)));
+	}
 }
 
 /**
- * shift a number of bits to the right
+ * shift a number of bits to the right, towards the last bit,
+ * in place and filled up with zeros
  *
  * @param 	SRC			the array to shift
- * @param	len			the length of the array
+ * @param	len			the length of the array in bytes
  * @param 	shift		the number of consecutive bits to shift
  *
  */
 void shift_bits_right(uint8_t SRC[], uint16_t len, uint32_t shift) {
-	uint32_t i = 0;
+	int32_t i = len;
+
+	if (shift >= BYTES_TO_BITS((uint32_t) len)) {
+		memset(SRC, 0, len);
+		return;
+	}
 
-	uint8_t start = shift / 8;
+	int32_t start = shift / 8;
 	uint8_t rest = shift % 8;
-	uint8_t previous = 0;
+	int32_t first = start + (rest ? 1 : 0); // the first byte with all source bytes in the array
 
-	for(i = 0; i < len; i++) {
-		if(start <= i) {
-			previous = SRC[i - start];
+	/* work back from the end, the source is always behind the destination,
+	 * so every word is read before it is overwritten */
+	while ((i - 8) >= first) {
+		i -= 8;
+		uint64_t w = load_be64(SRC + i - start);
+		if (rest) {
+			w = (w >> rest) | ((uint64_t) SRC[i - start - 1] << (64 - rest));
 		}
-		uint8_t value = (previous << (8 - rest)) | SRC[i + start] >> rest;
-		SRC[i + start] = value;
+		store_be64(SRC + i, w);
+	}
+
+	while (i-- > 0) {
+		SRC[i] = (uint8_t) ((byte_or_zero(SRC, i - start, len) >> rest)
+				| (byte_or_zero(SRC, i - start - 1, len) << (8 - rest)));
 	}
 }
 
@@ -326,8 +894,11 @@ void shift_bits_right(uint8_t SRC[], uint16_t len, uint32_t shift) {
 void xor_bits(uint8_t DST[], uint8_t SRC1[], uint8_t SRC2[], uint32_t len) {
 	uint32_t i;
 
-	for(i = 0; i < len; i++) {
-		DST[i / 8] |= (SRC1[i / 8] & (128 >> (i % 8) )) ^ (SRC2[i / 8] & (128 >> (i % 8) ));
+	for(i = 0; i < (len / 8); i++) {
+		DST[i] |= SRC1[i] ^ SRC2[i];
+	}
+	if(len % 8) {
+		DST[i] |= (SRC1[i] ^ SRC2[i]) & (uint8_t) (0xFF << (8 - (len % 8)));
 	}
 }
 
@@ -343,8 +914,11 @@ void xor_bits(uint8_t DST[], uint8_t SRC1[], uint8_t SRC2[], uint32_t len) {
 void and_bits(uint8_t DST[], uint8_t SRC1[], uint8_t SRC2[], uint32_t len) {
 	uint32_t i;
 
-	for(i = 0; i < len; i++) {
-		DST[i / 8] |= (SRC1[i / 8] & (128 >> (i % 8) )) & (SRC2[i / 8] & (128 >> (i % 8) ));
+	for(i = 0; i < (len / 8); i++) {
+		DST[i] |= SRC1[i] & SRC2[i];
+	}
+	if(len % 8) {
+		DST[i] |= (SRC1[i] & SRC2[i]) & (uint8_t) (0xFF << (8 - (len % 8)));
 	}
 }
 
@@ -364,6 +938,273 @@ void print_bitmap(const uint8_t bitmap[], uint32_t length) {
 	DEBUG_PRINTF("\n"); // flush buffer
 }
 
+/*
+ * the number of leading zero bits in a non-zero word,
+ * which is the index of the first set bit in a bitmap word
+ *
+ */
+static inline uint8_t bitmap_word_clz(uint32_t x) {
+#if defined(__GNUC__) && (UINT_MAX >= 0xFFFFFFFF)
+	return (uint8_t) __builtin_clz(x);
+#else
+	uint8_t n = 0;
+	while (!(x & 0x80000000)) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * the number of set bits in a word
+ *
+ */
+static inline uint8_t bitmap_word_popcount(uint32_t x) {
+#if defined(__GNUC__) && (UINT_MAX >= 0xFFFFFFFF)
+	return (uint8_t) __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	return (uint8_t) ((x * 0x01010101) >> 24);
+#endif
+}
+
+/*
+ * the mask covering the first bits of a bitmap word
+ *
+ * @param bits			the number of bits, msb first (1 - 32)
+ *
+ */
+static inline uint32_t bitmap_word_mask(uint32_t bits) {
+	return (bits >= BITMAP_WORD_BITS) ? UINT32_MAX : ~(UINT32_MAX >> bits);
+}
+
+/*
+ * limit a number of bits to the size of a bitmap
+ *
+ */
+static inline uint32_t bitmap_len(uint32_t len) {
+	return (len > (BITMAP_SIZE_WORDS * BITMAP_WORD_BITS)) ?
+			(BITMAP_SIZE_WORDS * BITMAP_WORD_BITS) : len;
+}
+
+/**
+ * clear all bits in a bitmap
+ *
+ * @param bm			the bitmap
+ *
+ */
+void bitmap_clear(schc_bitmap_t* bm) {
+	uint8_t i;
+	for (i = 0; i < BITMAP_SIZE_WORDS; i++) {
+		bm->word[i] = 0;
+	}
+}
+
+/**
+ * set a single bit in a bitmap
+ *
+ * @param bm			the bitmap
+ * @param bit			the index of the bit, 0 being the first
+ *
+ */
+void bitmap_set(schc_bitmap_t* bm, uint32_t bit) {
+	if (bit < (BITMAP_SIZE_WORDS * BITMAP_WORD_BITS)) {
+		bm->word[bit / BITMAP_WORD_BITS] |= 0x80000000 >> (bit % BITMAP_WORD_BITS);
+	}
+}
+
+/**
+ * test a single bit in a bitmap
+ *
+ * @param bm			the bitmap
+ * @param bit			the index of the bit, 0 being the first
+ *
+ * @return 	1			the bit is set
+ * 			0			the bit is not set
+ *
+ */
+uint8_t bitmap_test(const schc_bitmap_t* bm, uint32_t bit) {
+	if (bit >= (BITMAP_SIZE_WORDS * BITMAP_WORD_BITS)) {
+		return 0;
+	}
+	return (bm->word[bit / BITMAP_WORD_BITS] >> (31 - (bit % BITMAP_WORD_BITS))) & 1;
+}
+
+/**
+ * check if the first bits of a bitmap are all set
+ *
+ * @param bm			the bitmap
+ * @param len			the number of bits to check
+ *
+ * @return 	1			all bits are set
+ * 			0			at least one bit is missing
+ *
+ */
+uint8_t bitmap_is_full(const schc_bitmap_t* bm, uint32_t len) {
+	uint32_t i;
+	len = bitmap_len(len);
+
+	for (i = 0; (i * BITMAP_WORD_BITS) < len; i++) {
+		uint32_t mask = bitmap_word_mask(len - (i * BITMAP_WORD_BITS));
+		if ((bm->word[i] & mask) != mask) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * check if the first bits of a bitmap are all cleared
+ *
+ * @param bm			the bitmap
+ * @param len			the number of bits to check
+ *
+ * @return 	1			no bit is set
+ * 			0			at least one bit is set
+ *
+ */
+uint8_t bitmap_is_empty(const schc_bitmap_t* bm, uint32_t len) {
+	uint32_t i;
+	len = bitmap_len(len);
+
+	for (i = 0; (i * BITMAP_WORD_BITS) < len; i++) {
+		if (bm->word[i] & bitmap_word_mask(len - (i * BITMAP_WORD_BITS))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * find the first set bit in a bitmap, starting from a certain bit
+ *
+ * @param bm			the bitmap
+ * @param start			the first bit to look at
+ * @param len			the number of bits in the bitmap
+ *
+ * @return 	bit			the index of the first set bit
+ * 			len			no bit is set from start on
+ *
+ */
+uint32_t bitmap_find_next(const schc_bitmap_t* bm, uint32_t start, uint32_t len) {
+	uint32_t i, bit;
+	len = bitmap_len(len);
+
+	for (i = start / BITMAP_WORD_BITS; (i * BITMAP_WORD_BITS) < len; i++) {
+		uint32_t word = bm->word[i];
+		if (i == (start / BITMAP_WORD_BITS)) {
+			word &= UINT32_MAX >> (start % BITMAP_WORD_BITS); // skip the bits before start
+		}
+		if (word) {
+			bit = (i * BITMAP_WORD_BITS) + bitmap_word_clz(word);
+			return (bit < len) ? bit : len;
+		}
+	}
+	return len;
+}
+
+/**
+ * count the set bits in a bitmap
+ *
+ * @param bm			the bitmap
+ * @param len			the number of bits to count
+ *
+ * @return 	count		the number of set bits
+ *
+ */
+uint32_t bitmap_count(const schc_bitmap_t* bm, uint32_t len) {
+	uint32_t i, count = 0;
+	len = bitmap_len(len);
+
+	for (i = 0; (i * BITMAP_WORD_BITS) < len; i++) {
+		count += bitmap_word_popcount(bm->word[i] & bitmap_word_mask(len - (i * BITMAP_WORD_BITS)));
+	}
+	return count;
+}
+
+/**
+ * logical XOR the first bits of two bitmaps,
+ * the bits following len are cleared in the destination
+ *
+ * @param dst			the bitmap to save the result in, can be one of the sources
+ * @param a				the first bitmap
+ * @param b				the second bitmap
+ * @param len			the number of bits to XOR
+ *
+ */
+void bitmap_xor(schc_bitmap_t* dst, const schc_bitmap_t* a, const schc_bitmap_t* b, uint32_t len) {
+	uint32_t i;
+	len = bitmap_len(len);
+
+	for (i = 0; i < BITMAP_SIZE_WORDS; i++) {
+		uint32_t mask = ((i * BITMAP_WORD_BITS) < len) ? bitmap_word_mask(len - (i * BITMAP_WORD_BITS)) : 0;
+		dst->word[i] = (a->word[i] ^ b->word[i]) & mask;
+	}
+}
+
+/**
+ * load a bitmap from a bit array,
+ * the bits following len are cleared
+ *
+ * @param bm			the bitmap to load
+ * @param SRC			the array to read from
+ * @param src_pos		the bit to start from in the array
+ * @param len			the number of bits to read
+ *
+ */
+void bitmap_read(schc_bitmap_t* bm, const uint8_t SRC[], uint32_t src_pos, uint32_t len) {
+	uint32_t i;
+	len = bitmap_len(len);
+
+	bitmap_clear(bm);
+	for (i = 0; (i * BITMAP_WORD_BITS) < len; i++) {
+		uint32_t n = len - (i * BITMAP_WORD_BITS);
+		if (n > BITMAP_WORD_BITS) {
+			n = BITMAP_WORD_BITS;
+		}
+		bm->word[i] = read_bits32(SRC, src_pos + (i * BITMAP_WORD_BITS), n) << (BITMAP_WORD_BITS - n);
+	}
+}
+
+/**
+ * add the first bits of a bitmap to a bit writer
+ *
+ * @param w				the bit writer
+ * @param bm			the bitmap
+ * @param len			the number of bits to write
+ *
+ */
+void bitwriter_put_bitmap(schc_bitwriter_t* w, const schc_bitmap_t* bm, uint32_t len) {
+	uint32_t i;
+	len = bitmap_len(len);
+
+	for (i = 0; (i * BITMAP_WORD_BITS) < len; i++) {
+		uint32_t n = len - (i * BITMAP_WORD_BITS);
+		if (n > BITMAP_WORD_BITS) {
+			n = BITMAP_WORD_BITS;
+		}
+		bitwriter_put_bits(w, bm->word[i] >> (BITMAP_WORD_BITS - n), n);
+	}
+}
+
+/**
+ * print a bitmap
+ *
+ * @param bm			the bitmap
+ * @param len			the number of bits to print
+ *
+ */
+void bitmap_print(const schc_bitmap_t* bm, uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		DEBUG_PRINTF("%d ", bitmap_test(bm, i));
+	}
+	DEBUG_PRINTF("\n"); // flush buffer
+}
+
 /**
  * get the number of bytes required to store this amount of bits
  *
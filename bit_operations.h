@@ -20,6 +20,34 @@ extern "C" {
 #define BYTES_TO_BITS(x)	(x * 8)
 #define BITS_TO_BYTES(x)	(((x) == 0) ? 0 : (((x) - 1) / 8 + 1)) // bytes required for a number of bits
 
+/* bit writer, buffers bits in a 64-bit accumulator */
+typedef struct schc_bitwriter_t {
+	schc_bitarray_t* arr;
+	uint64_t acc; // pending bits, msb first
+	uint8_t acc_len; // number of bits in acc
+	uint32_t byte; // the byte in arr where acc starts
+	uint8_t overflow;
+} schc_bitwriter_t;
+
+/* window bitmap in 32-bit words, bit 0 is the msb of the first word
+ * so the words hold the bitmap in the order it is sent */
+#define BITMAP_WORD_BITS	32
+#define BITMAP_SIZE_WORDS	((BYTES_TO_BITS(BITMAP_SIZE_BYTES) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+typedef struct schc_bitmap_t {
+	uint32_t word[BITMAP_SIZE_WORDS];
+} schc_bitmap_t;
+
+/* bit reader, loads bytes in a 64-bit accumulator */
+typedef struct schc_bitreader_t {
+	schc_bitarray_t* arr;
+	uint64_t acc; // loaded bits, msb first
+	uint8_t acc_len; // number of bits in acc
+	uint32_t byte; // the next byte to load from arr
+	uint32_t pos; // the bits consumed, in bits
+	uint8_t overflow;
+} schc_bitreader_t;
+
 void little_end_uint8_from_uint32 (uint8_t A[4], uint32_t u32);
 
 // sets bits at a certain position in a bit array
@@ -33,6 +61,8 @@ void clear_bits(uint8_t A[], uint32_t pos, uint32_t len);
 
 // copy bits to a certain position in a bit array from another array
 void copy_bits(uint8_t DST[], uint32_t dst_pos, const uint8_t SRC[], uint32_t src_pos, uint32_t len);
+// copy bits to a byte aligned position and sum the copied bytes as 16-bit words
+uint64_t copy_bits_chksum(uint8_t DST[], const uint8_t SRC[], uint32_t src_pos, uint32_t len, uint64_t sum);
 // void copy_bits_BIG_END(uint8_t DST[], uint32_t dst_pos, const uint8_t SRC[], uint32_t src_pos, uint32_t len);
 
 // compare two bit arrays
@@ -41,6 +71,21 @@ uint8_t compare_bits_aligned(const uint8_t SRC1[], uint16_t pos1, const uint8_t
 uint8_t compare_bit_sequence(const uint8_t SRC1[], uint16_t pos1, const uint8_t SRC2[], uint16_t pos2, uint32_t len);
 uint8_t compare_bits_little_endian(uint8_t SRC1[], uint8_t SRC2[], uint32_t len);
 
+// buffered bit writer
+void bitwriter_init(schc_bitwriter_t* w, schc_bitarray_t* arr);
+void bitwriter_put_bits(schc_bitwriter_t* w, uint32_t value, uint8_t len);
+void bitwriter_put_array(schc_bitwriter_t* w, const uint8_t SRC[], uint32_t src_pos, uint32_t len);
+void bitwriter_put_bytes(schc_bitwriter_t* w, const uint8_t SRC[], uint16_t len);
+uint32_t bitwriter_offset(const schc_bitwriter_t* w);
+uint8_t bitwriter_flush(schc_bitwriter_t* w);
+
+// buffered bit reader
+void bitreader_init(schc_bitreader_t* r, schc_bitarray_t* arr);
+uint32_t bitreader_get_bits(schc_bitreader_t* r, uint8_t len);
+void bitreader_get_array(schc_bitreader_t* r, uint8_t DST[], uint32_t dst_pos, uint32_t len);
+uint32_t bitreader_offset(const schc_bitreader_t* r);
+uint8_t bitreader_sync(schc_bitreader_t* r);
+
 // shift a number of bits to the left
 void shift_bits_left(uint8_t SRC[], uint16_t len, uint32_t shift);
 
@@ -56,6 +101,19 @@ void and_bits(uint8_t DST[], uint8_t SRC1[], uint8_t SRC2[], uint32_t len);
 // print an array of bits
 void print_bitmap(const uint8_t bitmap[], uint32_t length);
 
+// window bitmap operations, on the first len bits
+void bitmap_clear(schc_bitmap_t* bm);
+void bitmap_set(schc_bitmap_t* bm, uint32_t bit);
+uint8_t bitmap_test(const schc_bitmap_t* bm, uint32_t bit);
+uint8_t bitmap_is_full(const schc_bitmap_t* bm, uint32_t len);
+uint8_t bitmap_is_empty(const schc_bitmap_t* bm, uint32_t len);
+uint32_t bitmap_find_next(const schc_bitmap_t* bm, uint32_t start, uint32_t len);
+uint32_t bitmap_count(const schc_bitmap_t* bm, uint32_t len);
+void bitmap_xor(schc_bitmap_t* dst, const schc_bitmap_t* a, const schc_bitmap_t* b, uint32_t len);
+void bitmap_read(schc_bitmap_t* bm, const uint8_t SRC[], uint32_t src_pos, uint32_t len);
+void bitwriter_put_bitmap(schc_bitwriter_t* w, const schc_bitmap_t* bm, uint32_t len);
+void bitmap_print(const schc_bitmap_t* bm, uint32_t len);
+
 // get the ceiled length in bytes
 uint8_t get_number_of_bytes_from_bits(uint16_t number_of_bits);
 
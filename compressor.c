@@ -15,13 +15,15 @@
 
 #include "compressor.h"
 #include "bit_operations.h"
+#include "trace.h"
+#include "metrics.h"
 
 #if CLICK
 #include <click/config.h>
 #endif
 
-jsmn_parser json_parser;
-jsmntok_t json_token[JSON_TOKENS];
+/* the context of schc_compress() */
+static struct schc_compressor_context_t compressor_context;
 
 ////////////////////////////////////////////////////////////////////////////////////
 //                                LOCAL FUNCIONS                                  //
@@ -51,100 +53,6 @@ int8_t set_rule_id(struct schc_compression_rule_t* schc_rule, struct schc_device
 	return 1;
 }
 
-/*
- * Combine the different layers to find the SCHC rule entry
- *
- * @param 	ip_rule_id 		the rule id for the IP layer
- * @param 	udp_rule_id		the rule id for the UDP layer
- * @param 	coap_rule_id	the rule id for the CoAP layer
- * @param 	device			the device to find a rule for
- * @param 	mode			the mode for which a rule should be found
- *
- * @return 	schc_rule		the rule that was found
- * 			NULL			if no rule was found
- *
- */
-static struct schc_compression_rule_t* get_schc_rule_by_layer_ids(struct schc_layer_rule_t *ipv6_rule,
-		struct schc_layer_rule_t *udp_rule, struct schc_layer_rule_t *coap_rule, struct schc_device* device) {
-	int i;
-
-	uint8_t rule_mask;
-
-	/* the rule selection is independent from the compiler flags.
-	 * The decompressor's rules MUST match the one selected at the compressor side. */
-	uint8_t layer_mask = (ipv6_rule == NULL) ? 0x00 : 0x04;
-	if (layer_mask != 0x00) {
-		layer_mask |= (udp_rule == NULL) ? 0x00 : 0x02;
-		if (layer_mask & 0x02) {
-			layer_mask |= (coap_rule == NULL) ? 0x00 : 0x01;
-		}
-	}
-
-	if(layer_mask == 0x00) {
-		return NULL; /* all layers are set to NULL, return */
-	}
-
-	for (i = 0; i < device->compression_rule_count; i++) {
-		const struct schc_compression_rule_t* curr_rule = (*device->compression_context)[i];
-        rule_mask = 0x00;
-#if USE_IP6 == 1
-		if (curr_rule->ipv6_rule != NULL &&
-				curr_rule->ipv6_rule == (struct schc_ipv6_rule_t*) ipv6_rule) {
-			rule_mask |= 0x04;
-		}
-#endif
-#if USE_UDP == 1
-		if (curr_rule->udp_rule != NULL &&
-				curr_rule->udp_rule == (struct schc_udp_rule_t*) udp_rule) {
-			rule_mask |= 0x02;
-		}
-#endif
-#if USE_COAP == 1
-		if (curr_rule->coap_rule != NULL &&
-				curr_rule->coap_rule == (struct schc_coap_rule_t*) coap_rule) {
-			rule_mask |= 0x01;
-		}
-#endif
-		if (rule_mask == layer_mask) {
-			return (struct schc_compression_rule_t*) (curr_rule);
-		}
-	}
-
-	return NULL;
-}
-
-/*
- * Find a SCHC rule entry for a device
- *
- * @param 	rule_arr 		the rule id in uint8_t array
- * @param 	device			the device to find a rule for
- *
- * @return 	schc_rule		the rule that was found
- * 			NULL			if no rule was found
- *
- */
-static struct schc_compression_rule_t* get_compression_rule_by_rule_id(uint8_t* rule_arr, struct schc_device *device) {
-	int i;
-
-	if (device == NULL) {
-		DEBUG_PRINTF("get_schc_rule(): no device was found for this id \n");
-		return NULL;
-	}
-
-	for (i = 0; i < device->compression_rule_count; i++) {
-		struct schc_compression_rule_t* curr_rule = (struct schc_compression_rule_t*) (*device->compression_context)[i];
-		uint8_t curr_rule_pos = get_position_in_first_byte(curr_rule->rule_id_size_bits);
-		uint8_t rule_id[4] = { 0 };
-		little_end_uint8_from_uint32(rule_id, curr_rule->rule_id); /* copy the uint32_t to a uint8_t array */
-		if( compare_bits_aligned(rule_id, curr_rule_pos, rule_arr, 0, curr_rule->rule_id_size_bits)) {
-			DEBUG_PRINTF("get_compression_rule(): curr rule %p \n", (void*) curr_rule);
-			return curr_rule;
-		}
-	}
-
-	return NULL;
-}
-
 static int _addr_offset(const struct schc_field *field, direction DI)
 {
     if (USE_IP6 != 1 && USE_UDP != 1) {
@@ -184,53 +92,294 @@ static int _addr_offset(const struct schc_field *field, direction DI)
     return 0;
 }
 
-static void compress_action(schc_bitarray_t* dst, schc_bitarray_t* src,
-		const struct schc_field *field, direction DI) {
-	uint8_t j = 0;
-	uint8_t json_result;
-	uint8_t field_length = field->field_length;
-	uint32_t src_offset = src->offset + _addr_offset(field, DI);
+/*
+ * Get the byte in the header at which a field is matched
+ * the matching operator continues from this byte at (src_offset % 8)
+ *
+ * @param src_offset	the bit offset of the field in the header
+ *
+ * @return the byte to pass to the matching operator
+ */
+static uint8_t _mo_byte(uint32_t src_offset) {
+	uint8_t src_pos = 0;
 
-	switch (field->action) {
-	case NOTSENT: { // do nothing
+	if(src_offset >= 8)
+		src_pos = get_number_of_bytes_from_bits(src_offset);
+
+	return src_pos;
+}
+
+/*
+ * Read up to 32 bits at a position in an array, right aligned
+ */
+static uint32_t read_key32(const uint8_t* ptr, uint32_t pos, uint8_t len) {
+	const uint8_t* p = ptr + (pos / 8);
+	uint8_t shift = pos % 8;
+	uint8_t i, bytes = (shift + len + 7) / 8;
+	uint64_t value = 0;
+
+	for (i = 0; i < bytes; i++) {
+		value = (value << 8) | p[i];
 	}
-		break;
-	case VALUESENT: {
-		copy_bits(dst->ptr, dst->offset, src->ptr, src_offset, field_length);
-		dst->offset += field_length;
+
+	return (uint32_t) ((value >> ((bytes * 8) - shift - len)) & (UINT32_MAX >> (32 - len)));
+}
+
+#define MAX_KEY_LENGTH					64 // the longest value read_key() returns
+
+/*
+ * Read a field value of up to 64 bits at a position in an array, right aligned
+ */
+static uint64_t read_key(const uint8_t* ptr, uint32_t pos, uint8_t len) {
+	if (len > 32) {
+		return ((uint64_t) read_key32(ptr, pos, len - 32) << 32)
+				| read_key32(ptr, pos + len - 32, 32);
 	}
-		break;
-	case MAPPINGSENT: {
-		json_result = 0;
-
-		/*
-		jsmn_init(&json_parser); // reset the parser
-		json_result = jsmn_parse(&json_parser, field->target_value,
-				strlen(field->target_value), json_token,
-				sizeof(json_token) / sizeof(json_token[0]));
-		uint8_t match_counter = 0; */
-
-		/* if the output of the jsmn parser is 0, the array is formatted as a normal unsigned char array */
-		if (json_result == 0) { // formatted as a normal unsigned char array
-			uint8_t list_len = get_required_number_of_bits(
-					(field->MO_param_length - 1)); // start from index 0
-			for (j = 0; j < field->MO_param_length; j++) {
-				uint8_t ptr = j;
-				if (!(field_length % 8)) // only support byte aligned matchmap
-					ptr = j * get_number_of_bytes_from_bits(field_length); // for multiple byte entry
-
-				if(compare_bit_sequence(
-						src->ptr, src_offset, (uint8_t*) (field->target_value + ptr), 0, field_length)) {
-					uint8_t ind[1] = { j }; // room for 255 indices
-					uint8_t src_pos = get_position_in_first_byte(list_len);
-					copy_bits(dst->ptr, dst->offset, ind, src_pos, list_len);
-					dst->offset += list_len;
-					break; /* found the mapping index */
-				}
+	return read_key32(ptr, pos, len);
+}
+
+#if USE_COAP == 1
+/*
+ * The CoAP fields of a rule are laid out as the fixed header, the token,
+ * the values of the options and the payload marker, without the option headers.
+ * A view maps this layout onto the segments of the CoAP message,
+ * so the message is matched and compressed where it is.
+ */
+#define COAP_SEGMENTS					(COAP_FIELDS + 2) // the header with the token, the options and the payload marker
+#define COAP_WINDOW_LENGTH				33 // the bytes of the longest field, at any bit offset
+#define COAP_WINDOW_BITS				256
+
+struct coap_segment_t {
+	uint16_t start; /* the first byte in the layout of the rule */
+	uint16_t pos; /* the first byte in the message */
+	uint16_t len;
+};
+
+struct coap_view_t {
+	/* the offset and length of the CoAP header
+	 * ptr is NULL: the bytes are read with header_bytes() */
+	schc_bitarray_t arr;
+	const uint8_t* buf;
+	struct coap_segment_t segments[COAP_SEGMENTS];
+	uint8_t segment_count;
+	/* the bytes of a field that crosses segments */
+	uint8_t window[COAP_WINDOW_LENGTH];
+};
+
+/*
+ * Get the bytes at a position in the layout of a CoAP view,
+ * from the message if they are in one segment, or copied into the window
+ * The bytes of the layout past the last segment are 0
+ */
+static const uint8_t* coap_view_bytes(struct coap_view_t* view, uint32_t byte, uint16_t len) {
+	uint8_t i;
+	if (len > COAP_WINDOW_LENGTH) {
+		len = COAP_WINDOW_LENGTH;
+	}
+
+	for (i = 0; i < view->segment_count; i++) {
+		const struct coap_segment_t* segment = &view->segments[i];
+		if (byte >= segment->start && (byte + len) <= (uint32_t) (segment->start + segment->len)) {
+			return view->buf + segment->pos + (byte - segment->start);
+		}
+	}
+
+	memset(view->window, 0, len);
+	for (i = 0; i < view->segment_count; i++) {
+		const struct coap_segment_t* segment = &view->segments[i];
+		uint32_t first = (byte > segment->start) ? byte : segment->start;
+		uint32_t end = segment->start + segment->len;
+		if (end > byte + len) {
+			end = byte + len;
+		}
+		if (first < end) {
+			memcpy(view->window + (first - byte), view->buf + segment->pos + (first - segment->start),
+					end - first);
+		}
+	}
+
+	return view->window;
+}
+#endif
+
+/*
+ * Get the bytes of a header a field is read from
+ *
+ * @param src			the header, or the array of a CoAP view
+ * @param byte			the first byte to read
+ * @param len			the number of bytes read
+ *
+ * @return a pointer to the bytes
+ */
+static const uint8_t* header_bytes(schc_bitarray_t* src, uint32_t byte, uint16_t len) {
+#if USE_COAP == 1
+	if (src->ptr == NULL) {
+		return coap_view_bytes((struct coap_view_t*) src, byte, len);
+	}
+#else
+	(void) len;
+#endif
+
+	return src->ptr + byte;
+}
+
+/*
+ * Append bits of a header to the residue
+ */
+static void put_header_bits(schc_bitwriter_t* dst, schc_bitarray_t* src, uint32_t offset,
+		uint32_t len) {
+#if USE_COAP == 1
+	if (src->ptr == NULL) {
+		while (len) { // at most a window at a time
+			uint32_t n = (len > COAP_WINDOW_BITS) ? COAP_WINDOW_BITS : len;
+			bitwriter_put_array(dst, header_bytes(src, offset / 8, (offset % 8 + n + 7) / 8),
+					offset % 8, n);
+			offset += n;
+			len -= n;
+		}
+		return;
+	}
+#endif
+
+	bitwriter_put_array(dst, src->ptr, offset, len);
+}
+
+#if USE_MATCHMAP_INDEX == 1
+/*
+ * The match-map fields of the rules are compiled at init into a table
+ * of their target values, sorted by value, found by the address of the field.
+ * Matching records the index of the value it found,
+ * so compressing the field does not look for it again.
+ */
+#define MATCHMAP_NOT_COMPILED			-2
+
+struct matchmap_entry_t {
+	uint64_t value;
+	uint8_t index;
+};
+
+struct matchmap_t {
+	const struct schc_field* field;
+	/* the first value in matchmap_entries */
+	uint16_t entries;
+	uint8_t entry_count;
+};
+
+static struct matchmap_t matchmaps[MATCHMAP_FIELDS];
+static uint8_t matchmap_count;
+static uint8_t matchmap_slots[2 * MATCHMAP_FIELDS]; // position in matchmaps plus one, 0 if empty
+static struct matchmap_entry_t matchmap_entries[MATCHMAP_ENTRIES];
+static uint16_t matchmap_entry_count;
+
+static uint16_t matchmap_hash(const struct schc_field* field) {
+	return (uint16_t) ((((uintptr_t) field) >> 3) * 2654435761u % (2 * MATCHMAP_FIELDS));
+}
+
+/*
+ * Look up the index of a header value in the target values of a match-map field
+ *
+ * @param field			the match-map field
+ * @param value			the header value, as passed to mo_matchmap()
+ *
+ * @return the index of the first target value that is equal to the header value
+ *         -1 if no target value is equal
+ *         MATCHMAP_NOT_COMPILED if the field has no table
+ */
+static int16_t matchmap_index(const struct schc_field* field, const uint8_t* value) {
+	uint16_t slot;
+	for (slot = matchmap_hash(field); matchmap_slots[slot]; slot = (slot + 1) % (2 * MATCHMAP_FIELDS)) {
+		const struct matchmap_t* matchmap = &matchmaps[matchmap_slots[slot] - 1];
+		if (matchmap->field != field) {
+			continue;
+		}
+
+		const struct matchmap_entry_t* entries = &matchmap_entries[matchmap->entries];
+		uint64_t key = read_key(value, 0, field->field_length);
+		uint8_t lo = 0, hi = matchmap->entry_count;
+		while (lo < hi) { // the first entry with the value, which has the lowest index
+			uint8_t mid = (lo + hi) / 2;
+			if (entries[mid].value < key) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
 			}
+		}
+		if (lo < matchmap->entry_count && entries[lo].value == key) {
+			return entries[lo].index;
+		}
+		return -1;
+	}
 
-		} else {
-			// formatted as a JSON object
+	return MATCHMAP_NOT_COMPILED;
+}
+
+/*
+ * Get the index a match-map field was matched with,
+ * from the matches recorded in the context or from the table
+ */
+static int16_t matchmap_recall(struct schc_compressor_context_t* ctx,
+		const struct schc_field* field, const uint8_t* value) {
+	uint8_t i;
+	for (i = 0; i < ctx->matchmap_match_count; i++) {
+		if (ctx->matchmap_matches[i].field == field && ctx->matchmap_matches[i].value == value) {
+			return ctx->matchmap_matches[i].index;
+		}
+	}
+
+	return matchmap_index(field, value);
+}
+#endif
+
+/*
+ * Send the index of the target value a match-map field is equal to
+ */
+static void compress_mapping(__attribute__((unused)) struct schc_compressor_context_t* ctx,
+		schc_bitwriter_t* dst, const schc_bitarray_t* src, const struct schc_field *field,
+		uint32_t src_offset) {
+	uint8_t j = 0;
+	uint8_t json_result;
+	uint8_t field_length = field->field_length;
+	const uint8_t* value = header_bytes((schc_bitarray_t*) src, src_offset / 8,
+			(src_offset % 8 + field_length + 7) / 8);
+
+	json_result = 0;
+
+	/*
+	jsmn_init(&ctx->json_parser); // reset the parser
+	json_result = jsmn_parse(&ctx->json_parser, field->target_value,
+			strlen(field->target_value), ctx->json_token,
+			sizeof(ctx->json_token) / sizeof(ctx->json_token[0]));
+	uint8_t match_counter = 0; */
+
+	/* if the output of the jsmn parser is 0, the array is formatted as a normal unsigned char array */
+	if (json_result == 0) { // formatted as a normal unsigned char array
+		uint8_t list_len = get_required_number_of_bits(
+				(field->MO_param_length - 1)); // start from index 0
+#if USE_MATCHMAP_INDEX == 1
+		/* the index found while matching the field */
+		int16_t index = (src_offset % 8) ? MATCHMAP_NOT_COMPILED
+				: matchmap_recall(ctx, field, value);
+		if (index != MATCHMAP_NOT_COMPILED) {
+			if (index >= 0) {
+				bitwriter_put_bits(dst, (uint32_t) index, list_len);
+			}
+			return;
+		}
+#endif
+		for (j = 0; j < field->MO_param_length; j++) {
+			uint8_t ptr = j;
+			if (!(field_length % 8)) // only support byte aligned matchmap
+				ptr = j * get_number_of_bytes_from_bits(field_length); // for multiple byte entry
+
+			if(compare_bit_sequence(
+					value, src_offset % 8, (uint8_t*) (field->target_value + ptr), 0, field_length)) {
+				bitwriter_put_bits(dst, j, list_len); // room for 255 indices
+				break; /* found the mapping index */
+			}
+		}
+
+	} else {
+		// formatted as a JSON object
 //					j = 1; // the first token is the string received
 //					while (j < json_result) {
 //						uint8_t k = 0;
@@ -256,14 +405,29 @@ static void compress_action(schc_bitarray_t* dst, schc_bitarray_t* src,
 //						}
 //						j++;
 //					}
-		}
+	}
+}
+
+static void compress_action(struct schc_compressor_context_t* ctx, schc_bitwriter_t* dst,
+		schc_bitarray_t* src, const struct schc_field *field, direction DI) {
+	uint8_t field_length = field->field_length;
+	uint32_t src_offset = src->offset + _addr_offset(field, DI);
+
+	switch (field->action) {
+	case NOTSENT: { // do nothing
+	}
+		break;
+	case VALUESENT: {
+		put_header_bits(dst, src, src_offset, field_length);
+	}
+		break;
+	case MAPPINGSENT: {
+		compress_mapping(ctx, dst, src, field, src_offset);
 	}
 		break;
 	case LSB: {
 		uint16_t lsb_len = field->field_length - field->MO_param_length;
-		copy_bits(dst->ptr, dst->offset, (uint8_t*) (src->ptr),
-				field->MO_param_length + src_offset, lsb_len);
-		dst->offset += lsb_len;
+		put_header_bits(dst, src, field->MO_param_length + src_offset, lsb_len);
 	}
 		break;
 	case COMPLENGTH:
@@ -278,280 +442,1440 @@ static void compress_action(schc_bitarray_t* dst, schc_bitarray_t* src,
 	case APPIID: {
 		// ToDo
 	}
-		break;
+		break;
+	}
+	src->offset += field_length;
+}
+
+/*
+ * Rebuild a match-map field from the received index
+ */
+static void decompress_mapping(const struct schc_field *field, schc_bitreader_t* src,
+		schc_bitarray_t *dst, uint32_t dst_offset) {
+	uint8_t field_length = field->field_length; int8_t json_result = -1;
+
+	// parse the json string
+	json_result = 0; // todo
+			// jsmn_parse(&json_parser, field->target_value,
+			// strlen(field->target_value), json_token, sizeof(json_token) / sizeof(json_token[0]));
+
+	// if result is 0,
+	if (json_result == 0) { // formatted as a normal unsigned uint8_t array
+		uint32_t list_len = get_required_number_of_bits( (field->MO_param_length - 1) ); // start from index 0
+		uint8_t map_index[1] = { 0 }; /* variable to store the index */
+		map_index[0] = bitreader_get_bits(src, list_len); /* read the index from the received header */
+		if( ! (field_length % 8) ) // multiply with byte alligned field length
+			map_index[0] = map_index[0] * get_number_of_bytes_from_bits(field_length);
+
+		uint8_t target_value_offset = (field_length % 8);
+		if(target_value_offset)
+			target_value_offset = 8 - target_value_offset;
+
+		copy_bits(dst->ptr, dst_offset,
+				(uint8_t*) (field->target_value + map_index[0]),
+				target_value_offset, field_length);
+	}
+
+//		} else if(json_result > 0) {
+//			// JSON object, grab the value(s), starting from the received index
+//			mapping_index = mapping_index + 1; // first element in json token is total array, next are individual tokens
+//			uint8_t length = (json_token[mapping_index].end - json_token[mapping_index].start);
+//
+//			uint8_t k = 0;
+//			// store rule value in decompressed header
+//			for (j = json_token[mapping_index].start; j < json_token[mapping_index].end; j++) {
+//				schc_header[index + k] = field->target_value[j];
+//				k++;
+//			}
+//
+//			field_length = length;
+//		}
+//
+//		*header_offset = *header_offset + 1;
+}
+
+static void decompress_action(struct schc_field *field, schc_bitreader_t* src,
+		schc_bitarray_t *dst, direction DI)
+{
+	uint8_t field_length;
+	uint32_t dst_offset = dst->offset + _addr_offset(field, DI);
+
+	field_length = field->field_length;
+	switch (field->action) {
+	case NOTSENT: {
+		// use value stored in context
+		uint8_t src_pos = get_position_in_first_byte(field_length);
+		copy_bits(dst->ptr, dst_offset, field->target_value, src_pos, field_length);
+
+	} break;
+	case VALUESENT: {
+		// build from received value
+		bitreader_get_array(src, dst->ptr, dst_offset, field_length);
+	} break;
+	case MAPPINGSENT: {
+		decompress_mapping(field, src, dst, dst_offset);
+	} break;
+	case LSB: {
+		uint8_t msb_len = field->MO_param_length;
+		uint8_t lsb_len = field->field_length - msb_len;
+		// build partially from rule
+		copy_bits(dst->ptr, dst_offset, field->target_value, 0, msb_len);
+
+		// .. and from received value
+		bitreader_get_array(src, dst->ptr, dst_offset + msb_len, lsb_len);
+	} break;
+	case COMPLENGTH:
+	case COMPCHK: {
+		clear_bits(dst->ptr, dst_offset, field_length); // set to 0, to indicate that it will be calculated after decompression
+	} break;
+	case DEVIID: {
+//		if (!strcmp(field->field, "src iid")) {
+//
+//			schc_ipaddr_t node_ip;
+//			get_node_ip(node_ip);
+//
+//			unsigned char ip_addr[8] = {
+//					(node_ip[4] & 0xFF),
+//					(node_ip[4] & 0xFF00) >> 8,
+//					(node_ip[5] & 0xFF),
+//					(node_ip[5] & 0xFF00) >> 8,
+//					(node_ip[6] & 0xFF),
+//					(node_ip[6] & 0xFF00) >> 8,
+//					(node_ip[7] & 0xFF),
+//					(node_ip[7] & 0xFF00) >> 8,
+//			};
+//
+//			for (j = 0; j < field_length; j++) {
+//				schc_header[index + j] = ip_addr[j];
+//			}
+//		}
+	} break;
+	case APPIID: {
+		// build iid from L2 server address
+	} break;
+	}
+
+	dst->offset += field_length;
+}
+
+#if USE_RULE_PROGRAM == 1
+/*
+ * The layer rules are lowered at init into a program per direction.
+ * The fields of the other direction and the fields without residue are left out,
+ * the offset of each field in the header is computed once
+ * and consecutive residues are copied at once.
+ */
+#define RULE_PROGRAM_DIRECTIONS			2 // UP and DOWN
+
+typedef enum {
+	RULE_OP_COPY = 0, /* copy the bits between the header and the residue */
+	RULE_OP_MAP = 1, /* the index of the target value */
+	RULE_OP_FILL = 2, /* the target value (decompression) */
+	RULE_OP_ZERO = 3 /* computed after decompression */
+} rule_op_t;
+
+struct rule_instruction_t {
+	const struct schc_field* field; /* the target value */
+	int32_t offset; /* bit offset of the field from the start of the layer */
+	uint16_t length; /* number of bits */
+	uint8_t value_pos; /* first bit in the target value */
+	uint8_t op;
+};
+
+struct rule_program_t {
+	const struct schc_layer_rule_t* rule;
+	uint16_t compress; /* the first instruction to compress */
+	uint16_t compress_count;
+	uint16_t decompress; /* the first instruction to decompress */
+	uint16_t decompress_count;
+	uint32_t length; /* bits of the header the rule covers */
+};
+
+static struct rule_program_t rule_programs[RULE_PROGRAMS][RULE_PROGRAM_DIRECTIONS];
+static uint16_t rule_program_count;
+static uint16_t rule_program_slots[2 * RULE_PROGRAMS]; // position in rule_programs plus one, 0 if empty
+static struct rule_instruction_t rule_instructions[RULE_PROGRAM_INSTRUCTIONS];
+static uint16_t rule_instruction_count;
+
+static uint16_t rule_program_hash(const struct schc_layer_rule_t* rule) {
+	return (uint16_t) ((((uintptr_t) rule) >> 3) * 2654435761u % (2 * RULE_PROGRAMS));
+}
+
+/*
+ * Find the slot of a layer rule in rule_program_slots
+ *
+ * @return the slot holding the rule, or the empty slot to add it to
+ */
+static uint16_t rule_program_slot(const struct schc_layer_rule_t* rule) {
+	uint16_t slot;
+	for (slot = rule_program_hash(rule); rule_program_slots[slot]; slot = (slot + 1) % (2 * RULE_PROGRAMS)) {
+		if (rule_programs[rule_program_slots[slot] - 1][0].rule == rule) {
+			break;
+		}
+	}
+
+	return slot;
+}
+
+/*
+ * Get the program of a layer rule
+ *
+ * @return the program for the direction
+ *         NULL if the rule was not compiled
+ */
+static const struct rule_program_t* rule_program_find(const struct schc_layer_rule_t* rule,
+		direction DI) {
+	uint16_t slot = rule_program_slot(rule);
+	if (!rule_program_slots[slot]) {
+		return NULL;
+	}
+
+	return &rule_programs[rule_program_slots[slot] - 1][DI == DOWN];
+}
+
+/*
+ * Append an instruction to the program being compiled,
+ * joined to the previous one if it copies the bits right before
+ *
+ * @return 0 if there is no room for the instruction
+ */
+static uint8_t rule_program_emit(uint16_t first, rule_op_t op, const struct schc_field* field,
+		int32_t offset, uint16_t length, uint8_t value_pos) {
+	if (op != RULE_OP_MAP && !length) {
+		return 1;
+	}
+	if (rule_instruction_count > first) {
+		struct rule_instruction_t* last = &rule_instructions[rule_instruction_count - 1];
+		if ((op == RULE_OP_COPY || op == RULE_OP_ZERO) && last->op == op
+				&& (last->offset + last->length) == offset
+				&& (uint32_t) last->length + length <= UINT16_MAX) {
+			last->length += length;
+			return 1;
+		}
+	}
+	if (rule_instruction_count >= RULE_PROGRAM_INSTRUCTIONS) {
+		return 0;
+	}
+
+	struct rule_instruction_t* instruction = &rule_instructions[rule_instruction_count++];
+	instruction->field = field;
+	instruction->offset = offset;
+	instruction->length = length;
+	instruction->value_pos = value_pos;
+	instruction->op = (uint8_t) op;
+
+	return 1;
+}
+
+/*
+ * Lower the fields of a layer rule in one direction into
+ * the instructions compress_action() and decompress_action() would execute
+ *
+ * @return 0 if there is no room for the program
+ */
+static uint8_t rule_program_compile(struct rule_program_t* program,
+		const struct schc_layer_rule_t* rule, direction DI) {
+	uint8_t i;
+	uint32_t offset = 0;
+
+	program->rule = rule;
+	program->compress = rule_instruction_count;
+	for (i = 0; i < rule->length; i++) {
+		const struct schc_field* field = &rule->content[i];
+		if (field->dir != BI && field->dir != DI) {
+			continue;
+		}
+
+		int32_t field_offset = (int32_t) offset + _addr_offset(field, DI);
+		uint8_t ok = 1;
+		switch (field->action) {
+		case VALUESENT:
+			ok = rule_program_emit(program->compress, RULE_OP_COPY, field, field_offset,
+					field->field_length, 0);
+			break;
+		case MAPPINGSENT:
+			ok = rule_program_emit(program->compress, RULE_OP_MAP, field, field_offset, 0, 0);
+			break;
+		case LSB:
+			ok = rule_program_emit(program->compress, RULE_OP_COPY, field,
+					field_offset + field->MO_param_length,
+					(uint16_t) (field->field_length - field->MO_param_length), 0);
+			break;
+		default: // nothing is sent
+			break;
+		}
+		if (!ok) {
+			return 0;
+		}
+		offset += field->field_length;
+	}
+	program->compress_count = rule_instruction_count - program->compress;
+	program->length = offset;
+
+	offset = 0;
+	program->decompress = rule_instruction_count;
+	for (i = 0; i < rule->length; i++) {
+		const struct schc_field* field = &rule->content[i];
+		if (field->dir != BI && field->dir != DI) {
+			continue;
+		}
+
+		int32_t field_offset = (int32_t) offset + _addr_offset(field, DI);
+		uint8_t msb_len = field->MO_param_length;
+		uint8_t ok = 1;
+		switch (field->action) {
+		case NOTSENT:
+			ok = rule_program_emit(program->decompress, RULE_OP_FILL, field, field_offset,
+					field->field_length, get_position_in_first_byte(field->field_length));
+			break;
+		case VALUESENT:
+			ok = rule_program_emit(program->decompress, RULE_OP_COPY, field, field_offset,
+					field->field_length, 0);
+			break;
+		case MAPPINGSENT:
+			ok = rule_program_emit(program->decompress, RULE_OP_MAP, field, field_offset, 0, 0);
+			break;
+		case LSB:
+			ok = rule_program_emit(program->decompress, RULE_OP_FILL, field, field_offset,
+					msb_len, 0)
+					&& rule_program_emit(program->decompress, RULE_OP_COPY, field,
+							field_offset + msb_len, (uint8_t) (field->field_length - msb_len), 0);
+			break;
+		case COMPLENGTH:
+		case COMPCHK:
+			ok = rule_program_emit(program->decompress, RULE_OP_ZERO, field, field_offset,
+					field->field_length, 0);
+			break;
+		default: // DEVIID and APPIID are not rebuilt
+			break;
+		}
+		if (!ok) {
+			return 0;
+		}
+		offset += field->field_length;
+	}
+	program->decompress_count = rule_instruction_count - program->decompress;
+
+	return 1;
+}
+
+/*
+ * Compile a layer rule for both directions
+ * Rules that do not fit are compressed field by field
+ */
+static void rule_program_add(const struct schc_layer_rule_t* rule) {
+	uint16_t slot = rule_program_slot(rule);
+	if (rule_program_slots[slot] || rule_program_count >= RULE_PROGRAMS) {
+		return; // compiled for another rule or no room
+	}
+
+	uint16_t first = rule_instruction_count;
+	if (!rule_program_compile(&rule_programs[rule_program_count][0], rule, UP)
+			|| !rule_program_compile(&rule_programs[rule_program_count][1], rule, DOWN)) {
+		rule_instruction_count = first;
+		return;
+	}
+	rule_program_slots[slot] = ++rule_program_count;
+}
+
+/*
+ * Run the compression program of a layer rule
+ */
+static void rule_program_compress(struct schc_compressor_context_t* ctx, schc_bitwriter_t* dst,
+		schc_bitarray_t* src, const struct rule_program_t* program) {
+	const struct rule_instruction_t* instruction = &rule_instructions[program->compress];
+	const struct rule_instruction_t* end = instruction + program->compress_count;
+
+	for (; instruction < end; instruction++) {
+		uint32_t src_offset = src->offset + instruction->offset;
+		if (instruction->op == RULE_OP_COPY) {
+			put_header_bits(dst, src, src_offset, instruction->length);
+		} else {
+			compress_mapping(ctx, dst, src, instruction->field, src_offset);
+		}
+	}
+	src->offset += program->length;
+}
+
+/*
+ * Run the decompression program of a layer rule
+ */
+static void rule_program_decompress(schc_bitreader_t* src, schc_bitarray_t* dst,
+		const struct rule_program_t* program) {
+	const struct rule_instruction_t* instruction = &rule_instructions[program->decompress];
+	const struct rule_instruction_t* end = instruction + program->decompress_count;
+
+	for (; instruction < end; instruction++) {
+		uint32_t dst_offset = dst->offset + instruction->offset;
+		switch (instruction->op) {
+		case RULE_OP_COPY:
+			bitreader_get_array(src, dst->ptr, dst_offset, instruction->length);
+			break;
+		case RULE_OP_MAP:
+			decompress_mapping(instruction->field, src, dst, dst_offset);
+			break;
+		case RULE_OP_FILL:
+			copy_bits(dst->ptr, dst_offset, instruction->field->target_value,
+					instruction->value_pos, instruction->length);
+			break;
+		case RULE_OP_ZERO:
+			clear_bits(dst->ptr, dst_offset, instruction->length);
+			break;
+		}
+	}
+	dst->offset += program->length;
+}
+#endif
+
+/**
+ * The compression mechanism
+ *
+ * @param ctx					the context the matches were recorded in
+ * @param dst	 				the bit writer to append the residue to
+ * @param src 					the original header
+ * @param rule 					the rule to match the compression with
+ *
+ * @return the length 			length of the compressed header
+ *
+ */
+static uint8_t compress(struct schc_compressor_context_t* ctx, schc_bitwriter_t* dst,
+		schc_bitarray_t* src, const struct schc_layer_rule_t *rule, direction DI) {
+	uint8_t i = 0;
+	if(rule == NULL) {
+		return 0;
+	}
+#if USE_RULE_PROGRAM == 1
+	const struct rule_program_t* program = rule_program_find(rule, DI);
+	if (program != NULL) {
+		rule_program_compress(ctx, dst, src, program);
+		return 1;
+	}
+#endif
+
+	for (i = 0; i < rule->length; i++) {
+		// exclude fields in other direction
+		if (((rule->content[i].dir) == BI) || ((rule->content[i].dir) == DI)) {
+			compress_action(ctx, dst, src, &rule->content[i], DI);
+		}
+	}
+	return 1;
+}
+
+/**
+ * The decompression mechanism
+ *
+ * @param rule 			pointer to the rule to use during the decompression
+ * @param src			the received SCHC bit buffer
+ * @param dst			the buffer to store the decompressed, original packet
+ *
+ * @return the length of the decompressed header
+ *
+ */
+static uint8_t decompress(struct schc_layer_rule_t* rule, schc_bitarray_t* src,
+		schc_bitarray_t* dst, direction DI) {
+	uint8_t i = 0;
+	schc_bitreader_t reader;
+
+	/* rule for layer can be set to NULL */
+	if(rule == NULL)
+		return 0;
+
+	bitreader_init(&reader, src);
+#if USE_RULE_PROGRAM == 1
+	const struct rule_program_t* program = rule_program_find(rule, DI);
+	if (program != NULL) {
+		rule_program_decompress(&reader, dst, program);
+		return bitreader_sync(&reader);
+	}
+#endif
+	for (i = 0; i < rule->length; i++) {
+		// exclude fields in other direction
+		if (((rule->content[i].dir) == BI) || ((rule->content[i].dir) == DI)) {
+			decompress_action(&rule->content[i], &reader, dst, DI);
+		}
+	}
+
+	return bitreader_sync(&reader);
+}
+
+static int _do_mo(struct schc_compressor_context_t* ctx, schc_bitarray_t *src,
+		uint32_t prev_offset, struct schc_field *field, direction DI) {
+    uint32_t src_offset = src->offset + _addr_offset(field, DI);
+	uint8_t src_pos = _mo_byte(src_offset);
+
+	if (src_pos > src->len) {
+		return 0;
+	}
+
+	/* the bits the matching operators read, from the byte at src_pos */
+	uint8_t first_bit = get_position_in_first_byte(field->field_length);
+	uint16_t bits = field->field_length;
+	if (first_bit < (src_offset % 8)) {
+		first_bit = src_offset % 8;
+	}
+	if (field->MO == &mo_MSB && field->MO_param_length > bits) {
+		bits = field->MO_param_length;
+	}
+	const uint8_t* field_value = header_bytes(src, src_pos, (first_bit + bits + 7) / 8);
+
+#if USE_MATCHMAP_INDEX == 1
+	if (field->MO == &mo_matchmap) {
+		int16_t index = matchmap_index(field, field_value);
+		if (index != MATCHMAP_NOT_COMPILED) {
+			if (index < 0) {
+				src->offset = prev_offset;
+				return 0;
+			}
+			if (ctx->matchmap_match_count < MATCHMAP_MATCHES) { // for compress_action()
+				ctx->matchmap_matches[ctx->matchmap_match_count].field = field;
+				ctx->matchmap_matches[ctx->matchmap_match_count].value = field_value;
+				ctx->matchmap_matches[ctx->matchmap_match_count].index = (uint8_t) index;
+				ctx->matchmap_match_count++;
+			}
+			src->offset += field->field_length;
+			return 1;
+		}
+	}
+#else
+	(void) ctx;
+#endif
+
+	if (field->MO(field,
+			(uint8_t*) field_value, (src_offset % 8))) { // compare header field and rule field using the matching operator
+		src->offset += field->field_length;
+		return 1;
+	} else {
+		src->offset = prev_offset; // reset offset
+		return 0;
+	}
+}
+
+#define SCHC_LAYERS						3 // see schc_layer_t
+#define LAYER_MATCH_CACHE				8 // layer rules remembered per layer while looking for a rule
+
+/*
+ * Get the rule for a single layer from a compression rule
+ *
+ * @param device		the device the rule belongs to
+ * @param index			the position of the compression rule in the device context
+ * @param layer			the layer to get the rule for
+ * @param max_fields	set to the maximum number of fields of this layer
+ *
+ * @return the rule for the layer
+ *         NULL if the compression rule has no rule for this layer
+ */
+static struct schc_layer_rule_t* get_layer_rule(struct schc_device *device, uint8_t index,
+		schc_layer_t layer, uint8_t *max_fields) {
+	struct schc_layer_rule_t* rule = NULL;
+	*max_fields = 0;
+#if USE_IP6 == 1
+	if(layer == SCHC_IPV6) {
+		*max_fields = IP6_FIELDS;
+		rule = (struct schc_layer_rule_t*) (*device->compression_context)[index]->ipv6_rule;
+	}
+#endif
+#if USE_UDP == 1
+	else if(layer == SCHC_UDP) {
+		*max_fields = UDP_FIELDS;
+		rule = (struct schc_layer_rule_t*) (*device->compression_context)[index]->udp_rule;
+	}
+#endif
+#if USE_COAP == 1
+	else if (layer == SCHC_COAP) {
+		*max_fields = COAP_FIELDS;
+		rule = (struct schc_layer_rule_t*) (*device->compression_context)[index]->coap_rule;
+	}
+#endif
+	return rule;
+}
+
+/*
+ * Match all fields of a layer rule, in the direction of the packet
+ *
+ * @param ctx			the context to record the matches in
+ * @param src			the header, the offset is moved past the layer if the rule matches
+ * @param prev_offset	the offset to restore if the rule does not match
+ * @param rule			the layer rule
+ * @param rule_id		the id of the compression rule, for debugging
+ * @param max_fields	the maximum number of fields of this layer
+ * @param DI			the direction
+ *
+ * @return 1 if all fields match
+ *         0 if a field does not match
+ *         -1 if the rule holds more fields than max_fields
+ */
+static int8_t match_layer_rule(struct schc_compressor_context_t* ctx,
+		schc_bitarray_t* src, uint32_t prev_offset,
+		struct schc_layer_rule_t* rule, uint32_t rule_id, uint8_t max_fields, direction DI) {
+	uint8_t j = 0; uint8_t k = 0;
+	uint8_t dir_length = (DI == UP) ? rule->up : rule->down;
+
+	while (j < dir_length) {
+		// exclude fields in other direction
+		if ((rule->content[k].dir == BI) || (rule->content[k].dir == DI)) {
+			if (!_do_mo(ctx, src, prev_offset, &rule->content[k], DI)) {
+				TRACE_DEBUG(TRACE_RULE_MISMATCH, rule_id, rule->content[k].field);
+				return 0;
+			}
+			j++;
+		}
+		k++; // increment to skip other directions
+		if(k > max_fields) { // todo coap <-> ipv6
+			DEBUG_PRINTF("schc_find_compression_rule(): more fields present than LAYER_FIELDS \n");
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+#if USE_MATCHMAP_INDEX == 1
+/*
+ * Compile a match-map field into a table of its target values
+ * Fields that do not fit, are longer than 64 bits or are not
+ * a whole number of bytes are matched value by value
+ */
+static void matchmap_add(const struct schc_field* field) {
+	uint8_t i, j;
+	uint16_t slot;
+
+	for (slot = matchmap_hash(field); matchmap_slots[slot]; slot = (slot + 1) % (2 * MATCHMAP_FIELDS)) {
+		if (matchmaps[matchmap_slots[slot] - 1].field == field) {
+			return; // shared by several rules
+		}
+	}
+	if (!field->field_length || field->field_length > MAX_KEY_LENGTH || (field->field_length % 8)
+			|| matchmap_count >= MATCHMAP_FIELDS
+			|| (matchmap_entry_count + field->MO_param_length) > MATCHMAP_ENTRIES) {
+		return;
+	}
+
+	struct matchmap_t* matchmap = &matchmaps[matchmap_count];
+	matchmap->field = field;
+	matchmap->entries = matchmap_entry_count;
+	matchmap->entry_count = field->MO_param_length;
+	struct matchmap_entry_t* entries = &matchmap_entries[matchmap->entries];
+
+	for (i = 0; i < field->MO_param_length; i++) { // the target values, as mo_matchmap() compares them
+		uint8_t ptr = i * get_number_of_bytes_from_bits(field->field_length);
+		struct matchmap_entry_t entry = { read_key(field->target_value + ptr, 0, field->field_length), i };
+		for (j = i; j > 0 && entries[j - 1].value > entry.value; j--) { // sorted by value, then index
+			entries[j] = entries[j - 1];
+		}
+		entries[j] = entry;
+	}
+
+	matchmap_entry_count += field->MO_param_length;
+	matchmap_slots[slot] = ++matchmap_count;
+}
+
+/*
+ * Compile the match-map fields of the compression rules of all devices,
+ * going over each rule context once
+ */
+static void matchmap_build(void) {
+	uint32_t d; uint8_t i, l, k, max_fields;
+
+	matchmap_count = 0;
+	matchmap_entry_count = 0;
+	memset(matchmap_slots, 0, sizeof(matchmap_slots));
+
+	for (d = 0; d < get_rule_context_count(); d++) {
+		struct schc_device* device = get_rule_context_by_index(d);
+		for (i = 0; i < device->compression_rule_count; i++) {
+			for (l = 0; l < SCHC_LAYERS; l++) {
+				const struct schc_layer_rule_t* rule = get_layer_rule(device, i, (schc_layer_t) l, &max_fields);
+				for (k = 0; rule != NULL && k < rule->length && k < max_fields; k++) {
+					if (rule->content[k].MO == &mo_matchmap) {
+						matchmap_add(&rule->content[k]);
+					}
+				}
+			}
+		}
+	}
+}
+#endif
+
+#if USE_RULE_PROGRAM == 1
+/*
+ * Compile the layer rules of the compression rules of all devices,
+ * going over each rule context once
+ */
+static void rule_program_build(void) {
+	uint32_t d; uint8_t i, l, max_fields;
+
+	rule_program_count = 0;
+	rule_instruction_count = 0;
+	memset(rule_program_slots, 0, sizeof(rule_program_slots));
+
+	for (d = 0; d < get_rule_context_count(); d++) {
+		struct schc_device* device = get_rule_context_by_index(d);
+		for (i = 0; i < device->compression_rule_count; i++) {
+			for (l = 0; l < SCHC_LAYERS; l++) {
+				const struct schc_layer_rule_t* rule = get_layer_rule(device, i, (schc_layer_t) l, &max_fields);
+				if (rule != NULL) {
+					rule_program_add(rule);
+				}
+			}
+		}
+	}
+}
+#endif
+
+#if USE_RULE_INDEX == 1
+/*
+ * The rule index is a decision tree per rule context, layer and direction,
+ * compiled from the rules at init and found by the rules of the device.
+ * An inner node tests a header field that some rules match with mo_equal,
+ * at the same position in the layer. The edges hold the values of these rules,
+ * rules without that field follow every edge and the fallback.
+ * A node holds the layer rules that can still match, each once,
+ * these are matched field by field, as without the index.
+ */
+#define RULE_INDEX_NONE					0xFFFF
+#define RULE_INDEX_DIRECTIONS			2 // UP and DOWN
+#define RULE_INDEX_DEPTH				8
+
+struct rule_index_node_t {
+	/* the position of the field in the layer, in bits */
+	int16_t offset;
+	/* the length of the field in bits, 0 for a leaf */
+	uint8_t length;
+	/* the number of values in rule_index_edges */
+	uint8_t edge_count;
+	/* the first value in rule_index_edges, sorted */
+	uint16_t edges;
+	/* the node to continue with if no edge holds the header value */
+	uint16_t fallback;
+	/* the first rule in rule_index_rules */
+	uint16_t rules;
+	/* the number of rules that can still match */
+	uint8_t rule_count;
+};
+
+struct rule_index_edge_t {
+	uint64_t value;
+	uint16_t node;
+};
+
+struct rule_index_t {
+	/* the compression rules of the devices this tree is used for */
+	const void* context;
+	uint8_t rule_count;
+	uint16_t root[SCHC_LAYERS][RULE_INDEX_DIRECTIONS];
+	/* the first and last position a field of the layer starts at, in bits */
+	int32_t first[SCHC_LAYERS][RULE_INDEX_DIRECTIONS];
+	int32_t last[SCHC_LAYERS][RULE_INDEX_DIRECTIONS];
+};
+
+static struct rule_index_t rule_index[RULE_INDEX_CONTEXTS];
+static uint16_t rule_index_count;
+/* the position of each rule index plus one, 0 if empty, at the hash of its context */
+static uint16_t rule_index_slots[2 * RULE_INDEX_CONTEXTS];
+static struct rule_index_node_t rule_index_nodes[RULE_INDEX_NODES];
+static uint16_t rule_index_node_count;
+static struct rule_index_edge_t rule_index_edges[RULE_INDEX_EDGES];
+static uint16_t rule_index_edge_count;
+static uint8_t rule_index_rules[RULE_INDEX_RULES]; // positions in the device context
+static uint16_t rule_index_rule_count;
+
+static uint16_t rule_index_hash(const struct schc_device* device) {
+	return (uint16_t) ((((uintptr_t) device->compression_context) >> 3) * 2654435761u
+			% (2 * RULE_INDEX_CONTEXTS));
+}
+
+/*
+ * Find the slot of the rule index of the rules of a device
+ *
+ * @return the slot, holding 0 if the rules have no rule index
+ */
+static uint16_t rule_index_slot(const struct schc_device* device) {
+	uint16_t slot;
+
+	for (slot = rule_index_hash(device); rule_index_slots[slot]; slot = (slot + 1) % (2 * RULE_INDEX_CONTEXTS)) {
+		const struct rule_index_t* index = &rule_index[rule_index_slots[slot] - 1];
+		if (index->context == (const void*) device->compression_context
+				&& index->rule_count == device->compression_rule_count) {
+			break;
+		}
+	}
+
+	return slot;
+}
+
+/*
+ * Find a field of a layer rule that is matched with mo_equal
+ * at a position in the layer
+ *
+ * @param rule			the layer rule
+ * @param DI			the direction
+ * @param n				the n-th suitable field of the rule, or -1 to look for offset and length
+ * @param offset		the position in bits, set to the position of the n-th field
+ * @param length		the length in bits, set to the length of the n-th field
+ * @param value			set to the target value of the field
+ *
+ * @return 1 if the field was found
+ *         0 otherwise
+ */
+static uint8_t rule_index_field(const struct schc_layer_rule_t* rule, direction DI, int16_t n,
+		int16_t *offset, uint8_t *length, uint64_t *value) {
+	uint8_t j = 0; uint8_t k = 0; int32_t pos = 0;
+	uint8_t dir_length = (DI == UP) ? rule->up : rule->down;
+
+	for (; j < dir_length; k++) {
+		const struct schc_field* field = &rule->content[k];
+		if ((field->dir != BI) && (field->dir != DI)) {
+			continue;
+		}
+		int32_t field_pos = pos + _addr_offset(field, DI);
+		if ((field->MO == &mo_equal) && (field->field_length > 0)
+				&& (field->field_length <= MAX_KEY_LENGTH)
+				&& (field_pos >= INT16_MIN) && (field_pos <= INT16_MAX)) {
+			if ((n < 0) ? ((field_pos == *offset) && (field->field_length == *length)) : (n-- == 0)) {
+				*offset = (int16_t) field_pos;
+				*length = field->field_length;
+				*value = read_key(field->target_value,
+						get_position_in_first_byte(field->field_length), field->field_length);
+				return 1;
+			}
+		}
+		pos += field->field_length;
+		j++;
+	}
+
+	return 0;
+}
+
+/*
+ * Widen first and last to the positions the fields of a layer rule start at
+ */
+static void rule_index_extent(const struct schc_layer_rule_t* rule, direction DI,
+		int32_t *first, int32_t *last) {
+	uint8_t j = 0; uint8_t k = 0; int32_t pos = 0;
+	uint8_t dir_length = (DI == UP) ? rule->up : rule->down;
+
+	for (; j < dir_length; k++) {
+		const struct schc_field* field = &rule->content[k];
+		if ((field->dir != BI) && (field->dir != DI)) {
+			continue;
+		}
+		int32_t field_pos = pos + _addr_offset(field, DI);
+		if (field_pos < *first) {
+			*first = field_pos;
+		}
+		if (field_pos > *last) {
+			*last = field_pos;
+		}
+		pos += field->field_length;
+		j++;
+	}
+}
+
+static struct rule_index_node_t* rule_index_new_node(void) {
+	if (rule_index_node_count >= RULE_INDEX_NODES) {
+		return NULL;
+	}
+	struct rule_index_node_t* node = &rule_index_nodes[rule_index_node_count++];
+	memset(node, 0, sizeof(struct rule_index_node_t));
+	node->fallback = RULE_INDEX_NONE;
+
+	return node;
+}
+
+/*
+ * Build a node for the rules at rule_index_rules[rules]
+ * and the nodes below, testing a field not tested by the nodes above
+ *
+ * @return the node
+ *         RULE_INDEX_NONE if the tree does not fit
+ */
+static uint16_t rule_index_build_node(struct schc_device *device, schc_layer_t layer,
+		direction DI, uint16_t rules, uint8_t rule_count, uint8_t depth, uint8_t max_depth,
+		int16_t used_offset[], uint8_t used_length[]) {
+	uint8_t i, j, max_fields;
+	struct rule_index_node_t* node = rule_index_new_node();
+	if (node == NULL) {
+		return RULE_INDEX_NONE;
+	}
+	uint16_t id = rule_index_node_count - 1;
+	node->rules = rules;
+	node->rule_count = rule_count;
+
+	if (rule_count <= 1 || depth >= max_depth) {
+		return id;
+	}
+
+	/* pick the field that leaves the fewest rules per branch on average:
+	 * (matched + (values + 1) * unmatched) / (values + 1) */
+	int16_t best_offset = 0; uint8_t best_length = 0;
+	uint32_t best_total = 0, best_branches = 1;
+	for (i = 0; i < rule_count; i++) {
+		const struct schc_layer_rule_t* rule = get_layer_rule(device,
+				rule_index_rules[rules + i], layer, &max_fields);
+		int16_t n = 0, offset; uint8_t length; uint64_t value;
+		while (rule_index_field(rule, DI, n++, &offset, &length, &value)) {
+			uint8_t used = 0, d;
+			for (d = 0; d < depth; d++) {
+				used |= (used_offset[d] == offset) && (used_length[d] == length);
+			}
+			if (used || (offset == best_offset && length == best_length)) {
+				continue;
+			}
+
+			uint32_t matched = 0, values = 0;
+			for (j = 0; j < rule_count; j++) {
+				const struct schc_layer_rule_t* other = get_layer_rule(device,
+						rule_index_rules[rules + j], layer, &max_fields);
+				int16_t o = offset; uint8_t l = length; uint64_t v;
+				if (rule_index_field(other, DI, -1, &o, &l, &v)) {
+					uint8_t k, seen = 0;
+					for (k = 0; k < j && !seen; k++) { // count distinct values
+						const struct schc_layer_rule_t* prev = get_layer_rule(device,
+								rule_index_rules[rules + k], layer, &max_fields);
+						int16_t po = offset; uint8_t pl = length; uint64_t pv;
+						seen = rule_index_field(prev, DI, -1, &po, &pl, &pv) && (pv == v);
+					}
+					values += !seen;
+					matched++;
+				}
+			}
+			uint32_t total = matched + ((values + 1) * (rule_count - matched));
+			if (!best_length || (total * best_branches) < (best_total * (values + 1))) {
+				best_offset = offset; best_length = length;
+				best_total = total; best_branches = values + 1;
+			}
+		}
+	}
+
+	/* a field that leaves most rules in each branch only copies them */
+	if (!best_length || (best_total * 4) > (rule_count * 3 * best_branches)) {
+		return id;
+	}
+
+	/* the edges, sorted by value */
+	uint8_t edge_count = (uint8_t) (best_branches - 1);
+	if ((rule_index_edge_count + edge_count) > RULE_INDEX_EDGES) {
+		return RULE_INDEX_NONE;
+	}
+	uint16_t edges = rule_index_edge_count;
+	rule_index_edge_count += edge_count;
+	uint8_t filled = 0;
+	for (i = 0; i < rule_count; i++) {
+		const struct schc_layer_rule_t* rule = get_layer_rule(device,
+				rule_index_rules[rules + i], layer, &max_fields);
+		int16_t o = best_offset; uint8_t l = best_length; uint64_t v;
+		if (rule_index_field(rule, DI, -1, &o, &l, &v)) {
+			for (j = 0; j < filled && rule_index_edges[edges + j].value < v; j++);
+			if (j < filled && rule_index_edges[edges + j].value == v) {
+				continue;
+			}
+			memmove(&rule_index_edges[edges + j + 1], &rule_index_edges[edges + j],
+					(filled - j) * sizeof(struct rule_index_edge_t));
+			rule_index_edges[edges + j].value = v;
+			filled++;
+		}
+	}
+
+	used_offset[depth] = best_offset;
+	used_length[depth] = best_length;
+
+	/* the rules for each value, followed by the rules for any other value */
+	for (j = 0; j <= edge_count; j++) {
+		uint16_t child_rules = rule_index_rule_count;
+		uint8_t child_count = 0;
+		for (i = 0; i < rule_count; i++) {
+			uint8_t index = rule_index_rules[rules + i];
+			const struct schc_layer_rule_t* rule = get_layer_rule(device, index, layer, &max_fields);
+			int16_t o = best_offset; uint8_t l = best_length; uint64_t v;
+			uint8_t has_field = rule_index_field(rule, DI, -1, &o, &l, &v);
+			if (!has_field || (j < edge_count && v == rule_index_edges[edges + j].value)) {
+				if (rule_index_rule_count >= RULE_INDEX_RULES) {
+					return RULE_INDEX_NONE;
+				}
+				rule_index_rules[rule_index_rule_count++] = index;
+				child_count++;
+			}
+		}
+		uint16_t child = rule_index_build_node(device, layer, DI, child_rules, child_count,
+				depth + 1, max_depth, used_offset, used_length);
+		if (child == RULE_INDEX_NONE) {
+			return RULE_INDEX_NONE;
+		}
+		if (j < edge_count) {
+			rule_index_edges[edges + j].node = child;
+		} else {
+			rule_index_nodes[id].fallback = child;
+		}
+	}
+
+	rule_index_nodes[id].offset = best_offset;
+	rule_index_nodes[id].length = best_length;
+	rule_index_nodes[id].edges = edges;
+	rule_index_nodes[id].edge_count = edge_count;
+
+	return id;
+}
+
+/*
+ * Build the decision tree for a layer of a device in one direction
+ *
+ * @return the root node
+ *         RULE_INDEX_NONE if the rules are matched one by one
+ */
+static uint16_t rule_index_build_layer(struct schc_device *device, schc_layer_t layer,
+		direction DI, int32_t *first, int32_t *last) {
+	uint8_t i, j, max_fields;
+	uint16_t node_count = rule_index_node_count;
+	uint16_t edge_count = rule_index_edge_count;
+	uint16_t rules = rule_index_rule_count;
+	uint8_t rule_count = 0;
+	int16_t used_offset[RULE_INDEX_DEPTH];
+	uint8_t used_length[RULE_INDEX_DEPTH];
+
+	for (i = 0; i < device->compression_rule_count; i++) {
+		struct schc_layer_rule_t* rule = get_layer_rule(device, i, layer, &max_fields);
+		if (rule == NULL) {
+			continue;
+		}
+
+		uint8_t duplicate = 0;
+		for (j = 0; j < rule_count; j++) { // shared by several compression rules
+			uint8_t m;
+			duplicate |= (get_layer_rule(device, rule_index_rules[rules + j], layer, &m) == rule);
+		}
+		if (duplicate) {
+			continue;
+		}
+
+		/* the fields must be found within max_fields, like match_layer_rule() */
+		uint8_t k = 0, n = 0, overflow = 0;
+		uint8_t dir_length = (DI == UP) ? rule->up : rule->down;
+		while (n < dir_length && !overflow) {
+			if ((rule->content[k].dir == BI) || (rule->content[k].dir == DI)) {
+				n++;
+			}
+			overflow = (++k > max_fields);
+		}
+		if (overflow) { // never matches
+			continue;
+		}
+
+		rule_index_extent(rule, DI, first, last);
+
+		if (rule_index_rule_count >= RULE_INDEX_RULES) {
+			rule_index_rule_count = rules;
+			return RULE_INDEX_NONE;
+		}
+		rule_index_rules[rule_index_rule_count++] = i;
+		rule_count++;
+	}
+
+	/* a shallower tree if it does not fit */
+	uint8_t max_depth;
+	for (max_depth = RULE_INDEX_DEPTH; max_depth > 0; max_depth /= 2) {
+		uint16_t root = rule_index_build_node(device, layer, DI, rules, rule_count, 0,
+				max_depth, used_offset, used_length);
+		if (root != RULE_INDEX_NONE) {
+			return root;
+		}
+		rule_index_node_count = node_count; // free what was used
+		rule_index_edge_count = edge_count;
+		rule_index_rule_count = rules + rule_count;
 	}
-	src->offset += field_length;
+	rule_index_rule_count = rules;
+
+	return RULE_INDEX_NONE;
 }
 
-/**
- * The compression mechanism
- *
- * @param dst_arr	 			the bit array in which to copy the contents to
- * @param src_arr 				the original header
- * @param rule 					the rule to match the compression with
- *
- * @return the length 			length of the compressed header
- *
+/*
+ * Build the decision trees for the compression rules of all devices,
+ * going over each rule context once
  */
-static uint8_t compress(schc_bitarray_t* dst, schc_bitarray_t* src,
-		const struct schc_layer_rule_t *rule, direction DI) {
-	uint8_t i = 0;
-	if(rule == NULL) {
-		return 0;
-	}
-
-	for (i = 0; i < rule->length; i++) {
-		// exclude fields in other direction
-		if (((rule->content[i].dir) == BI) || ((rule->content[i].dir) == DI)) {
-			compress_action(dst, src, &rule->content[i], DI);
+static void rule_index_build(void) {
+	uint32_t i; uint8_t l; uint8_t d;
+
+	rule_index_count = 0;
+	rule_index_node_count = 0;
+	rule_index_edge_count = 0;
+	rule_index_rule_count = 0;
+	memset(rule_index_slots, 0, sizeof(rule_index_slots));
+
+	for (i = 0; i < get_rule_context_count() && rule_index_count < RULE_INDEX_CONTEXTS; i++) {
+		struct schc_device* device = get_rule_context_by_index(i);
+		uint16_t slot = rule_index_slot(device);
+		if (rule_index_slots[slot]) {
+			continue; // the rules of another device
+		}
+		struct rule_index_t* index = &rule_index[rule_index_count];
+		rule_index_slots[slot] = ++rule_index_count;
+		index->context = (const void*) device->compression_context;
+		index->rule_count = device->compression_rule_count;
+		for (l = 0; l < SCHC_LAYERS; l++) {
+			for (d = 0; d < RULE_INDEX_DIRECTIONS; d++) {
+				index->first[l][d] = 0;
+				index->last[l][d] = 0;
+				index->root[l][d] = rule_index_build_layer(device, (schc_layer_t) l, (direction) d,
+						&index->first[l][d], &index->last[l][d]);
+				if (index->root[l][d] == RULE_INDEX_NONE) {
+					DEBUG_PRINTF("rule_index_build(): device %02" PRIu64 " layer %d direction %d is matched rule by rule\n",
+							device->device_id, l, d);
+				}
+			}
 		}
 	}
-	return 1;
 }
 
-static void decompress_action(struct schc_field *field, schc_bitarray_t* src,
-		schc_bitarray_t *dst, direction DI)
-{
-	uint8_t field_length; int8_t json_result = -1;
-	uint32_t dst_offset = dst->offset + _addr_offset(field, DI);
+/*
+ * Walk the decision tree for a layer with the header fields
+ *
+ * @param src			the header, at the start of the layer
+ * @param device		the device to find a rule for
+ * @param layer			the layer to find a rule for
+ * @param DI			the direction
+ *
+ * @return the node with the rules that can match the header
+ *         NULL if the layer is not indexed
+ */
+static const struct rule_index_node_t* rule_index_lookup(schc_bitarray_t* src,
+		struct schc_device *device, schc_layer_t layer, direction DI) {
+	if ((DI != UP && DI != DOWN) || layer >= SCHC_LAYERS) {
+		return NULL;
+	}
+	uint16_t slot = rule_index_slot(device);
+	if (!rule_index_slots[slot]) {
+		return NULL;
+	}
+	const struct rule_index_t* index = &rule_index[rule_index_slots[slot] - 1];
+	uint16_t id = index->root[layer][DI];
+	if (id == RULE_INDEX_NONE) {
+		return NULL;
+	}
 
-	field_length = field->field_length;
-	switch (field->action) {
-	case NOTSENT: {
-		// use value stored in context
-		uint8_t src_pos = get_position_in_first_byte(field_length);
-		copy_bits(dst->ptr, dst_offset, field->target_value, src_pos, field_length);
+	/* only walk the tree if every field of the layer starts within the header,
+	 * where _do_mo() compares it, otherwise all rules are matched */
+	int64_t first = (int64_t) src->offset + index->first[layer][DI];
+	int64_t last = (int64_t) src->offset + index->last[layer][DI];
+	if (first < 0 || last > (UINT8_MAX * 8) || _mo_byte((uint32_t) last) > src->len) {
+		return NULL;
+	}
 
-	} break;
-	case VALUESENT: {
-		// build from received value
-		copy_bits(dst->ptr, dst_offset, src->ptr, src->offset, field_length);
-		src->offset += field_length;
-	} break;
-	case MAPPINGSENT: {
-		// reset the parser
-		jsmn_init(&json_parser);
+	const struct rule_index_node_t* node = &rule_index_nodes[id];
+	while (node->length) {
+		uint32_t src_offset = src->offset + node->offset;
+		uint8_t src_pos = _mo_byte(src_offset); // the byte _do_mo() compares at
+		uint32_t pos = (src_pos * 8) + (src_offset % 8);
+		if ((pos + node->length) > ((uint32_t) src->len * 8)) {
+			break; // match the rules of this node one by one
+		}
 
-		// parse the json string
-		json_result = 0; // todo
-				// jsmn_parse(&json_parser, field->target_value,
-				// strlen(field->target_value), json_token, sizeof(json_token) / sizeof(json_token[0]));
+		uint64_t value = read_key(header_bytes(src, pos / 8, (pos % 8 + node->length + 7) / 8),
+				pos % 8, node->length);
+		const struct rule_index_edge_t* edges = &rule_index_edges[node->edges];
+		uint8_t lo = 0, hi = node->edge_count;
+		while (lo < hi) { // binary search
+			uint8_t mid = (lo + hi) / 2;
+			if (edges[mid].value < value) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo < node->edge_count && edges[lo].value == value) {
+			node = &rule_index_nodes[edges[lo].node];
+		} else {
+			node = &rule_index_nodes[node->fallback];
+		}
+	}
 
-		// if result is 0,
-		if (json_result == 0) { // formatted as a normal unsigned uint8_t array
-			uint32_t list_len = get_required_number_of_bits( (field->MO_param_length - 1) ); // start from index 0
-			uint8_t src_pos = get_position_in_first_byte(list_len);
+	return node;
+}
+#endif
 
-			uint8_t map_index[1] = { 0 }; /* variable to store the index */
-			copy_bits((uint8_t*) (map_index), src_pos, src->ptr, src->offset, list_len); /* copy the index from the received header */
-			if( ! (field_length % 8) ) // multiply with byte alligned field length
-				map_index[0] = map_index[0] * get_number_of_bytes_from_bits(field_length);
+/*
+ * The result of matching a layer rule against a header,
+ * kept while looking for a compression rule,
+ * as layer rules are shared by several compression rules
+ */
+struct layer_match_t {
+	const struct schc_layer_rule_t* rule;
+	/* the offset the rule was matched from */
+	uint32_t start;
+	/* the offset after the fields of the rule */
+	uint32_t end;
+	uint8_t match;
+};
+
+struct layer_matcher_t {
+	/* the header, NULL if the layer is not present in the packet */
+	schc_bitarray_t* src;
+	schc_layer_t layer;
+	struct layer_match_t cache[LAYER_MATCH_CACHE];
+	uint8_t cached;
+#if USE_RULE_INDEX == 1
+	/* the layer rules that can match, from the rule index */
+	const struct rule_index_node_t* node;
+	uint32_t node_start;
+	uint8_t looked_up;
+#endif
+};
 
-			uint8_t target_value_offset = (field_length % 8);
-			if(target_value_offset)
-				target_value_offset = 8 - target_value_offset;
+/*
+ * Match a layer rule against the header of a layer
+ *
+ * @param ctx			the context to record the matches in
+ * @param matcher		the header and the rules matched so far
+ * @param device		the device the rule belongs to
+ * @param index			the position of the compression rule in the device context
+ * @param start			the offset of the layer in the header
+ * @param end			set to the offset after the layer
+ * @param DI			the direction
+ *
+ * @return 1 if the layer rule of the compression rule matches the header
+ *         0 otherwise
+ */
+static uint8_t match_layer(struct schc_compressor_context_t* ctx, struct layer_matcher_t* matcher,
+		struct schc_device *device, uint8_t index, uint32_t start, uint32_t *end, direction DI) {
+	uint8_t i, max_fields;
+	struct schc_layer_rule_t* rule = get_layer_rule(device, index, matcher->layer, &max_fields);
+	struct layer_match_t* cached;
+
+	for (i = 0; i < matcher->cached && i < LAYER_MATCH_CACHE; i++) {
+		cached = &matcher->cache[i];
+		if (cached->rule == rule && cached->start == start) {
+			*end = cached->end;
+			return cached->match;
+		}
+	}
 
-			copy_bits(dst->ptr, dst_offset,
-					(uint8_t*) (field->target_value + map_index[0]),
-					target_value_offset, field_length);
-			src->offset += list_len;
+	cached = &matcher->cache[matcher->cached++ % LAYER_MATCH_CACHE];
+	cached->rule = rule;
+	cached->start = start;
+	cached->end = start;
+	cached->match = 0;
+
+#if USE_RULE_INDEX == 1
+	if (!matcher->looked_up || matcher->node_start != start) {
+		matcher->src->offset = start;
+		matcher->node = rule_index_lookup(matcher->src, device, matcher->layer, DI);
+		matcher->node_start = start;
+		matcher->looked_up = 1;
+	}
+	if (matcher->node != NULL) { // the rules outside the node can not match
+		uint8_t candidate = 0, m;
+		for (i = 0; i < matcher->node->rule_count && !candidate; i++) {
+			candidate = (get_layer_rule(device, rule_index_rules[matcher->node->rules + i],
+					matcher->layer, &m) == rule);
+		}
+		if (!candidate) {
+			TRACE_DEBUG(TRACE_RULE_SKIPPED, (*device->compression_context)[index]->rule_id);
+			*end = start;
+			return 0;
 		}
+	}
+#endif
 
-//		} else if(json_result > 0) {
-//			// JSON object, grab the value(s), starting from the received index
-//			mapping_index = mapping_index + 1; // first element in json token is total array, next are individual tokens
-//			uint8_t length = (json_token[mapping_index].end - json_token[mapping_index].start);
-//
-//			uint8_t k = 0;
-//			// store rule value in decompressed header
-//			for (j = json_token[mapping_index].start; j < json_token[mapping_index].end; j++) {
-//				schc_header[index + k] = field->target_value[j];
-//				k++;
-//			}
-//
-//			field_length = length;
-//		}
-//
-//		*header_offset = *header_offset + 1;
+	matcher->src->offset = start;
+	cached->match = (match_layer_rule(ctx, matcher->src, start, rule,
+			(*device->compression_context)[index]->rule_id, max_fields, DI) == 1);
+	cached->end = matcher->src->offset;
+	matcher->src->offset = start;
 
-	} break;
-	case LSB: {
-		uint8_t msb_len = field->MO_param_length;
-		uint8_t lsb_len = field->field_length - msb_len;
-		// build partially from rule
-		copy_bits(dst->ptr, dst_offset, field->target_value, 0, msb_len);
+	*end = cached->end;
+	return cached->match;
+}
 
-		// .. and from received value
-		copy_bits(dst->ptr, dst_offset + msb_len, src->ptr, src->offset, lsb_len);
-		src->offset += lsb_len;
-	} break;
-	case COMPLENGTH:
-	case COMPCHK: {
-		clear_bits(dst->ptr, dst_offset, field_length); // set to 0, to indicate that it will be calculated after decompression
-	} break;
-	case DEVIID: {
-//		if (!strcmp(field->field, "src iid")) {
-//
-//			schc_ipaddr_t node_ip;
-//			get_node_ip(node_ip);
-//
-//			unsigned char ip_addr[8] = {
-//					(node_ip[4] & 0xFF),
-//					(node_ip[4] & 0xFF00) >> 8,
-//					(node_ip[5] & 0xFF),
-//					(node_ip[5] & 0xFF00) >> 8,
-//					(node_ip[6] & 0xFF),
-//					(node_ip[6] & 0xFF00) >> 8,
-//					(node_ip[7] & 0xFF),
-//					(node_ip[7] & 0xFF00) >> 8,
-//			};
-//
-//			for (j = 0; j < field_length; j++) {
-//				schc_header[index + j] = ip_addr[j];
-//			}
-//		}
-	} break;
-	case APPIID: {
-		// build iid from L2 server address
-	} break;
+#if USE_FLOW_CACHE == 1
+/*
+ * FNV-1a over a part of a header
+ */
+static uint32_t flow_cache_hash(uint32_t hash, const uint8_t* ptr, uint16_t len) {
+	uint16_t i;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ ptr[i]) * 16777619u;
 	}
 
-	dst->offset += field_length;
+	return hash;
 }
 
-/**
- * The decompression mechanism
- *
- * @param rule 			pointer to the rule to use during the decompression
- * @param src			the received SCHC bit buffer
- * @param dst			the buffer to store the decompressed, original packet
- *
- * @return the length of the decompressed header
- *
+/*
+ * Hash the header bytes that identify a flow:
+ * the IPv6 header without the payload length, the UDP ports
+ * and the first bytes of the CoAP header (version, type, token length and code)
  */
-static uint8_t decompress(struct schc_layer_rule_t* rule, schc_bitarray_t* src,
-		schc_bitarray_t* dst, direction DI) {
-	uint8_t i = 0;
-
-	/* rule for layer can be set to NULL */
-	if(rule == NULL)
-		return 0;
+static uint32_t flow_cache_key(const schc_bitarray_t* src, const schc_bitarray_t* coap_src,
+		uint8_t use_udp, direction DI) {
+	uint32_t hash = flow_cache_hash(2166136261u, (const uint8_t*) &DI, sizeof(DI));
+	uint16_t ip_len = 0;
+	uint8_t layers = (use_udp << 1) | (coap_src != NULL);
 
-	for (i = 0; i < rule->length; i++) {
-		// exclude fields in other direction
-		if (((rule->content[i].dir) == BI) || ((rule->content[i].dir) == DI)) {
-			decompress_action(&rule->content[i], src, dst, DI);
-		}
+	hash = flow_cache_hash(hash, &layers, 1);
+#if USE_IP6 == 1
+	if (src->len >= IP6_HLEN) {
+		hash = flow_cache_hash(hash, src->ptr, 4);
+		hash = flow_cache_hash(hash, src->ptr + 6, IP6_HLEN - 6);
+	}
+	ip_len = IP6_HLEN;
+#endif
+#if USE_UDP == 1
+	if (use_udp && src->len >= ip_len + 4) {
+		hash = flow_cache_hash(hash, src->ptr + ip_len, 4);
+	}
+#endif
+#if USE_COAP == 1
+	if (coap_src != NULL && coap_src->len >= 2) {
+		hash = flow_cache_hash(hash, header_bytes((schc_bitarray_t*) coap_src, 0, 2), 2);
 	}
+#endif
+	(void) ip_len;
 
-	return 1;
+	return hash;
 }
 
-static int _do_mo(schc_bitarray_t *src, uint32_t prev_offset, struct schc_field *field,
-				  direction DI) {
-    uint32_t src_offset = src->offset + _addr_offset(field, DI);
-	uint8_t src_pos = 0;
+static uint16_t flow_cache_slot(const struct schc_device* device, uint32_t key) {
+	return (uint16_t) ((key ^ (uint32_t) (((uintptr_t) device) >> 3) * 2654435761u) % FLOW_CACHE_SIZE);
+}
+#endif
 
-	if(src_offset >= 8)
-		src_pos = get_number_of_bytes_from_bits(src_offset);
-	if (src_pos > src->len) {
-		return 0;
-	}
-	if (field->MO(field,
-			(uint8_t*) (src->ptr + src_pos), (src_offset % 8))) { // compare header field and rule field using the matching operator
-		src->offset += field->field_length;
-		return 1;
-	} else {
-		src->offset = prev_offset; // reset offset
-		return 0;
+/*
+ * Match the layer rules of a compression rule against the layers of the packet
+ *
+ * @param ctx			the context to record the matches in
+ * @param matchers		the headers of the layers and the layer rules matched so far
+ * @param src			the IPv6 and UDP headers
+ * @param device		the device the rule belongs to
+ * @param index			the position of the compression rule in the device context
+ * @param prev_offset	the offset of the first layer in src
+ * @param DI			the direction
+ *
+ * @return 1 if the rule matches the packet
+ *         0 otherwise
+ */
+static uint8_t match_compression_rule(struct schc_compressor_context_t* ctx,
+		struct layer_matcher_t* matchers, schc_bitarray_t* src, struct schc_device *device,
+		uint8_t index, uint32_t prev_offset, direction DI) {
+	uint8_t l, max_fields;
+	uint32_t offset = prev_offset;
+	uint8_t match = 1;
+
+	for (l = 0; l < SCHC_LAYERS && match; l++) {
+		struct layer_matcher_t* matcher = &matchers[l];
+		uint8_t has_rule = (get_layer_rule(device, index, matcher->layer, &max_fields) != NULL);
+		if (matcher->src == NULL || !has_rule) {
+			match = (matcher->src == NULL && !has_rule); // the rule and the packet must agree
+			continue;
+		}
+		if (matcher->src != src) { // a separate header starts at its first bit
+			offset = matcher->src->offset;
+		}
+		match = match_layer(ctx, matcher, device, index, offset, &offset, DI);
 	}
+
+	return match;
 }
 
 /**
- * Find a matching rule for a layer
- *
- * @param schc_bitarray the bit array as received from the network
- * 						note: a conversion is required for CoAP to decode the options
+ * Find the compression rule for a packet
+ * The first rule of the context is returned that has a layer rule
+ * for each layer in the packet, and none for the other layers,
+ * where each layer rule matches the header of its layer.
+ * The layers are matched in order, the next layer starting
+ * where the fields of the previous layer rule end.
+ * With the flow cache, the rule found for the previous packet of the flow
+ * is returned if it still matches, even if an earlier rule matches too.
  *
+ * @param ctx			the context holding the flow cache
+ * @param src			the IPv6 and UDP headers
+ * @param coap_src		the CoAP header, as a view in the layout of the rules
+ * 						NULL if the packet has no CoAP header
+ * @param use_udp		1 if the packet has a UDP header
  * @param device		the device to find a rule for
- * @param schc_layer	the layer for which to find a rule for
+ * @param DI			the direction
  *
  * @return the rule
  *         NULL if no rule is found
  */
-static struct schc_layer_rule_t* schc_find_rule_from_header(
-		schc_bitarray_t* src, struct schc_device *device, schc_layer_t layer, direction DI) {
-	uint8_t i = 0;
-	// set to 0 when a rule doesn't match
-	uint8_t rule_is_found = 1; uint8_t max_layer_fields = 0; uint32_t prev_offset = src->offset;
-
-	for (i = 0; i < device->compression_rule_count; i++) {
-		struct schc_layer_rule_t* curr_rule = NULL;
+static struct schc_compression_rule_t* schc_find_compression_rule(
+		struct schc_compressor_context_t* ctx, schc_bitarray_t* src, schc_bitarray_t* coap_src,
+		uint8_t use_udp, struct schc_device *device, direction DI) {
+	uint8_t i, l;
+	struct layer_matcher_t matchers[SCHC_LAYERS];
+	uint32_t prev_offset = src->offset;
+	uint8_t present = 0;
+
+	memset(matchers, 0, sizeof(matchers));
+	for (l = 0; l < SCHC_LAYERS; l++) {
+		matchers[l].layer = (schc_layer_t) l;
+	}
 #if USE_IP6 == 1
-		if(layer == SCHC_IPV6) {
-			max_layer_fields = IP6_FIELDS;
-			curr_rule = (struct schc_layer_rule_t*) (*device->compression_context)[i]->ipv6_rule;
-		}
+	matchers[SCHC_IPV6].src = src;
+	present++;
 #endif
-#if USE_UDP == 1 
-		else if(layer == SCHC_UDP) {
-			max_layer_fields = UDP_FIELDS;
-			curr_rule = (struct schc_layer_rule_t*) (*device->compression_context)[i]->udp_rule;
-		}
+#if USE_UDP == 1
+	if (use_udp) {
+		matchers[SCHC_UDP].src = src;
+		present++;
+	}
 #endif
 #if USE_COAP == 1
-		else if (layer == SCHC_COAP) {
-			max_layer_fields = COAP_FIELDS;
-			curr_rule = (struct schc_layer_rule_t*) (*device->compression_context)[i]->coap_rule;
-		}
+	if (coap_src != NULL) {
+		matchers[SCHC_COAP].src = coap_src;
+		present++;
+	}
 #endif
+	if (!present) {
+		return NULL;
+	}
 
-		/* rule for layer can be set to NULL */
-		if(curr_rule == NULL) {
-			DEBUG_PRINTF("schc_find_rule_from_header(): skipped rule %02" PRIu32 ", layer set to NULL \n", (*device->compression_context)[i]->rule_id);
-			continue;
-		}
-
-		uint8_t j = 0; uint8_t k = 0;
-		uint8_t dir_length = (DI == UP) ? curr_rule->up : curr_rule->down;
+	struct schc_compression_rule_t* rule = NULL;
+#if USE_FLOW_CACHE == 1
+	uint32_t key = flow_cache_key(src, coap_src, use_udp, DI);
+	struct schc_flow_cache_entry_t* flow = &ctx->flow_cache[flow_cache_slot(device, key)];
+	if (flow->device == device && flow->key == key && flow->index < device->compression_rule_count
+			&& match_compression_rule(ctx, matchers, src, device, flow->index, prev_offset, DI)) {
+		TRACE_DEBUG(TRACE_FLOW_CACHE_HIT, (*device->compression_context)[flow->index]->rule_id);
+		METRIC_RULE(device, flow->index, 1);
+		ctx->flow_cache_hits++;
+		src->offset = prev_offset;
+		return (struct schc_compression_rule_t*) (*device->compression_context)[flow->index];
+	}
+	ctx->flow_cache_misses++;
+#endif
 
-		while (j < dir_length) {
-			// exclude fields in other direction
-			if ((curr_rule->content[k].dir == BI) || (curr_rule->content[k].dir == DI)) {
-				if (!(rule_is_found = _do_mo(src, prev_offset, &curr_rule->content[k], DI))) {
-					DEBUG_PRINTF(
-							"schc_find_rule_from_header(): skipped rule %02" PRIu32 ", %s does not match\n", (*device->compression_context)[i]->rule_id, schc_header_field_names[curr_rule->content[k].field]);
-					break;
-				}
-				j++;
-			}
-			k++; // increment to skip other directions
-			if(k > max_layer_fields) { // todo coap <-> ipv6
-				DEBUG_PRINTF("schc_find_rule_from_header(): more fields present than LAYER_FIELDS \n");
-				return NULL;
-			}
+	for (i = 0; i < device->compression_rule_count && rule == NULL; i++) {
+		if (match_compression_rule(ctx, matchers, src, device, i, prev_offset, DI)) {
+			rule = (struct schc_compression_rule_t*) (*device->compression_context)[i];
+			METRIC_RULE(device, i, 1);
+		} else {
+			METRIC_RULE(device, i, 0);
 		}
+	}
+	src->offset = prev_offset;
 
-		if (rule_is_found) {
-			return (struct schc_layer_rule_t*) (curr_rule);
-		}
+#if USE_FLOW_CACHE == 1
+	if (rule != NULL) {
+		flow->device = device;
+		flow->key = key;
+		flow->index = i - 1;
 	}
+#endif
 
-	return NULL;
+	return rule;
 }
 
 #if USE_COAP == 1
 /**
- * Generates an unsigned char array, based on the CoAP header provided
+ * Maps the CoAP header provided onto the layout the rules are matched with:
+ * the fixed header and the token, the option values and the payload marker
  *
- * @param header_fields the array to transfer the header to
- * @param dst			the destination array
+ * @param view			the view to initialize
+ * @param pdu			the CoAP message
  *
- * @return the length of the array, which represents the number of CoAP fields
+ * @return the number of CoAP header fields
+ *         0 if the message is not valid
  *
  */
-static uint8_t generate_coap_header_fields(pcoap_pdu *pdu, schc_bitarray_t* dst) {
-	uint8_t offset = 0;
+static uint8_t coap_view_init(struct coap_view_t* view, pcoap_pdu *pdu) {
+	uint16_t start = 0;
 
 	if (pcoap_validate_pkt(pdu) != CE_NONE) {
 		DEBUG_PRINTF("schc_find_coap_rule_from_header(): invalid CoAP packet\n");
@@ -559,33 +1883,42 @@ static uint8_t generate_coap_header_fields(pcoap_pdu *pdu, schc_bitarray_t* dst)
 	}
 
 	uint8_t field_length = 5; // the 5 first fields are always present (!= bytes)
-
-	memcpy((uint8_t*) (dst->ptr + offset), pdu->buf, 4);
-	offset += 4;
-
 	if (pcoap_get_tkl(pdu) > 0) {
-		uint8_t token[8];
-		pcoap_get_token(pdu, token);
-
-		memcpy((uint8_t*) (dst->ptr + offset), &token, pcoap_get_tkl(pdu));
-
-		field_length++; offset += pcoap_get_tkl(pdu);
+		field_length++;
 	}
 
+	view->arr.ptr = NULL;
+	view->arr.offset = 0;
+	view->buf = pdu->buf;
+	view->segments[0].start = 0;
+	view->segments[0].pos = 0;
+	view->segments[0].len = 4 + pcoap_get_tkl(pdu); // the token follows the header
+	view->segment_count = 1;
+	start = view->segments[0].len;
+
 	pcoap_option option;
 	option = pcoap_get_option(pdu, NULL); // get first option
 
 	while (option.num > 0) {
-		memcpy((uint8_t*) (dst->ptr + offset), option.val, option.len);
+		/* the options that do not fit are read as 0, their fields do not match */
+		if (option.len > 0 && view->segment_count < (COAP_SEGMENTS - 1)) {
+			struct coap_segment_t* segment = &view->segments[view->segment_count++];
+			segment->start = start;
+			segment->pos = (uint16_t) (option.val - pdu->buf);
+			segment->len = option.len;
+		}
 
-		offset += option.len;
+		start += option.len;
 		option = pcoap_get_option(pdu, &option); // get next option
 		field_length++;
 	}
 
 	pcoap_payload pl = pcoap_get_payload(pdu);
-	if (pl.len > 0) {
-		dst->ptr[offset] = 0xFF; // add payload marker
+	if (pl.len > 0) { // the payload marker
+		struct coap_segment_t* segment = &view->segments[view->segment_count++];
+		segment->start = start;
+		segment->pos = (uint16_t) (pl.val - pdu->buf) - 1;
+		segment->len = 1;
 		field_length++;
 	}
 
@@ -672,7 +2005,6 @@ static uint8_t decompress_coap_rule(struct schc_coap_rule_t* rule,
 uint8_t mo_equal(struct schc_field* target_field, unsigned char* field_value, uint16_t field_offset) {
 	uint8_t bit_pos = get_position_in_first_byte(target_field->field_length);
 
-	// todo no copy w/ compare_bit_sequence()
 	return compare_bits_aligned((uint8_t*) (target_field->target_value), bit_pos,
 			(uint8_t*) (field_value), field_offset, target_field->field_length);
 }
@@ -737,8 +2069,12 @@ uint8_t mo_matchmap(struct schc_field *target_field, unsigned char *field_value,
 		__attribute__((unused)) uint16_t field_offset) {
 	uint8_t i;
 
-	// reset the parser
-	jsmn_init(&json_parser);
+#if USE_MATCHMAP_INDEX == 1
+	int16_t index = matchmap_index(target_field, field_value);
+	if (index != MATCHMAP_NOT_COMPILED) {
+		return (index >= 0);
+	}
+#endif
 
 	uint8_t result;
 	result = 0;// jsmn_parse(&json_parser, target_field->target_value,
@@ -798,57 +2134,124 @@ uint8_t mo_matchmap(struct schc_field *target_field, unsigned char *field_value,
  *
  */
 uint8_t schc_compressor_init() {
-	jsmn_init(&json_parser);
+	schc_compressor_context_init(&compressor_context);
 	if(!rm_revise_rule_context()) {
 		return 0;
 	}
+	rm_build_tables();
+#if USE_MATCHMAP_INDEX == 1
+	matchmap_build();
+#endif
+#if USE_RULE_PROGRAM == 1
+	rule_program_build();
+#endif
+#if USE_RULE_INDEX == 1
+	rule_index_build();
+#endif
 
 	return 1;
 }
 
 /**
- * Compresses a CoAP/UDP/IP packet
+ * Initializes a compressor context
+ * Each thread that compresses packets with schc_compress_ctx() needs its own context,
+ * which can be initialized before or after schc_compressor_init()
+ *
+ * @param ctx			the context to initialize
+ */
+void schc_compressor_context_init(schc_compressor_context_t* ctx) {
+	memset(ctx, 0, sizeof(schc_compressor_context_t));
+	jsmn_init(&ctx->json_parser);
+}
+
+#if USE_FLOW_CACHE == 1
+/**
+ * Get the number of compressed packets for which the rule was found
+ * in the flow cache of a context, and the number for which all rules were searched
+ *
+ * @param ctx			the context of the flow cache
+ * @param stats			the counters to fill
+ */
+void schc_get_flow_cache_stats_ctx(schc_compressor_context_t* ctx, schc_flow_cache_stats_t* stats) {
+	stats->hits = ctx->flow_cache_hits;
+	stats->misses = ctx->flow_cache_misses;
+}
+
+/**
+ * Empty the flow cache of a context and reset its counters
+ *
+ * @param ctx			the context of the flow cache
+ */
+void schc_reset_flow_cache_ctx(schc_compressor_context_t* ctx) {
+	memset(ctx->flow_cache, 0, sizeof(ctx->flow_cache));
+	ctx->flow_cache_hits = 0;
+	ctx->flow_cache_misses = 0;
+}
+
+/**
+ * Get the flow cache counters of schc_compress()
+ *
+ * @param stats			the counters to fill
+ */
+void schc_get_flow_cache_stats(schc_flow_cache_stats_t* stats) {
+	schc_get_flow_cache_stats_ctx(&compressor_context, stats);
+}
+
+/**
+ * Empty the flow cache of schc_compress() and reset its counters
+ */
+void schc_reset_flow_cache() {
+	schc_reset_flow_cache_ctx(&compressor_context);
+}
+#endif
+
+/**
+ * Compresses a CoAP/UDP/IP packet with the default context
+ * See schc_compress_ctx()
+ */
+struct schc_compression_rule_t* schc_compress(uint8_t *data, uint16_t total_length,
+		schc_bitarray_t* dst, schc_device_id_t device_id, direction dir) {
+	return schc_compress_ctx(&compressor_context, data, total_length, dst, device_id, dir);
+}
+
+/* no SCHC packet was written to dst, see schc_compress_ctx() */
+static void compress_failed(schc_bitarray_t* dst) {
+	dst->offset = 0;
+	dst->padding = 0;
+	dst->len = 0;
+	dst->bit_len = 0;
+}
+
+/*
+ * Compresses a packet for a device
  *
- * @param 	data 			pointer to the original packet
- * @param 	total_length 	the length of the packet
- * @param 	dst				pointer to the bit array object, where the compressed packet will
- * 							be stored. Can later be passed to fragmenter
- * @param 	device_id		the device id to find a rule for
- * @param 	direction		the direction of the flow
- * 							UP: LPWAN to IPv6 or DOWN: IPv6 to LPWAN
+ * @param 	rule			set to the compression rule that was used to compress the packet
+ * 							NULL if the packet was sent uncompressed
+ * @param 	payload			NULL to copy the payload behind the compressed header,
+ * 							or set to the payload in data, which is not copied
  *
- * @return 	schc_rule		the compression rule that was used to compress the packet
- *         	NULL			otherwise
+ * @return 	1				the SCHC packet was written to dst
+ *         	0				otherwise
  */
-
-struct schc_compression_rule_t* schc_compress(uint8_t *data, uint16_t total_length,
-		schc_bitarray_t* dst, uint32_t device_id, direction dir) {
+static uint8_t compress_packet(schc_compressor_context_t* ctx, struct schc_device *device,
+		uint8_t *data, uint16_t total_length, schc_bitarray_t* dst, direction dir,
+		struct schc_compression_rule_t** rule, schc_iovec_t* payload) {
 	struct schc_compression_rule_t* schc_rule;
+	schc_bitwriter_t writer;
 	uint16_t coap_length = 0;
 
-	struct schc_device *device = get_device_by_id(device_id);
-	if (device == NULL) {
-		DEBUG_PRINTF(
-				"schc_compress(): no device was found for this id=%02" PRIu32 "\n", device_id);
-		return 0;
-	}
-
+	*rule = NULL;
 	memset(dst->ptr, 0, dst->len);
 	/* use bit array for comparison */
 	schc_bitarray_t src; src.ptr = data; src.offset = 0; src.len = total_length;
 	uint8_t icmp6_packet = 0; uint8_t use_udp = USE_UDP;
 
-	DEBUG_PRINTF("schc_compress(): \n");
+#if USE_MATCHMAP_INDEX == 1
+	ctx->matchmap_match_count = 0;
+#endif
 
-	/* look for a matching rule */
-	struct schc_layer_rule_t *ipv6_rule = NULL;
-	struct schc_layer_rule_t *udp_rule = NULL;
-	struct schc_layer_rule_t *coap_rule = NULL;
+	/* the layers in the packet */
 #if USE_IP6 == 1
-	ipv6_rule = schc_find_rule_from_header(&src, device, SCHC_IPV6, dir);
-	if(ipv6_rule != NULL) {
-		DEBUG_PRINTF("schc_compress(): IPv6 rule ptr=%p \n", (void*)ipv6_rule);
-	}
 	if(data[6] == 0x3A) { // icmpv6 packet
 		icmp6_packet = 1;
 		use_udp      = 0;
@@ -857,16 +2260,9 @@ struct schc_compression_rule_t* schc_compress(uint8_t *data, uint16_t total_leng
 		use_udp      = 0;
 	}
 #endif
-#if USE_UDP == 1
-		if(use_udp) {
-			udp_rule = schc_find_rule_from_header(&src, device, SCHC_UDP, dir);
-			if(udp_rule != NULL) {
-				DEBUG_PRINTF("schc_compress(): UDP rule ptr=%p \n", (void*)udp_rule);
-			}
-		}
-#endif
 #if USE_COAP == 1
-		schc_bitarray_t coap_src = { .ptr = 0 };
+		struct coap_view_t coap_view;
+		schc_bitarray_t* coap_src = NULL;
 		uint8_t* coap_ptr = NULL;
 		if (!icmp6_packet &&
 			(total_length >= (IP6_HLEN * USE_IP6) + (UDP_HLEN * use_udp))) {
@@ -878,72 +2274,96 @@ struct schc_compression_rule_t* schc_compress(uint8_t *data, uint16_t total_leng
 			/* check the buffer for determining the CoAP header length */
 			coap_length = pcoap_get_coap_offset(&coap_msg);
 
-			/* generate a bit array, matchable to the rule */
-			uint8_t coap_buffer[MAX_COAP_MSG_SIZE] = { 0 };
-			coap_src.ptr = coap_buffer; coap_src.offset = 0;
-			if (generate_coap_header_fields(&coap_msg, &coap_src) > 0) {
-				coap_src.len = coap_length;
-				coap_rule = schc_find_rule_from_header(&coap_src, device, SCHC_COAP, dir);
-				if(coap_rule != NULL) {
-					DEBUG_PRINTF("schc_compress(): CoAP rule ptr=%p \n", (void*)coap_rule);
-				}
-				/* reset the bit arrays offset and start compressing */
-				coap_src.offset = 0;
+			/* a view on the message, matchable to the rule */
+			if (coap_view_init(&coap_view, &coap_msg) > 0) {
+				coap_view.arr.len = coap_length;
+				coap_src = &coap_view.arr;
 			}
 			else {
 				coap_ptr = NULL;
-				coap_src.ptr = NULL;
 			}
 		}
 #endif
+
+	/* look for a matching rule */
+#if USE_COAP == 1
+	schc_rule = schc_find_compression_rule(ctx, &src, coap_src, use_udp, device, dir);
+#else
+	schc_rule = schc_find_compression_rule(ctx, &src, NULL, use_udp, device, dir);
+#endif
+
+	const struct schc_layer_rule_t *ipv6_rule = NULL;
+	const struct schc_layer_rule_t *udp_rule = NULL;
+	const struct schc_layer_rule_t *coap_rule = NULL;
+	if (schc_rule != NULL) {
+#if USE_IP6 == 1
+		ipv6_rule = (const struct schc_layer_rule_t*) schc_rule->ipv6_rule;
+#endif
+#if USE_UDP == 1
+		udp_rule = (const struct schc_layer_rule_t*) schc_rule->udp_rule;
+#endif
+#if USE_COAP == 1
+		coap_rule = (const struct schc_layer_rule_t*) schc_rule->coap_rule;
+#endif
+	}
+
 	/* reset the offset and start compressing */
 	src.offset = 0;
+#if USE_COAP == 1
+	if (coap_src != NULL) {
+		coap_src->offset = 0;
+	}
+#endif
 
-	schc_rule = get_schc_rule_by_layer_ids(ipv6_rule, udp_rule, coap_rule, device);
-
+	uint8_t rule_id_size_bits = (schc_rule != NULL) ? schc_rule->rule_id_size_bits
+			: device->uncomp_rule_id_size_bits;
+	if (BITS_TO_BYTES(rule_id_size_bits) > dst->len) {
+		TRACE_ERROR(TRACE_COMPRESS_OVERFLOW, dst->len);
+		compress_failed(dst);
+		return 0;
+	}
 	if (set_rule_id(schc_rule, device, dst->ptr) != 1) {
-		return NULL;
+		compress_failed(dst);
+		return 0;
 	}
 
 	if(schc_rule == NULL) {
-		DEBUG_PRINTF("schc_compress(): no rule was found \n");
 		/* if no rule was found and the use of a specific layer is set to 0,
 		 * we expect that headers from these layers are not present in the original packet
 		 */
 		dst->offset = device->uncomp_rule_id_size_bits;
+		bitwriter_init(&writer, dst);
 #if USE_IP6 == 1
-		copy_bits(dst->ptr, dst->offset, data, 0, BYTES_TO_BITS(IP6_HLEN));
-		dst->offset += BYTES_TO_BITS(IP6_HLEN);
+		bitwriter_put_bytes(&writer, data, IP6_HLEN);
 #endif
 		if(!icmp6_packet) {
 #if USE_UDP == 1
 			if (use_udp) {
-				copy_bits(dst->ptr, dst->offset, data, BYTES_TO_BITS(IP6_HLEN), BYTES_TO_BITS(UDP_HLEN));
-				dst->offset += BYTES_TO_BITS(UDP_HLEN);
+				bitwriter_put_bytes(&writer, (data + IP6_HLEN), UDP_HLEN);
 			}
 #endif
 #if USE_COAP == 1
 			if (coap_ptr) {
-				copy_bits(dst->ptr, dst->offset, coap_ptr, 0, BYTES_TO_BITS(coap_length));
-				dst->offset += BYTES_TO_BITS(coap_length);
+				bitwriter_put_bytes(&writer, coap_ptr, coap_length);
 			}
 #endif
 		}
 	}
 	else { /* a rule was found - compress */
 		dst->offset = schc_rule->rule_id_size_bits;
+		bitwriter_init(&writer, dst);
 #if USE_IP6 == 1
-		compress(dst, &src, (const struct schc_layer_rule_t*) ipv6_rule, dir);
+		compress(ctx, &writer, &src, ipv6_rule, dir);
 #endif
 		if(!icmp6_packet) {
 #if USE_UDP == 1
 			if (use_udp) {
-				compress(dst, &src, (const struct schc_layer_rule_t*) udp_rule, dir);
+				compress(ctx, &writer, &src, udp_rule, dir);
 			}
 #endif
 #if USE_COAP == 1
-			if (coap_src.ptr) {
-				compress(dst, &coap_src, (const struct schc_layer_rule_t*) coap_rule, dir);
+			if (coap_src != NULL) {
+				compress(ctx, &writer, coap_src, coap_rule, dir);
 			}
 #endif
 		}
@@ -955,7 +2375,19 @@ struct schc_compression_rule_t* schc_compress(uint8_t *data, uint16_t total_leng
 	const uint8_t *payload_ptr = (data + (IP6_HLEN * USE_IP6)
 			+ (UDP_HLEN * use_udp) + coap_length);
 
-	copy_bits(dst->ptr, dst->offset, payload_ptr, 0, BYTES_TO_BITS(payload_len));
+	if (!bitwriter_flush(&writer) || (payload == NULL
+			&& BITS_TO_BYTES(dst->offset + BYTES_TO_BITS((uint32_t) payload_len)) > dst->len)) {
+		TRACE_ERROR(TRACE_COMPRESS_OVERFLOW, dst->len);
+		compress_failed(dst);
+		return 0;
+	}
+
+	if (payload != NULL) { // shifted by the fragmenter or sent as is, see schc_compress_detached()
+		payload->iov_base = (void*) payload_ptr;
+		payload->iov_len = payload_len;
+	} else {
+		copy_bits(dst->ptr, dst->offset, payload_ptr, 0, BYTES_TO_BITS(payload_len));
+	}
     uint16_t new_pkt_length = (BITS_TO_BYTES(dst->offset) + payload_len);
     /* set the padding of the compressed packet */
     dst->padding = padded(dst);
@@ -964,27 +2396,109 @@ struct schc_compression_rule_t* schc_compress(uint8_t *data, uint16_t total_leng
     dst->bit_len = BYTES_TO_BITS(payload_len) + dst->offset;
     uint16_t total_packet_len_bits = dst->bit_len + dst->padding;
 
-	DEBUG_PRINTF("\n");
-	DEBUG_PRINTF(
-			"schc_compress(): %d compressed header bits + %d payload bits + %d padding bits = %d bits (%dB)\n",
-			(int) dst->offset, BYTES_TO_BITS(payload_len), dst->padding, total_packet_len_bits, BITS_TO_BYTES(total_packet_len_bits));
-	DEBUG_PRINTF("+---------------------------------+\n");
-	DEBUG_PRINTF("|          SCHC Packet            |\n");
-	DEBUG_PRINTF("+---------------------------------+\n");
-
-	int i;
-	for(i = 0; i <  new_pkt_length; i++) {
-		DEBUG_PRINTF("%02X ", dst->ptr[i]);
-		if(!((i + 1) % 12)) {
-			DEBUG_PRINTF("\n");
-		}
+	METRIC_ADD(device, (schc_rule != NULL) ? SCHC_METRIC_COMPRESSED : SCHC_METRIC_UNCOMPRESSED, 1);
+	METRIC_ADD(device, SCHC_METRIC_BYTES_IN, total_length);
+	METRIC_ADD(device, SCHC_METRIC_BYTES_OUT, new_pkt_length);
+	METRIC_SIZE(device, new_pkt_length);
+	if (schc_rule != NULL) {
+		TRACE_INFO(TRACE_COMPRESS, device->device_id, schc_rule->rule_id, total_packet_len_bits,
+				BITS_TO_BYTES(total_packet_len_bits));
+	} else {
+		TRACE_INFO(TRACE_COMPRESS_UNCOMPRESSED, device->device_id, total_packet_len_bits,
+				BITS_TO_BYTES(total_packet_len_bits));
 	}
 
-	DEBUG_PRINTF("\n");
 	/* set the compressed packet length */
 	dst->len = new_pkt_length;
 
 	/* and return the schc rule */
+	*rule = schc_rule;
+	return 1;
+}
+
+/**
+ * Compresses a CoAP/UDP/IP packet
+ *
+ * @param 	ctx				the compressor context of the calling thread
+ * @param 	data 			pointer to the original packet
+ * @param 	total_length 	the length of the packet
+ * @param 	dst				pointer to the bit array object, where the compressed packet will
+ * 							be stored. Can later be passed to fragmenter
+ * 							dst->len is the size of dst->ptr and is set to the length
+ * 							of the compressed packet, or to 0 if it could not be compressed
+ * @param 	device_id		the device id to find a rule for
+ * @param 	direction		the direction of the flow
+ * 							UP: LPWAN to IPv6 or DOWN: IPv6 to LPWAN
+ *
+ * @return 	schc_rule		the compression rule that was used to compress the packet
+ *         	NULL			the packet was sent uncompressed, with the uncompressed rule id,
+ *         					or it could not be compressed, then dst->len is 0:
+ *         					the device was not found or the packet does not fit in dst
+ */
+struct schc_compression_rule_t* schc_compress_ctx(schc_compressor_context_t* ctx,
+		uint8_t *data, uint16_t total_length, schc_bitarray_t* dst,
+		schc_device_id_t device_id, direction dir) {
+	struct schc_compression_rule_t* schc_rule;
+
+	struct schc_device *device = get_device_by_id(device_id);
+	if (device == NULL) {
+		TRACE_ERROR(TRACE_COMPRESS_NO_DEVICE, device_id);
+		compress_failed(dst);
+		return NULL;
+	}
+
+	if (!compress_packet(ctx, device, data, total_length, dst, dir, &schc_rule, NULL)) {
+		return NULL;
+	}
+
+	TRACE_BYTES(TRACE_COMPRESSED_PACKET, dst->ptr, dst->len);
+
+	return schc_rule;
+}
+
+/**
+ * Compresses a CoAP/UDP/IP packet, but leaves the payload in the original packet
+ * Only the rule id and the compressed header are written to dst, the payload
+ * follows them at bit dst->offset. dst->len and dst->bit_len are the length of
+ * the complete SCHC packet, as for schc_compress_ctx().
+ * When dst->offset is a multiple of 8, the packet can be sent as the
+ * first dst->offset / 8 bytes of dst->ptr followed by the payload, without copying it.
+ * Otherwise pass the payload to the fragmenter in the payload of the connection,
+ * which shifts it into the fragments as they are sent.
+ * The original packet should be kept until the SCHC packet is sent.
+ *
+ * @param 	ctx				the compressor context of the calling thread
+ * @param 	data 			pointer to the original packet
+ * @param 	total_length 	the length of the packet
+ * @param 	dst				pointer to the bit array object, where the compressed header will
+ * 							be stored, dst->len is the size of dst->ptr
+ * @param 	payload			set to the payload in data
+ * @param 	device_id		the device id to find a rule for
+ * @param 	direction		the direction of the flow
+ * 							UP: LPWAN to IPv6 or DOWN: IPv6 to LPWAN
+ *
+ * @return 	schc_rule		the compression rule that was used to compress the packet
+ *         	NULL			the packet was sent uncompressed or, with dst->len set to 0,
+ *         					it could not be compressed, as for schc_compress_ctx()
+ */
+struct schc_compression_rule_t* schc_compress_detached(schc_compressor_context_t* ctx,
+		uint8_t *data, uint16_t total_length, schc_bitarray_t* dst, schc_iovec_t* payload,
+		schc_device_id_t device_id, direction dir) {
+	struct schc_compression_rule_t* schc_rule;
+
+	struct schc_device *device = get_device_by_id(device_id);
+	if (device == NULL) {
+		TRACE_ERROR(TRACE_COMPRESS_NO_DEVICE, device_id);
+		compress_failed(dst);
+		return NULL;
+	}
+
+	if (!compress_packet(ctx, device, data, total_length, dst, dir, &schc_rule, payload)) {
+		return NULL;
+	}
+
+	TRACE_BYTES(TRACE_COMPRESSED_PACKET, dst->ptr, BITS_TO_BYTES(dst->offset));
+
 	return schc_rule;
 }
 
@@ -1019,35 +2533,60 @@ static uint16_t compute_length(unsigned char *data, uint16_t data_len) {
 	return 0;
 }
 
-static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len) {
-	uint16_t t;
-	const uint8_t *dataptr;
-	const uint8_t *last_byte;
+/**
+ * fold a 64-bit one's complement sum to 16 bits
+ *
+ * @param sum			the running sum
+ *
+ * @return the 16-bit sum
+ *
+ */
+static uint16_t chksum_fold(uint64_t sum) {
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
 
-	dataptr = data;
-	last_byte = data + len - 1;
+	return (uint16_t) sum;
+}
 
-	while (dataptr < last_byte) { /* At least two more bytes */
-		t = (dataptr[0] << 8) + dataptr[1];
-		sum += t;
-		if (sum < t) {
-			sum++; /* carry */
-		}
-		dataptr += 2;
+/**
+ * add data to a one's complement sum, as big endian 16-bit words
+ * the sum is accumulated in 64 bits, 16 bytes at a time, and folded once
+ *
+ * @param sum			the 16-bit sum to start from
+ * @param data			the data to add
+ * @param len			the number of bytes, an odd last byte is zero padded
+ *
+ * @return the 16-bit sum in host byte order
+ *
+ */
+static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len) {
+	uint64_t acc = sum;
+
+	while (len >= 16) {
+		acc += (uint64_t) (((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3])
+			+ (((uint32_t) data[4] << 24) | ((uint32_t) data[5] << 16) | ((uint32_t) data[6] << 8) | data[7])
+			+ (((uint32_t) data[8] << 24) | ((uint32_t) data[9] << 16) | ((uint32_t) data[10] << 8) | data[11])
+			+ (((uint32_t) data[12] << 24) | ((uint32_t) data[13] << 16) | ((uint32_t) data[14] << 8) | data[15]);
+		data += 16; len -= 16;
 	}
 
-	if (dataptr == last_byte) {
-		t = (dataptr[0] << 8) + 0;
-		sum += t;
-		if (sum < t) {
-			sum++; // carry
-		}
+	while (len >= 2) {
+		acc += ((uint32_t) data[0] << 8) | data[1];
+		data += 2; len -= 2;
+	}
+
+	if (len) {
+		acc += ((uint32_t) data[0] << 8);
 	}
 
 	// return sum in host byte order
-	return sum;
+	return chksum_fold(acc);
 }
 
+static uint16_t compute_checksum_with_payload(unsigned char *data, uint16_t header_len,
+		uint16_t payload_len, uint16_t payload_sum);
+
 /**
  * Calculates the UDP checksum and sets the appropriate header fields
  *
@@ -1057,6 +2596,23 @@ static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len) {
  *
  */
 uint16_t compute_checksum(unsigned char *data) {
+	return compute_checksum_with_payload(data, 0, 0, 0);
+}
+
+/**
+ * Calculates the UDP checksum and sets the appropriate header fields
+ * reusing the sum of the payload, as computed while copying it
+ *
+ * @param data 				pointer to the data packet
+ * @param header_len		the length of the headers in front of the payload
+ * @param payload_len		the length of the payload, 0 to sum the complete packet
+ * @param payload_sum		the 16-bit sum of the payload, as if it started at an even offset
+ *
+ * @return checksum the computed checksum
+ *
+ */
+static uint16_t compute_checksum_with_payload(unsigned char *data, uint16_t header_len,
+		uint16_t payload_len, uint16_t payload_sum) {
 	// if the checksum fields are set to 0
 	// the checksum must be calculated
 #if USE_UDP == 1
@@ -1072,8 +2628,17 @@ uint16_t compute_checksum(unsigned char *data) {
 			// sum IP source and destination
 			sum = chksum(sum, (uint8_t *)&data[8], 2 * sizeof(schc_ipaddr_t));
 
-			// sum upper layer headers and data
-			sum = chksum(sum, &data[IP6_HLEN], upper_layer_len);
+			if (payload_len && (header_len + payload_len) == (IP6_HLEN + upper_layer_len)) {
+				// sum upper layer headers, the payload sum is known
+				sum = chksum(sum, &data[IP6_HLEN], header_len - IP6_HLEN);
+				if ((header_len - IP6_HLEN) % 2) { // the payload starts in the low byte of a word
+					payload_sum = (uint16_t) ((payload_sum << 8) | (payload_sum >> 8));
+				}
+				sum = chksum_fold((uint32_t) sum + payload_sum);
+			} else {
+				// sum upper layer headers and data
+				sum = chksum(sum, &data[IP6_HLEN], upper_layer_len);
+			}
 
 			result = (~sum);
 
@@ -1088,54 +2653,25 @@ uint16_t compute_checksum(unsigned char *data) {
 	return 0;
 }
 
-/**
- * Construct the header from the layered set of rules
- *
- * @param 	bit_arr				pointer to the received data
- * @param 	buf	 				pointer where to save the decompressed packet
- * @param 	device_id 			the device its id
- * @param 	total_length 		the total length of the received data
- * @param 	direction			the direction of the flow (UP: LPWAN to IPv6, DOWN: IPv6 to LPWAN)
+/*
+ * Decompresses a packet of a device
+ * See schc_decompress()
  *
- * @return 	length 				length of the newly constructed packet
- * 			0 					the rule or device was not found
+ * With payload set, a byte aligned payload of a UDP packet is not copied to buf,
+ * payload is set to the payload in bit_arr instead. Otherwise its length is set to 0.
  */
-uint16_t schc_decompress(schc_bitarray_t* bit_arr, uint8_t *buf,
-		uint32_t device_id, uint16_t total_length, direction dir) {
-	struct schc_device *device = get_device_by_id(device_id);
-	if(device == NULL) {
-		DEBUG_PRINTF("schc_decompress(): No device found with id=%d\n", device_id);
-		return 0;
-	}
-
-	DEBUG_PRINTF("\n");
-	DEBUG_PRINTF("schc_decompress(): \n");
-
-	struct schc_compression_rule_t *rule = get_compression_rule_by_rule_id(bit_arr->ptr, device);
+static uint16_t decompress_packet(struct schc_device *device, schc_bitarray_t* bit_arr,
+		uint8_t *buf, uint16_t total_length, direction dir, schc_iovec_t* payload) {
+	struct schc_compression_rule_t *rule = get_compression_rule_by_rule_id(device, bit_arr->ptr);
 
 	if(rule != NULL) {
-#if USE_COAP == 1
-		if(rule->coap_rule != NULL) {
-			DEBUG_PRINTF("schc_decompress(): CoAP rule ptr=%p \n", (void*)rule->coap_rule);
-		}
-#endif
-#if USE_UDP == 1
-		if(rule->udp_rule != NULL) {
-			DEBUG_PRINTF("schc_decompress(): UDP rule ptr=%p \n", (void*)rule->udp_rule);
-		}
-#endif
-#if USE_IP6 == 1
-		if(rule->ipv6_rule != NULL) {
-			DEBUG_PRINTF("schc_decompress(): IPv6 rule ptr=%p \n", (void*)rule->ipv6_rule);
-		}
-#endif
 		/* indicate initial offset in the source array */
 		bit_arr->offset = rule->rule_id_size_bits;
 	} else {
 		/* indicate initial offset in the source array */
 		bit_arr->offset = device->uncomp_rule_id_size_bits;
-		DEBUG_PRINTF("no rule was found \n");
 	}
+	bit_arr->len = total_length; /* bound the residue reads to the received packet */
 
 	uint8_t ret = 0;
 	uint8_t coap_offset = 0;
@@ -1208,31 +2744,282 @@ uint16_t schc_decompress(schc_bitarray_t* bit_arr, uint8_t *buf,
 	bit_arr->padding = padded(bit_arr);
 	uint16_t payload_bit_length = BYTES_TO_BITS(total_length) - bit_arr->offset - bit_arr->padding; // the schc header minus the total length is the payload length
 
-	copy_bits(buf, BYTES_TO_BITS(new_header_length), bit_arr->ptr, bit_arr->offset, payload_bit_length);
 	uint16_t payload_length = get_number_of_bytes_from_bits(payload_bit_length);
+	if (payload != NULL) {
+		payload->iov_base = NULL;
+		payload->iov_len = 0;
+	}
+	if (new_header_length >= (IP6_HLEN + UDP_HLEN) && use_udp) {
+		uint16_t payload_sum;
+
+		/* set UDP and IPv6 length if the field is set to 0 */
+		compute_length(buf, (payload_length + new_header_length));
+
+		if (payload != NULL && !(bit_arr->offset % 8) && !(payload_bit_length % 8)
+				&& (((uint16_t) buf[44] << 8) | buf[45]) == (new_header_length + payload_length - IP6_HLEN)) {
+			/* the payload is byte aligned, refer to it in the received packet */
+			payload->iov_base = bit_arr->ptr + (bit_arr->offset / 8);
+			payload->iov_len = payload_length;
+			payload_sum = chksum(0, payload->iov_base, payload_length);
+		} else {
+			/* sum the payload while copying it, for the UDP checksum */
+			payload_sum = chksum_fold(copy_bits_chksum((buf + new_header_length),
+					bit_arr->ptr, bit_arr->offset, payload_bit_length, 0));
+		}
+
+		/* set UDP checksum if the field is set to 0 */
+		compute_checksum_with_payload(buf, new_header_length, payload_length, payload_sum);
+	} else {
+		copy_bits(buf, BYTES_TO_BITS(new_header_length), bit_arr->ptr, bit_arr->offset, payload_bit_length);
+
+		/* set UDP and IPv6 length and checksum if the field is set to 0 */
+		compute_length(buf, (payload_length + new_header_length));
+		compute_checksum(buf);
+	}
+
+	METRIC_ADD(device, SCHC_METRIC_DECOMPRESSED, 1);
+	TRACE_INFO(TRACE_DECOMPRESS, device->device_id, (rule != NULL) ? rule->rule_id : device->uncomp_rule_id,
+			new_header_length, payload_length);
+
+	return new_header_length + payload_length;
+}
+
+/**
+ * Construct the header from the layered set of rules
+ *
+ * @param 	bit_arr				pointer to the received data
+ * @param 	buf	 				pointer where to save the decompressed packet
+ * @param 	device_id 			the device its id
+ * @param 	total_length 		the total length of the received data
+ * @param 	direction			the direction of the flow (UP: LPWAN to IPv6, DOWN: IPv6 to LPWAN)
+ *
+ * @return 	length 				length of the newly constructed packet
+ * 			0 					the rule or device was not found
+ */
+uint16_t schc_decompress(schc_bitarray_t* bit_arr, uint8_t *buf,
+		schc_device_id_t device_id, uint16_t total_length, direction dir) {
+	struct schc_device *device = get_device_by_id(device_id);
+	if(device == NULL) {
+		TRACE_ERROR(TRACE_DECOMPRESS_NO_DEVICE, device_id);
+		return 0;
+	}
+
+	uint16_t length = decompress_packet(device, bit_arr, buf, total_length, dir, NULL);
+	if (length == 0) {
+		return 0;
+	}
 
-	/* set UDP and IPv6 length and checksum if the field is set to 0 */
-	compute_length(buf, (payload_length + new_header_length));
-	compute_checksum(buf);
+	TRACE_BYTES(TRACE_DECOMPRESSED_PACKET, buf, length);
 
-	DEBUG_PRINTF("schc_decompress(): header length: %d, payload length %d \n", new_header_length, payload_length);
+	return length;
+}
+
+/**
+ * Construct the header from the layered set of rules, as schc_decompress(),
+ * but leave the payload in the received data when it is byte aligned
+ * The packet can then be written with writev() without copying the payload.
+ *
+ * @param 	bit_arr				pointer to the received data, which iov can refer to
+ * @param 	buf	 				pointer where to save the headers, or the decompressed packet
+ * 								when the payload is not aligned, as large as for schc_decompress()
+ * @param 	iov					set to the parts of the decompressed packet
+ * @param 	device_id 			the device its id
+ * @param 	total_length 		the total length of the received data
+ * @param 	direction			the direction of the flow (UP: LPWAN to IPv6, DOWN: IPv6 to LPWAN)
+ *
+ * @return 	2					iov holds the headers in buf and the payload in bit_arr
+ * 			1					iov holds the decompressed packet, copied to buf
+ * 			0 					the rule or device was not found
+ */
+uint8_t schc_decompress_iov(schc_bitarray_t* bit_arr, uint8_t *buf, schc_iovec_t iov[2],
+		schc_device_id_t device_id, uint16_t total_length, direction dir) {
+	struct schc_device *device = get_device_by_id(device_id);
+	if(device == NULL) {
+		TRACE_ERROR(TRACE_DECOMPRESS_NO_DEVICE, device_id);
+		return 0;
+	}
+
+	uint16_t length = decompress_packet(device, bit_arr, buf, total_length, dir, &iov[1]);
+	if (length == 0) {
+		return 0;
+	}
+
+	iov[0].iov_base = buf;
+	iov[0].iov_len = length - iov[1].iov_len;
+	TRACE_BYTES(TRACE_DECOMPRESSED_PACKET, buf, iov[0].iov_len);
+	if (iov[1].iov_len == 0) {
+		return 1;
+	}
+	TRACE_BYTES(TRACE_DECOMPRESSED_PACKET, iov[1].iov_base, iov[1].iov_len);
 
-	DEBUG_PRINTF("\n");
-	DEBUG_PRINTF("+---------------------------------+\n");
-	DEBUG_PRINTF("|        Original Packet          |\n");
-	DEBUG_PRINTF("+---------------------------------+\n");
+	return 2;
+}
+
+#if defined(__GNUC__)
+#define BATCH_PREFETCH(addr)			__builtin_prefetch(addr)
+#else
+#define BATCH_PREFETCH(addr)
+#endif
 
-	int i;
-	for (i = 0; i < new_header_length + payload_length; i++) {
-		DEBUG_PRINTF("%02X ", buf[i]);
-		if (!((i + 1) % 12)) {
-			DEBUG_PRINTF("\n");
+/*
+ * Look up the devices of the packets of a batch, at most COMPRESS_BATCH_SIZE,
+ * and order the packets by device, each device once
+ * The packets of a device keep their order.
+ *
+ * @param packets		the packets
+ * @param count			the number of packets
+ * @param order			set to the positions of the packets, grouped by device
+ * @param devices		set to the device of each packet in order, NULL if it is not found
+ *
+ * @return the number of devices
+ */
+static uint16_t batch_group(schc_packet_t* packets, uint16_t count, uint16_t order[],
+		struct schc_device* devices[]) {
+	schc_device_id_t ids[COMPRESS_BATCH_SIZE];
+	struct schc_device* found[COMPRESS_BATCH_SIZE];
+	uint16_t start[COMPRESS_BATCH_SIZE];
+	uint16_t group[COMPRESS_BATCH_SIZE];
+	uint16_t i, g, groups = 0, last = 0;
+
+	for (i = 0; i < count; i++) {
+		g = last; // bursts usually hold several packets of a device in a row
+		if (groups == 0 || ids[g] != packets[i].device_id) {
+			for (g = 0; g < groups && ids[g] != packets[i].device_id; g++);
+			if (g == groups) {
+				ids[g] = packets[i].device_id;
+				prefetch_device_by_id(ids[g], 0);
+				start[g] = 0;
+				groups++;
+			}
 		}
+		group[i] = g;
+		start[g]++;
+		last = g;
 	}
 
-	DEBUG_PRINTF("\n\n");
+	/* the devices are looked up once their table slots and records are prefetched,
+	 * so the cache misses of the lookups overlap */
+	for (g = 0; g < groups; g++) {
+		prefetch_device_by_id(ids[g], 1);
+	}
+	for (g = 0; g < groups; g++) {
+		found[g] = get_device_by_id(ids[g]);
+	}
 
-	return new_header_length + payload_length;
+	uint16_t next = 0;
+	for (g = 0; g < groups; g++) { // the number of packets of each device to the first position
+		uint16_t packet_count = start[g];
+		start[g] = next;
+		next += packet_count;
+	}
+
+	for (i = 0; i < count; i++) {
+		uint16_t k = start[group[i]]++;
+		order[k] = i;
+		devices[k] = found[group[i]];
+	}
+
+	return groups;
+}
+
+/*
+ * Prefetch the packet to handle after the current one
+ * and the rules of its device, if the device differs
+ */
+static void batch_prefetch(schc_packet_t* packet, struct schc_device* device,
+		struct schc_device* prev_device) {
+	BATCH_PREFETCH(packet->data);
+	BATCH_PREFETCH(packet->bit_arr);
+	BATCH_PREFETCH(packet->bit_arr->ptr);
+	if (device != NULL && device != prev_device && device->compression_rule_count > 0) {
+		BATCH_PREFETCH(*device->compression_context);
+		BATCH_PREFETCH((*device->compression_context)[0]);
+	}
+}
+
+/**
+ * Compresses a batch of CoAP/UDP/IP packets
+ * The packets are grouped by device, so each device is looked up once
+ * and its rules stay in cache while its packets are compressed.
+ * The packets of a device are compressed in order.
+ *
+ * @param 	ctx				the compressor context of the calling thread
+ * @param 	packets			the packets, with data, length, bit_arr and device_id set
+ * 							rule and done are set for each packet
+ * @param 	count			the number of packets
+ * @param 	dir				the direction of the flow
+ * 							UP: LPWAN to IPv6 or DOWN: IPv6 to LPWAN
+ *
+ * @return 	the number of packets that were compressed
+ */
+uint16_t schc_compress_batch(schc_compressor_context_t* ctx, schc_packet_t* packets,
+		uint16_t count, direction dir) {
+	uint16_t order[COMPRESS_BATCH_SIZE];
+	struct schc_device* devices[COMPRESS_BATCH_SIZE];
+	uint16_t base, n, k, done = 0;
+
+	for (base = 0; base < count; base += n) {
+		n = ((count - base) > COMPRESS_BATCH_SIZE) ? COMPRESS_BATCH_SIZE : (count - base);
+		batch_group(packets + base, n, order, devices);
+
+		for (k = 0; k < n; k++) {
+			schc_packet_t* packet = &packets[base + order[k]];
+			if (k + 1 < n) {
+				batch_prefetch(&packets[base + order[k + 1]], devices[k + 1], devices[k]);
+			}
+			packet->rule = NULL;
+			packet->done = 0;
+			if (devices[k] == NULL) {
+				TRACE_ERROR(TRACE_COMPRESS_NO_DEVICE, packet->device_id);
+				continue;
+			}
+			packet->done = compress_packet(ctx, devices[k], packet->data, packet->length,
+					packet->bit_arr, dir, &packet->rule, NULL);
+			done += packet->done;
+		}
+	}
+
+	return done;
+}
+
+/**
+ * Decompresses a batch of packets
+ * The packets are grouped by device, like in schc_compress_batch().
+ *
+ * @param 	packets			the packets, with bit_arr, data and device_id set,
+ * 							data must hold the decompressed packet
+ * 							length and done are set for each packet
+ * @param 	count			the number of packets
+ * @param 	dir				the direction of the flow
+ * 							UP: LPWAN to IPv6 or DOWN: IPv6 to LPWAN
+ *
+ * @return 	the number of packets that were decompressed
+ */
+uint16_t schc_decompress_batch(schc_packet_t* packets, uint16_t count, direction dir) {
+	uint16_t order[COMPRESS_BATCH_SIZE];
+	struct schc_device* devices[COMPRESS_BATCH_SIZE];
+	uint16_t base, n, k, done = 0;
+
+	for (base = 0; base < count; base += n) {
+		n = ((count - base) > COMPRESS_BATCH_SIZE) ? COMPRESS_BATCH_SIZE : (count - base);
+		batch_group(packets + base, n, order, devices);
+
+		for (k = 0; k < n; k++) {
+			schc_packet_t* packet = &packets[base + order[k]];
+			if (k + 1 < n) {
+				batch_prefetch(&packets[base + order[k + 1]], devices[k + 1], devices[k]);
+			}
+			packet->length = 0;
+			if (devices[k] != NULL) {
+				packet->length = decompress_packet(devices[k], packet->bit_arr, packet->data,
+						packet->bit_arr->len, dir, NULL);
+			}
+			packet->done = (packet->length > 0);
+			done += packet->done;
+		}
+	}
+
+	return done;
 }
 
 #if CLICK
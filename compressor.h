@@ -10,17 +10,181 @@
 #define __SCHC_COMPRESSOR_H__
 
 #include "schc.h"
+#include "jsmn.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#else
+#include <stddef.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#ifndef USE_RULE_INDEX
+#define USE_RULE_INDEX					0
+#endif
+
+#ifndef RULE_INDEX_CONTEXTS
+#define RULE_INDEX_CONTEXTS				4
+#endif
+#ifndef RULE_INDEX_NODES
+#define RULE_INDEX_NODES				128
+#endif
+#ifndef RULE_INDEX_EDGES
+#define RULE_INDEX_EDGES				256
+#endif
+#ifndef RULE_INDEX_RULES
+#define RULE_INDEX_RULES				1024
+#endif
+
+#ifndef USE_MATCHMAP_INDEX
+#define USE_MATCHMAP_INDEX				0
+#endif
+#ifndef MATCHMAP_FIELDS
+#define MATCHMAP_FIELDS					32
+#endif
+#ifndef MATCHMAP_ENTRIES
+#define MATCHMAP_ENTRIES				256
+#endif
+#ifndef MATCHMAP_MATCHES
+#define MATCHMAP_MATCHES				16
+#endif
+
+#ifndef USE_RULE_PROGRAM
+#define USE_RULE_PROGRAM				0
+#endif
+#ifndef RULE_PROGRAMS
+#define RULE_PROGRAMS					32
+#endif
+#ifndef RULE_PROGRAM_INSTRUCTIONS
+#define RULE_PROGRAM_INSTRUCTIONS		512
+#endif
+
+#ifndef USE_FLOW_CACHE
+#define USE_FLOW_CACHE					0
+#endif
+#ifndef FLOW_CACHE_SIZE
+#define FLOW_CACHE_SIZE					64
+#endif
+
+#ifndef COMPRESS_BATCH_SIZE
+#define COMPRESS_BATCH_SIZE				32
+#endif
+
+#if USE_MATCHMAP_INDEX == 1
+/* the index a match-map field matched with, recorded for compress_action() */
+struct schc_matchmap_match_t {
+	const struct schc_field* field;
+	const uint8_t* value;
+	uint8_t index;
+};
+#endif
+
+#if USE_FLOW_CACHE == 1
+/*
+ * The rule found for a flow is remembered, keyed by the device
+ * and a hash of the header bytes that do not change within a flow.
+ * The next packet of the flow is matched against that rule first.
+ */
+struct schc_flow_cache_entry_t {
+	const struct schc_device* device;
+	uint32_t key;
+	/* the position of the compression rule in the device context */
+	uint8_t index;
+};
+#endif
+
+/*
+ * The state of the compressor that changes per packet.
+ * The rules and the tables built by schc_compressor_init() are shared
+ * and only read, so each thread compressing or decompressing packets
+ * uses its own context. A context that is set to zero is ready to use.
+ */
+typedef struct schc_compressor_context_t {
+	jsmn_parser json_parser;
+	jsmntok_t json_token[JSON_TOKENS];
+#if USE_MATCHMAP_INDEX == 1
+	/* the match-map fields matched while looking for a rule */
+	struct schc_matchmap_match_t matchmap_matches[MATCHMAP_MATCHES];
+	uint8_t matchmap_match_count;
+#endif
+#if USE_FLOW_CACHE == 1
+	struct schc_flow_cache_entry_t flow_cache[FLOW_CACHE_SIZE];
+	uint32_t flow_cache_hits;
+	uint32_t flow_cache_misses;
+#endif
+} schc_compressor_context_t;
+
+/*
+ * A packet of a batch
+ * schc_compress_batch() compresses data into bit_arr,
+ * schc_decompress_batch() decompresses bit_arr into data.
+ */
+typedef struct schc_packet_t {
+	/* the uncompressed packet */
+	uint8_t* data;
+	/* the length of the uncompressed packet,
+	 * set by schc_decompress_batch() */
+	uint16_t length;
+	/* the compressed packet, its len is the length of the buffer
+	 * for schc_compress_batch() and the received length for schc_decompress_batch() */
+	schc_bitarray_t* bit_arr;
+	schc_device_id_t device_id;
+	/* the compression rule that was used, set by schc_compress_batch(),
+	 * NULL if the packet was sent uncompressed */
+	struct schc_compression_rule_t* rule;
+	/* 1 if the packet was compressed or decompressed, 0 on error */
+	uint8_t done;
+} schc_packet_t;
+
+/*
+ * A part of a packet, see schc_decompress_iov() and schc_compress_detached()
+ * This is a struct iovec where writev() is available.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+typedef struct iovec schc_iovec_t;
+#else
+typedef struct schc_iovec_t {
+	void* iov_base;
+	size_t iov_len;
+} schc_iovec_t;
+#endif
+
+#if USE_FLOW_CACHE == 1
+typedef struct schc_flow_cache_stats_t {
+	/* the packets compressed with the rule from the flow cache */
+	uint32_t hits;
+	/* the packets for which all rules were searched */
+	uint32_t misses;
+} schc_flow_cache_stats_t;
+
+void schc_get_flow_cache_stats(schc_flow_cache_stats_t* stats);
+void schc_reset_flow_cache();
+void schc_get_flow_cache_stats_ctx(schc_compressor_context_t* ctx, schc_flow_cache_stats_t* stats);
+void schc_reset_flow_cache_ctx(schc_compressor_context_t* ctx);
+#endif
+
 uint8_t schc_compressor_init();
+void schc_compressor_context_init(schc_compressor_context_t* ctx);
 struct schc_compression_rule_t* schc_compress(uint8_t *data, uint16_t total_length,
-		schc_bitarray_t* buf, uint32_t device_id, direction dir);
+		schc_bitarray_t* buf, schc_device_id_t device_id, direction dir);
+struct schc_compression_rule_t* schc_compress_ctx(schc_compressor_context_t* ctx,
+		uint8_t *data, uint16_t total_length, schc_bitarray_t* buf,
+		schc_device_id_t device_id, direction dir);
+struct schc_compression_rule_t* schc_compress_detached(schc_compressor_context_t* ctx,
+		uint8_t *data, uint16_t total_length, schc_bitarray_t* buf, schc_iovec_t* payload,
+		schc_device_id_t device_id, direction dir);
 
 uint16_t schc_decompress(schc_bitarray_t* bit_arr, uint8_t *buf,
-		uint32_t device_id, uint16_t total_length, direction dir);
+		schc_device_id_t device_id, uint16_t total_length, direction dir);
+uint8_t schc_decompress_iov(schc_bitarray_t* bit_arr, uint8_t *buf, schc_iovec_t iov[2],
+		schc_device_id_t device_id, uint16_t total_length, direction dir);
+
+uint16_t schc_compress_batch(schc_compressor_context_t* ctx, schc_packet_t* packets,
+		uint16_t count, direction dir);
+uint16_t schc_decompress_batch(schc_packet_t* packets, uint16_t count, direction dir);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1032 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * A binary file with the devices and their rules, written from a rule
+ * configuration and mapped at runtime instead of the rules compiled in
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "context_file.h"
+#include "bit_operations.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CONTEXT_FILE_MMAP				1
+#else
+#define CONTEXT_FILE_MMAP				0
+#endif
+
+#if CLICK
+#include <click/config.h>
+#endif
+
+/* the states of a device view */
+#define VIEW_EMPTY						0
+#define VIEW_FILLING					1
+#define VIEW_READY						2
+
+/* a growing array of records, for the writer */
+struct context_vector_t {
+	uint8_t* data;
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t size;
+};
+
+/*
+ * The records written once, found by their key:
+ * the address of a rule, or the rules and the uncompressed rule id of a context
+ * The slots hold the position of each key plus one, 0 if empty.
+ */
+struct context_index_t {
+	struct context_vector_t keys;
+	uint32_t* slots;
+	uint32_t size;
+};
+
+/* the key of a context, without padding */
+struct context_key_t {
+	const void* compression_context;
+	const void* fragmentation_context;
+	uint32_t uncomp_rule_id;
+	uint8_t uncomp_rule_id_size_bits;
+	uint8_t compression_rule_count;
+	uint8_t fragmentation_rule_count;
+	uint8_t reserved;
+};
+
+struct context_writer_t {
+	struct context_index_t context_index;
+	struct context_index_t compression_index;
+	struct context_index_t layer_index;
+	struct context_index_t fragmentation_index;
+	struct context_vector_t contexts;
+	struct context_vector_t compression_rules;
+	struct context_vector_t layer_rules;
+	struct context_vector_t fields;
+	struct context_vector_t fragmentation_rules;
+	struct context_vector_t indices;
+	struct context_vector_t values;
+};
+
+/* the context file that was loaded */
+static struct {
+	uint8_t loaded;
+	const uint8_t* map;
+	size_t map_size;
+	const context_file_header_t* header;
+	const context_device_t* devices;
+	const uint32_t* device_table;
+	/* a device with the rules of each context and device id 0 */
+	struct schc_device* contexts;
+	/* the devices, filled on their first lookup */
+	struct schc_device* views;
+	_Atomic uint8_t* view_states;
+	uint8_t* layer_rules;
+	struct schc_compression_rule_t* compression_rules;
+	struct schc_fragmentation_rule_t* fragmentation_rules;
+	const struct schc_compression_rule_t** compression_lists;
+	const struct schc_fragmentation_rule_t** fragmentation_lists;
+} context_file;
+
+/* add a record to a vector, cleared */
+static void* vector_add(struct context_vector_t* vector) {
+	if (vector->count == vector->capacity) {
+		uint32_t capacity = vector->capacity ? (2 * vector->capacity) : 64;
+		uint8_t* data = realloc(vector->data, (size_t) capacity * vector->size);
+		if (data == NULL) {
+			return NULL;
+		}
+		vector->data = data;
+		vector->capacity = capacity;
+	}
+
+	void* record = vector->data + ((size_t) vector->count++ * vector->size);
+	memset(record, 0, vector->size);
+	return record;
+}
+
+static uint64_t key_hash(const uint8_t* key, uint32_t size) {
+	uint64_t h = 0, word;
+	uint32_t i;
+	for (i = 0; i < size; i += sizeof(word)) {
+		word = 0;
+		memcpy(&word, key + i, ((size - i) < sizeof(word)) ? (size - i) : sizeof(word));
+		h = device_id_hash(h ^ word);
+	}
+	return h;
+}
+
+/*
+ * Find a key in an index, or add it
+ *
+ * @param index			the index
+ * @param key			the key, of the size of the keys of the index
+ * @param added			set to 1 if the key was added
+ *
+ * @return the position of the key
+ *         CONTEXT_NONE	if out of memory
+ */
+static uint32_t index_find(struct context_index_t* index, const void* key, uint8_t* added) {
+	uint32_t i, slot;
+
+	*added = 0;
+	if ((2 * (index->keys.count + 1)) > index->size) { // grow and rehash
+		uint32_t size = index->size ? (2 * index->size) : 64;
+		uint32_t* slots = calloc(size, sizeof(uint32_t));
+		if (slots == NULL) {
+			return CONTEXT_NONE;
+		}
+		for (i = 0; i < index->keys.count; i++) {
+			slot = key_hash(index->keys.data + ((size_t) i * index->keys.size), index->keys.size) % size;
+			while (slots[slot]) {
+				slot = (slot + 1) % size;
+			}
+			slots[slot] = i + 1;
+		}
+		free(index->slots);
+		index->slots = slots;
+		index->size = size;
+	}
+
+	for (slot = key_hash(key, index->keys.size) % index->size; index->slots[slot];
+			slot = (slot + 1) % index->size) {
+		i = index->slots[slot] - 1;
+		if (!memcmp(index->keys.data + ((size_t) i * index->keys.size), key, index->keys.size)) {
+			return i;
+		}
+	}
+
+	void* record = vector_add(&index->keys);
+	if (record == NULL) {
+		return CONTEXT_NONE;
+	}
+	memcpy(record, key, index->keys.size);
+	index->slots[slot] = index->keys.count;
+	*added = 1;
+
+	return index->keys.count - 1;
+}
+
+static uint8_t mo_to_file(uint8_t (*MO)(struct schc_field*, unsigned char*, uint16_t)) {
+	if (MO == &mo_equal) {
+		return CONTEXT_MO_EQUAL;
+	} else if (MO == &mo_ignore) {
+		return CONTEXT_MO_IGNORE;
+	} else if (MO == &mo_MSB) {
+		return CONTEXT_MO_MSB;
+	} else if (MO == &mo_matchmap) {
+		return CONTEXT_MO_MATCHMAP;
+	}
+	return 0xFF;
+}
+
+/* write a layer rule and its fields once, return its position */
+static uint32_t write_layer_rule(struct context_writer_t* writer,
+		const struct schc_layer_rule_t* rule, schc_layer_t layer, uint8_t max_fields) {
+	uint8_t added, k;
+
+	if (rule == NULL) {
+		return CONTEXT_NONE;
+	}
+	uint32_t position = index_find(&writer->layer_index, &rule, &added);
+	if (!added) {
+		return position;
+	}
+	if (rule->length > max_fields) {
+		DEBUG_PRINTF("write_layer_rule(): layer rule %p has more fields than the layer \n",
+				(void*) rule);
+		return CONTEXT_NONE;
+	}
+
+	context_layer_rule_t* record = vector_add(&writer->layer_rules);
+	if (record == NULL) {
+		return CONTEXT_NONE;
+	}
+	record->up = rule->up;
+	record->down = rule->down;
+	record->length = rule->length;
+	record->layer = (uint8_t) layer;
+	record->fields = writer->fields.count;
+
+	for (k = 0; k < rule->length; k++) {
+		const struct schc_field* field = &rule->content[k];
+		context_field_t* dst = vector_add(&writer->fields);
+		if (dst == NULL) {
+			return CONTEXT_NONE;
+		}
+		dst->field = field->field;
+		dst->MO_param_length = field->MO_param_length;
+		dst->field_length = field->field_length;
+		dst->field_pos = field->field_pos;
+		dst->dir = (uint8_t) field->dir;
+		dst->MO = mo_to_file(field->MO);
+		dst->action = (uint8_t) field->action;
+		if (dst->MO == 0xFF) {
+			DEBUG_PRINTF("write_layer_rule(): field %d uses an unknown matching operator \n",
+					field->field);
+			return CONTEXT_NONE;
+		}
+
+		uint16_t length = MAX_FIELD_LENGTH, i;
+		while (length && !field->target_value[length - 1]) {
+			length--;
+		}
+		dst->value = writer->values.count;
+		dst->value_length = length;
+		for (i = 0; i < length; i++) {
+			uint8_t* byte = vector_add(&writer->values);
+			if (byte == NULL) {
+				return CONTEXT_NONE;
+			}
+			*byte = field->target_value[i];
+		}
+	}
+
+	return position;
+}
+
+/* write a compression rule and its layer rules once, return its position */
+static uint32_t write_compression_rule(struct context_writer_t* writer,
+		const struct schc_compression_rule_t* rule) {
+	uint8_t added;
+
+	uint32_t position = index_find(&writer->compression_index, &rule, &added);
+	if (!added) {
+		return position;
+	}
+
+	context_compression_rule_t record = { rule->rule_id, rule->rule_id_size_bits, { 0 },
+			{ CONTEXT_NONE, CONTEXT_NONE, CONTEXT_NONE } };
+#if USE_IP6 == 1
+	if (rule->ipv6_rule != NULL && (record.layers[SCHC_IPV6] = write_layer_rule(writer,
+			(const struct schc_layer_rule_t*) rule->ipv6_rule, SCHC_IPV6, IP6_FIELDS)) == CONTEXT_NONE) {
+		return CONTEXT_NONE;
+	}
+#endif
+#if USE_UDP == 1
+	if (rule->udp_rule != NULL && (record.layers[SCHC_UDP] = write_layer_rule(writer,
+			(const struct schc_layer_rule_t*) rule->udp_rule, SCHC_UDP, UDP_FIELDS)) == CONTEXT_NONE) {
+		return CONTEXT_NONE;
+	}
+#endif
+#if USE_COAP == 1
+	if (rule->coap_rule != NULL && (record.layers[SCHC_COAP] = write_layer_rule(writer,
+			(const struct schc_layer_rule_t*) rule->coap_rule, SCHC_COAP, COAP_FIELDS)) == CONTEXT_NONE) {
+		return CONTEXT_NONE;
+	}
+#endif
+
+	context_compression_rule_t* dst = vector_add(&writer->compression_rules);
+	if (dst == NULL) {
+		return CONTEXT_NONE;
+	}
+	*dst = record;
+
+	return position;
+}
+
+/* write a fragmentation rule once, return its position */
+static uint32_t write_fragmentation_rule(struct context_writer_t* writer,
+		const struct schc_fragmentation_rule_t* rule) {
+	uint8_t added;
+
+	uint32_t position = index_find(&writer->fragmentation_index, &rule, &added);
+	if (!added || position == CONTEXT_NONE) {
+		return position;
+	}
+
+	context_fragmentation_rule_t* dst = vector_add(&writer->fragmentation_rules);
+	if (dst == NULL) {
+		return CONTEXT_NONE;
+	}
+	dst->rule_id = rule->rule_id;
+	dst->rule_id_size_bits = rule->rule_id_size_bits;
+	dst->mode = (uint8_t) rule->mode;
+	dst->dir = (uint8_t) rule->dir;
+	dst->FCN_SIZE = rule->FCN_SIZE;
+	dst->MAX_WND_FCN = rule->MAX_WND_FCN;
+	dst->WINDOW_SIZE = rule->WINDOW_SIZE;
+	dst->DTAG_SIZE = rule->DTAG_SIZE;
+
+	return position;
+}
+
+/* write the context of a device once, return its position */
+static uint32_t write_context(struct context_writer_t* writer, const struct schc_device* device) {
+	struct context_key_t key;
+	uint8_t added, i;
+
+	memset(&key, 0, sizeof(key));
+	key.compression_context = device->compression_context;
+	key.fragmentation_context = device->fragmentation_context;
+	key.uncomp_rule_id = device->uncomp_rule_id;
+	key.uncomp_rule_id_size_bits = device->uncomp_rule_id_size_bits;
+	key.compression_rule_count = device->compression_rule_count;
+	key.fragmentation_rule_count = device->fragmentation_rule_count;
+
+	uint32_t position = index_find(&writer->context_index, &key, &added);
+	if (!added || position == CONTEXT_NONE) {
+		return position;
+	}
+
+	context_context_t record = { device->uncomp_rule_id, device->uncomp_rule_id_size_bits,
+			device->compression_rule_count, device->fragmentation_rule_count, 0, 0, 0 };
+	uint32_t rules[256];
+
+	for (i = 0; i < device->compression_rule_count; i++) {
+		if ((rules[i] = write_compression_rule(writer, (*device->compression_context)[i])) == CONTEXT_NONE) {
+			return CONTEXT_NONE;
+		}
+	}
+	record.compression_rules = writer->indices.count;
+	for (i = 0; i < device->compression_rule_count; i++) {
+		uint32_t* index = vector_add(&writer->indices);
+		if (index == NULL) {
+			return CONTEXT_NONE;
+		}
+		*index = rules[i];
+	}
+
+	for (i = 0; i < device->fragmentation_rule_count; i++) {
+		if ((rules[i] = write_fragmentation_rule(writer, (*device->fragmentation_context)[i])) == CONTEXT_NONE) {
+			return CONTEXT_NONE;
+		}
+	}
+	record.fragmentation_rules = writer->indices.count;
+	for (i = 0; i < device->fragmentation_rule_count; i++) {
+		uint32_t* index = vector_add(&writer->indices);
+		if (index == NULL) {
+			return CONTEXT_NONE;
+		}
+		*index = rules[i];
+	}
+
+	context_context_t* dst = vector_add(&writer->contexts);
+	if (dst == NULL) {
+		return CONTEXT_NONE;
+	}
+	*dst = record;
+
+	return position;
+}
+
+static uint64_t section_end(uint64_t offset, uint64_t size) {
+	return (offset + size + CONTEXT_FILE_ALIGN - 1) & ~((uint64_t) CONTEXT_FILE_ALIGN - 1);
+}
+
+/* write a section and the padding up to the next one */
+static uint8_t write_section(FILE* file, const void* data, uint64_t offset, uint64_t size) {
+	static const uint8_t padding[CONTEXT_FILE_ALIGN] = { 0 };
+	uint64_t padding_size = section_end(offset, size) - (offset + size);
+
+	if (size && fwrite(data, 1, size, file) != size) {
+		return 0;
+	}
+	return (!padding_size || fwrite(padding, 1, padding_size, file) == padding_size);
+}
+
+static void writer_free(struct context_writer_t* writer) {
+	struct context_index_t* indices[] = { &writer->context_index, &writer->compression_index,
+			&writer->layer_index, &writer->fragmentation_index };
+	struct context_vector_t* vectors[] = { &writer->contexts, &writer->compression_rules,
+			&writer->layer_rules, &writer->fields, &writer->fragmentation_rules, &writer->indices,
+			&writer->values };
+	uint8_t i;
+
+	for (i = 0; i < sizeof(indices) / sizeof(indices[0]); i++) {
+		free(indices[i]->keys.data);
+		free(indices[i]->slots);
+	}
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		free(vectors[i]->data);
+	}
+}
+
+/**
+ * Write devices and their rules to a context file
+ * The rules are compared by their address: the rules a device points to,
+ * or that several devices share, are written once.
+ *
+ * @param 	file			the binary file to write to
+ * @param 	device_count	the number of devices
+ * @param 	get_device		returns the device at a position, e.g. get_device_by_index()
+ * 							to write the rule configuration, the device is copied
+ * 							so the same struct may be returned for every position
+ *
+ * @return 	1				the file was written
+ * 			0				on error
+ */
+uint8_t schc_context_file_write(FILE* file, uint32_t device_count,
+		struct schc_device* (*get_device)(uint32_t index)) {
+	struct context_writer_t writer;
+	context_file_header_t header;
+	uint32_t i, slot;
+	uint8_t ok = 0;
+
+	memset(&writer, 0, sizeof(writer));
+	writer.context_index.keys.size = sizeof(struct context_key_t);
+	writer.compression_index.keys.size = sizeof(void*);
+	writer.layer_index.keys.size = sizeof(void*);
+	writer.fragmentation_index.keys.size = sizeof(void*);
+	writer.contexts.size = sizeof(context_context_t);
+	writer.compression_rules.size = sizeof(context_compression_rule_t);
+	writer.layer_rules.size = sizeof(context_layer_rule_t);
+	writer.fields.size = sizeof(context_field_t);
+	writer.fragmentation_rules.size = sizeof(context_fragmentation_rule_t);
+	writer.indices.size = sizeof(uint32_t);
+	writer.values.size = sizeof(uint8_t);
+
+	uint32_t table_size = device_count ? (2 * device_count) : 1;
+	context_device_t* devices = calloc(device_count ? device_count : 1, sizeof(context_device_t));
+	uint32_t* table = calloc(table_size, sizeof(uint32_t));
+	if (devices == NULL || table == NULL) {
+		goto end;
+	}
+
+	for (i = 0; i < device_count; i++) {
+		const struct schc_device* device = get_device(i);
+		if (device == NULL) {
+			goto end;
+		}
+		devices[i].device_id = device->device_id;
+		if ((devices[i].context = write_context(&writer, device)) == CONTEXT_NONE) {
+			goto end;
+		}
+		for (slot = device_id_hash(device->device_id) % table_size; table[slot];
+				slot = (slot + 1) % table_size) {
+			if (devices[table[slot] - 1].device_id == device->device_id) {
+				break; // the first device with an id is used
+			}
+		}
+		if (!table[slot]) {
+			table[slot] = i + 1;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = CONTEXT_FILE_MAGIC;
+	header.version = CONTEXT_FILE_VERSION;
+	header.header_size = sizeof(header);
+	header.device_count = device_count;
+	header.device_table_size = table_size;
+	header.context_count = writer.contexts.count;
+	header.compression_rule_count = writer.compression_rules.count;
+	header.layer_rule_count = writer.layer_rules.count;
+	header.field_count = writer.fields.count;
+	header.fragmentation_rule_count = writer.fragmentation_rules.count;
+	header.index_count = writer.indices.count;
+	header.value_size = writer.values.count;
+	header.devices = section_end(0, sizeof(header));
+	header.device_table = section_end(header.devices, (uint64_t) device_count * sizeof(context_device_t));
+	header.contexts = section_end(header.device_table, (uint64_t) table_size * sizeof(uint32_t));
+	header.compression_rules = section_end(header.contexts,
+			(uint64_t) writer.contexts.count * writer.contexts.size);
+	header.layer_rules = section_end(header.compression_rules,
+			(uint64_t) writer.compression_rules.count * writer.compression_rules.size);
+	header.fields = section_end(header.layer_rules,
+			(uint64_t) writer.layer_rules.count * writer.layer_rules.size);
+	header.fragmentation_rules = section_end(header.fields,
+			(uint64_t) writer.fields.count * writer.fields.size);
+	header.indices = section_end(header.fragmentation_rules,
+			(uint64_t) writer.fragmentation_rules.count * writer.fragmentation_rules.size);
+	header.values = section_end(header.indices, (uint64_t) writer.indices.count * writer.indices.size);
+	header.file_size = section_end(header.values, writer.values.count);
+
+	ok = write_section(file, &header, 0, sizeof(header))
+			&& write_section(file, devices, header.devices,
+					(uint64_t) device_count * sizeof(context_device_t))
+			&& write_section(file, table, header.device_table, (uint64_t) table_size * sizeof(uint32_t))
+			&& write_section(file, writer.contexts.data, header.contexts,
+					(uint64_t) writer.contexts.count * writer.contexts.size)
+			&& write_section(file, writer.compression_rules.data, header.compression_rules,
+					(uint64_t) writer.compression_rules.count * writer.compression_rules.size)
+			&& write_section(file, writer.layer_rules.data, header.layer_rules,
+					(uint64_t) writer.layer_rules.count * writer.layer_rules.size)
+			&& write_section(file, writer.fields.data, header.fields,
+					(uint64_t) writer.fields.count * writer.fields.size)
+			&& write_section(file, writer.fragmentation_rules.data, header.fragmentation_rules,
+					(uint64_t) writer.fragmentation_rules.count * writer.fragmentation_rules.size)
+			&& write_section(file, writer.indices.data, header.indices,
+					(uint64_t) writer.indices.count * writer.indices.size)
+			&& write_section(file, writer.values.data, header.values, writer.values.count);
+
+end:
+	free(devices);
+	free(table);
+	writer_free(&writer);
+
+	return ok;
+}
+
+#if CONTEXT_FILE_MMAP == 1
+/* check that a section lies within the file */
+static uint8_t section_fits(const context_file_header_t* header, uint64_t offset, uint64_t count,
+		uint64_t size) {
+	return !(offset % CONTEXT_FILE_ALIGN) && offset >= header->header_size
+			&& offset <= header->file_size && (count * size) <= (header->file_size - offset);
+}
+
+/* the size of the largest layer rule that is built */
+static size_t layer_rule_size(void) {
+	size_t size = sizeof(struct schc_layer_rule_t);
+#if USE_IP6 == 1
+	size = (sizeof(struct schc_ipv6_rule_t) > size) ? sizeof(struct schc_ipv6_rule_t) : size;
+#endif
+#if USE_UDP == 1
+	size = (sizeof(struct schc_udp_rule_t) > size) ? sizeof(struct schc_udp_rule_t) : size;
+#endif
+#if USE_COAP == 1
+	size = (sizeof(struct schc_coap_rule_t) > size) ? sizeof(struct schc_coap_rule_t) : size;
+#endif
+	return size;
+}
+
+static uint8_t layer_max_fields(uint8_t layer) {
+	switch (layer) {
+#if USE_IP6 == 1
+	case SCHC_IPV6:
+		return IP6_FIELDS;
+#endif
+#if USE_UDP == 1
+	case SCHC_UDP:
+		return UDP_FIELDS;
+#endif
+#if USE_COAP == 1
+	case SCHC_COAP:
+		return COAP_FIELDS;
+#endif
+	default:
+		return 0; // not built
+	}
+}
+
+static uint8_t (*const file_mo[])(struct schc_field*, unsigned char*, uint16_t) = {
+	[CONTEXT_MO_EQUAL] = &mo_equal,
+	[CONTEXT_MO_IGNORE] = &mo_ignore,
+	[CONTEXT_MO_MSB] = &mo_MSB,
+	[CONTEXT_MO_MATCHMAP] = &mo_matchmap
+};
+
+/* convert the layer rules of the file, with their fields */
+static uint8_t load_layer_rules(const context_file_header_t* header) {
+	const context_layer_rule_t* rules = (const context_layer_rule_t*) (context_file.map + header->layer_rules);
+	const context_field_t* fields = (const context_field_t*) (context_file.map + header->fields);
+	const uint8_t* values = context_file.map + header->values;
+	size_t stride = layer_rule_size();
+	uint32_t i; uint8_t k;
+
+	context_file.layer_rules = calloc(header->layer_rule_count ? header->layer_rule_count : 1, stride);
+	if (context_file.layer_rules == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < header->layer_rule_count; i++) {
+		const context_layer_rule_t* src = &rules[i];
+		struct schc_layer_rule_t* dst = (struct schc_layer_rule_t*) (context_file.layer_rules + (i * stride));
+		if (src->length > layer_max_fields(src->layer) || src->fields > header->field_count
+				|| src->length > (header->field_count - src->fields)) {
+			DEBUG_PRINTF("load_layer_rules(): layer rule %u does not fit the layers that are built \n", i);
+			return 0;
+		}
+		dst->up = src->up;
+		dst->down = src->down;
+		dst->length = src->length;
+		for (k = 0; k < src->length; k++) {
+			const context_field_t* field = &fields[src->fields + k];
+			if (field->MO > CONTEXT_MO_MATCHMAP || field->dir > BI || field->action > APPIID
+					|| get_number_of_bytes_from_bits(field->field_length) > MAX_FIELD_LENGTH
+					|| (field->MO == CONTEXT_MO_MSB && field->MO_param_length > field->field_length)
+					|| (field->MO == CONTEXT_MO_MATCHMAP && (!field->MO_param_length
+							|| (field->MO_param_length * get_number_of_bytes_from_bits(field->field_length)) > MAX_FIELD_LENGTH))
+					|| field->value_length > MAX_FIELD_LENGTH || field->value > header->value_size
+					|| field->value_length > (header->value_size - field->value)) {
+				DEBUG_PRINTF("load_layer_rules(): field %u of layer rule %u is not valid \n", k, i);
+				return 0;
+			}
+			dst->content[k].field = field->field;
+			dst->content[k].MO_param_length = field->MO_param_length;
+			dst->content[k].field_length = field->field_length;
+			dst->content[k].field_pos = field->field_pos;
+			dst->content[k].dir = (direction) field->dir;
+			memcpy(dst->content[k].target_value, values + field->value, field->value_length);
+			dst->content[k].MO = file_mo[field->MO];
+			dst->content[k].action = (CDA) field->action;
+		}
+	}
+
+	return 1;
+}
+
+/* get a converted layer rule of a compression rule, check its layer */
+static uint8_t load_layer(const context_file_header_t* header, uint32_t index, uint8_t layer,
+		const void** rule) {
+	const context_layer_rule_t* rules = (const context_layer_rule_t*) (context_file.map + header->layer_rules);
+
+	*rule = NULL;
+	if (index == CONTEXT_NONE) {
+		return 1;
+	}
+	if (index >= header->layer_rule_count || rules[index].layer != layer) {
+		return 0;
+	}
+	*rule = context_file.layer_rules + (index * layer_rule_size());
+	return 1;
+}
+
+/* convert the compression and fragmentation rules of the file */
+static uint8_t load_rules(const context_file_header_t* header) {
+	const context_compression_rule_t* compression_rules =
+			(const context_compression_rule_t*) (context_file.map + header->compression_rules);
+	const context_fragmentation_rule_t* fragmentation_rules =
+			(const context_fragmentation_rule_t*) (context_file.map + header->fragmentation_rules);
+	uint32_t i; uint8_t l;
+
+	context_file.compression_rules = calloc(header->compression_rule_count ? header->compression_rule_count : 1,
+			sizeof(struct schc_compression_rule_t));
+	context_file.fragmentation_rules = calloc(header->fragmentation_rule_count ? header->fragmentation_rule_count : 1,
+			sizeof(struct schc_fragmentation_rule_t));
+	if (context_file.compression_rules == NULL || context_file.fragmentation_rules == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < header->compression_rule_count; i++) {
+		const context_compression_rule_t* src = &compression_rules[i];
+		struct schc_compression_rule_t* dst = &context_file.compression_rules[i];
+		const void* layers[3];
+		for (l = 0; l < 3; l++) {
+			if (!load_layer(header, src->layers[l], l, &layers[l])) {
+				DEBUG_PRINTF("load_rules(): compression rule %u has no valid layer %u \n", i, l);
+				return 0;
+			}
+		}
+		if (src->rule_id_size_bits > (RULE_SIZE_BYTES * 8)) {
+			DEBUG_PRINTF("load_rules(): compression rule %u has a rule id of more than %d bits \n", i,
+					RULE_SIZE_BYTES * 8);
+			return 0;
+		}
+		dst->rule_id = src->rule_id;
+		dst->rule_id_size_bits = src->rule_id_size_bits;
+#if USE_IP6 == 1
+		dst->ipv6_rule = (const struct schc_ipv6_rule_t*) layers[SCHC_IPV6];
+#endif
+#if USE_UDP == 1
+		dst->udp_rule = (const struct schc_udp_rule_t*) layers[SCHC_UDP];
+#endif
+#if USE_COAP == 1
+		dst->coap_rule = (const struct schc_coap_rule_t*) layers[SCHC_COAP];
+#endif
+	}
+
+	for (i = 0; i < header->fragmentation_rule_count; i++) {
+		const context_fragmentation_rule_t* src = &fragmentation_rules[i];
+		struct schc_fragmentation_rule_t* dst = &context_file.fragmentation_rules[i];
+		if (src->mode < ACK_ALWAYS || src->mode >= MAX_RELIABILITY_MODES || src->dir > BI
+				|| src->rule_id_size_bits > (RULE_SIZE_BYTES * 8)) {
+			DEBUG_PRINTF("load_rules(): fragmentation rule %u is not valid \n", i);
+			return 0;
+		}
+		dst->rule_id = src->rule_id;
+		dst->rule_id_size_bits = src->rule_id_size_bits;
+		dst->mode = (reliability_mode) src->mode;
+		dst->dir = (direction) src->dir;
+		dst->FCN_SIZE = src->FCN_SIZE;
+		dst->MAX_WND_FCN = src->MAX_WND_FCN;
+		dst->WINDOW_SIZE = src->WINDOW_SIZE;
+		dst->DTAG_SIZE = src->DTAG_SIZE;
+	}
+
+	return 1;
+}
+
+/*
+ * Convert the contexts of the file to a device each, with device id 0
+ * and revise them as rm_revise_rule_context() does
+ */
+static uint8_t load_contexts(const context_file_header_t* header) {
+	const context_context_t* contexts = (const context_context_t*) (context_file.map + header->contexts);
+	const uint32_t* indices = (const uint32_t*) (context_file.map + header->indices);
+	uint32_t i, j;
+
+	context_file.contexts = calloc(header->context_count ? header->context_count : 1,
+			sizeof(struct schc_device));
+	context_file.compression_lists = calloc(header->index_count ? header->index_count : 1,
+			sizeof(struct schc_compression_rule_t*));
+	context_file.fragmentation_lists = calloc(header->index_count ? header->index_count : 1,
+			sizeof(struct schc_fragmentation_rule_t*));
+	if (context_file.contexts == NULL || context_file.compression_lists == NULL
+			|| context_file.fragmentation_lists == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < header->context_count; i++) {
+		const context_context_t* src = &contexts[i];
+		struct schc_device* dst = &context_file.contexts[i];
+		if (src->compression_rules > header->index_count
+				|| src->compression_rule_count > (header->index_count - src->compression_rules)
+				|| src->fragmentation_rules > header->index_count
+				|| src->fragmentation_rule_count > (header->index_count - src->fragmentation_rules)
+				|| src->uncomp_rule_id_size_bits > (RULE_SIZE_BYTES * 8)) {
+			DEBUG_PRINTF("load_contexts(): the rules of context %u are not valid \n", i);
+			return 0;
+		}
+		for (j = 0; j < src->compression_rule_count; j++) {
+			uint32_t rule = indices[src->compression_rules + j];
+			if (rule >= header->compression_rule_count) {
+				return 0;
+			}
+			if (context_file.compression_rules[rule].rule_id == src->uncomp_rule_id) {
+				DEBUG_PRINTF("load_contexts(): context %u uses the uncompressed rule id %u \n", i,
+						src->uncomp_rule_id);
+				return 0;
+			}
+			context_file.compression_lists[src->compression_rules + j] = &context_file.compression_rules[rule];
+		}
+		for (j = 0; j < src->fragmentation_rule_count; j++) {
+			uint32_t rule = indices[src->fragmentation_rules + j];
+			if (rule >= header->fragmentation_rule_count) {
+				return 0;
+			}
+			context_file.fragmentation_lists[src->fragmentation_rules + j] = &context_file.fragmentation_rules[rule];
+		}
+		dst->device_id = 0;
+		dst->uncomp_rule_id = src->uncomp_rule_id;
+		dst->uncomp_rule_id_size_bits = src->uncomp_rule_id_size_bits;
+		dst->compression_rule_count = src->compression_rule_count;
+		dst->compression_context = (const struct schc_compression_rule_t *(*)[])
+				&context_file.compression_lists[src->compression_rules];
+		dst->fragmentation_rule_count = src->fragmentation_rule_count;
+		dst->fragmentation_context = (const struct schc_fragmentation_rule_t *(*)[])
+				&context_file.fragmentation_lists[src->fragmentation_rules];
+	}
+
+	return 1;
+}
+
+/**
+ * Map a context file and use its devices instead of the rule configuration
+ * The devices and the device table stay in the file, mapped read-only,
+ * so the processes that load the same file share these pages.
+ * Only the rules are converted at load, a device is filled from its
+ * context when it is first looked up, so loading reads the devices once
+ * but does not build anything per device.
+ * Call schc_compressor_init() after loading a file, not while packets are compressed.
+ *
+ * @param 	path			the file, written by schc_context_file_write()
+ *
+ * @return 	1				the file was loaded
+ * 			0				the file is not a valid context file of this version,
+ * 							the rule configuration is used
+ */
+uint8_t schc_context_file_load(const char* path) {
+	struct stat st;
+
+	schc_context_file_unload();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		DEBUG_PRINTF("schc_context_file_load(): can not open %s \n", path);
+		return 0;
+	}
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(context_file_header_t)) {
+		close(fd);
+		return 0;
+	}
+	void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	context_file.map = map;
+	context_file.map_size = (size_t) st.st_size;
+
+	const context_file_header_t* header = (const context_file_header_t*) context_file.map;
+	if (header->magic != CONTEXT_FILE_MAGIC || header->version != CONTEXT_FILE_VERSION
+			|| header->header_size != sizeof(context_file_header_t)
+			|| header->file_size > context_file.map_size || !header->device_table_size
+			|| !section_fits(header, header->devices, header->device_count, sizeof(context_device_t))
+			|| !section_fits(header, header->device_table, header->device_table_size, sizeof(uint32_t))
+			|| !section_fits(header, header->contexts, header->context_count, sizeof(context_context_t))
+			|| !section_fits(header, header->compression_rules, header->compression_rule_count,
+					sizeof(context_compression_rule_t))
+			|| !section_fits(header, header->layer_rules, header->layer_rule_count,
+					sizeof(context_layer_rule_t))
+			|| !section_fits(header, header->fields, header->field_count, sizeof(context_field_t))
+			|| !section_fits(header, header->fragmentation_rules, header->fragmentation_rule_count,
+					sizeof(context_fragmentation_rule_t))
+			|| !section_fits(header, header->indices, header->index_count, sizeof(uint32_t))
+			|| !section_fits(header, header->values, header->value_size, sizeof(uint8_t))) {
+		DEBUG_PRINTF("schc_context_file_load(): %s is not a context file of version %d \n", path,
+				CONTEXT_FILE_VERSION);
+		schc_context_file_unload();
+		return 0;
+	}
+	context_file.header = header;
+	context_file.devices = (const context_device_t*) (context_file.map + header->devices);
+	context_file.device_table = (const uint32_t*) (context_file.map + header->device_table);
+
+	if (!load_layer_rules(header) || !load_rules(header) || !load_contexts(header)) {
+		schc_context_file_unload();
+		return 0;
+	}
+	uint32_t i;
+	for (i = 0; i < header->device_count; i++) { // a linear read, the only pass over the devices
+		if (context_file.devices[i].context >= header->context_count) {
+			DEBUG_PRINTF("schc_context_file_load(): device %u has no valid context \n", i);
+			schc_context_file_unload();
+			return 0;
+		}
+	}
+
+	/* the pages of the views are only touched for the devices that are looked up */
+	context_file.views = calloc(header->device_count ? header->device_count : 1, sizeof(struct schc_device));
+	context_file.view_states = calloc(header->device_count ? header->device_count : 1, sizeof(_Atomic uint8_t));
+	if (context_file.views == NULL || context_file.view_states == NULL) {
+		schc_context_file_unload();
+		return 0;
+	}
+
+	context_file.loaded = 1;
+	return 1;
+}
+
+/**
+ * Unmap the context file and use the rule configuration again
+ * Call schc_compressor_init() after unloading, the devices of the file
+ * can not be used anymore.
+ */
+void schc_context_file_unload(void) {
+	if (context_file.map != NULL) {
+		munmap((void*) context_file.map, context_file.map_size);
+	}
+	free(context_file.contexts);
+	free(context_file.views);
+	free((void*) context_file.view_states);
+	free(context_file.layer_rules);
+	free(context_file.compression_rules);
+	free(context_file.fragmentation_rules);
+	free(context_file.compression_lists);
+	free(context_file.fragmentation_lists);
+	memset(&context_file, 0, sizeof(context_file));
+}
+#else
+uint8_t schc_context_file_load(const char* path) {
+	(void) path;
+	DEBUG_PRINTF("schc_context_file_load(): context files are not supported on this platform \n");
+	return 0;
+}
+
+void schc_context_file_unload(void) {
+}
+#endif
+
+/**
+ * Check whether a context file is used instead of the rule configuration
+ *
+ * @return 	1				a context file was loaded
+ * 			0				otherwise
+ */
+uint8_t schc_context_file_loaded(void) {
+	return context_file.loaded;
+}
+
+/**
+ * Get the number of devices in the context file
+ *
+ * @return 	the number of devices
+ */
+uint32_t schc_context_file_device_count(void) {
+	return context_file.loaded ? context_file.header->device_count : 0;
+}
+
+/**
+ * Get a device of the context file, use get_device_by_index() instead
+ * The device is filled from its context on the first lookup,
+ * which may happen in several threads at once.
+ *
+ * @param 	index			the position of the device in the file
+ *
+ * @return 	the device
+ * 			NULL			if there is no device at this position
+ */
+struct schc_device* schc_context_file_device_by_index(uint32_t index) {
+	if (!context_file.loaded || index >= context_file.header->device_count) {
+		return NULL;
+	}
+
+	struct schc_device* view = &context_file.views[index];
+	_Atomic uint8_t* state = &context_file.view_states[index];
+	if (atomic_load_explicit(state, memory_order_acquire) == VIEW_READY) {
+		return view;
+	}
+
+	const context_device_t* device = &context_file.devices[index];
+	uint8_t expected = VIEW_EMPTY;
+	if (atomic_compare_exchange_strong(state, &expected, VIEW_FILLING)) {
+		*view = context_file.contexts[device->context];
+		view->device_id = device->device_id;
+		atomic_store_explicit(state, VIEW_READY, memory_order_release);
+	} else {
+		while (atomic_load_explicit(state, memory_order_acquire) != VIEW_READY) {
+			// filled by an other thread
+		}
+	}
+
+	return view;
+}
+
+/**
+ * Get a device of the context file by its id, use get_device_by_id() instead
+ *
+ * @param 	device_id		the id of the device
+ *
+ * @return 	the device
+ * 			NULL			if no device was found
+ */
+struct schc_device* schc_context_file_device_by_id(schc_device_id_t device_id) {
+	if (!context_file.loaded) {
+		return NULL;
+	}
+
+	const context_file_header_t* header = context_file.header;
+	uint32_t slot = (uint32_t) (device_id_hash(device_id) % header->device_table_size), probes;
+	for (probes = 0; probes < header->device_table_size && context_file.device_table[slot]; probes++) {
+		uint32_t index = context_file.device_table[slot] - 1;
+		if (index < header->device_count && context_file.devices[index].device_id == device_id) {
+			return schc_context_file_device_by_index(index);
+		}
+		slot = (slot + 1) % header->device_table_size;
+	}
+
+	return NULL;
+}
+
+/**
+ * Prefetch what the lookup of a device reads, use prefetch_device_by_id() instead
+ *
+ * @param 	device_id		the id of the device
+ * @param 	step			0 for the slot of the device table,
+ * 							1 for the device the slot refers to, once the slot is read
+ */
+void schc_context_file_prefetch(schc_device_id_t device_id, uint8_t step) {
+#if defined(__GNUC__)
+	if (!context_file.loaded) {
+		return;
+	}
+
+	const context_file_header_t* header = context_file.header;
+	uint32_t slot = (uint32_t) (device_id_hash(device_id) % header->device_table_size);
+	if (step == 0) {
+		__builtin_prefetch(&context_file.device_table[slot]);
+	} else if (context_file.device_table[slot]
+			&& context_file.device_table[slot] <= header->device_count) {
+		uint32_t index = context_file.device_table[slot] - 1;
+		__builtin_prefetch(&context_file.devices[index]);
+		__builtin_prefetch(&context_file.views[index]);
+		__builtin_prefetch(&context_file.view_states[index]);
+	}
+#else
+	(void) device_id; (void) step;
+#endif
+}
+
+/**
+ * Get the number of contexts in the context file, see get_rule_context_count()
+ *
+ * @return 	the number of contexts
+ */
+uint32_t schc_context_file_context_count(void) {
+	return context_file.loaded ? context_file.header->context_count : 0;
+}
+
+/**
+ * Get a context of the context file, as a device with device id 0,
+ * see get_rule_context_by_index()
+ *
+ * @param 	index			the position of the context
+ *
+ * @return 	the context
+ * 			NULL			if there is no context at this position
+ */
+struct schc_device* schc_context_file_context_by_index(uint32_t index) {
+	if (!context_file.loaded || index >= context_file.header->context_count) {
+		return NULL;
+	}
+	return &context_file.contexts[index];
+}
+
+#if CLICK
+ELEMENT_PROVIDES(schcCONTEXT_FILE)
+#endif
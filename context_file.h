@@ -0,0 +1,152 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ */
+#ifndef _SCHC_CONTEXT_FILE_H_
+#define _SCHC_CONTEXT_FILE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "schc.h"
+
+#ifndef USE_CONTEXT_FILE
+#define USE_CONTEXT_FILE				0
+#endif
+
+#define CONTEXT_FILE_MAGIC				0x58434353 // "SCCX"
+#define CONTEXT_FILE_VERSION			1
+#define CONTEXT_FILE_ALIGN				8 // of each section
+
+/* the matching operators of a field in a context file */
+#define CONTEXT_MO_EQUAL				0
+#define CONTEXT_MO_IGNORE				1
+#define CONTEXT_MO_MSB					2
+#define CONTEXT_MO_MATCHMAP				3
+
+/* no layer rule, in context_compression_rule_t */
+#define CONTEXT_NONE					0xFFFFFFFF
+
+/*
+ * A context file holds the devices and their rules, in the byte order of the host,
+ * in sections that are referred to by their offset in the file
+ * and by the index of a record in a section, never by a pointer,
+ * so the file can be mapped at any address and shared by processes.
+ * Devices with the same uncompressed rule id and rules share one context,
+ * rules shared by several contexts are stored once.
+ */
+typedef struct context_file_header_t {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint64_t file_size;
+	uint32_t device_count;
+	/* the slots of the device table, which holds the position of each device
+	 * plus one, 0 if empty, at the hash of its id, see device_hash() in schc.c */
+	uint32_t device_table_size;
+	uint32_t context_count;
+	uint32_t compression_rule_count;
+	uint32_t layer_rule_count;
+	uint32_t field_count;
+	uint32_t fragmentation_rule_count;
+	uint32_t index_count;
+	uint32_t value_size;
+	uint32_t reserved;
+	/* the offsets of the sections */
+	uint64_t devices;
+	uint64_t device_table;
+	uint64_t contexts;
+	uint64_t compression_rules;
+	uint64_t layer_rules;
+	uint64_t fields;
+	uint64_t fragmentation_rules;
+	uint64_t indices;
+	uint64_t values;
+} context_file_header_t;
+
+typedef struct context_device_t {
+	uint64_t device_id;
+	uint32_t context;
+	uint32_t reserved;
+} context_device_t;
+
+/* the rules of a context are a list of indices in the indices section */
+typedef struct context_context_t {
+	uint32_t uncomp_rule_id;
+	uint8_t uncomp_rule_id_size_bits;
+	uint8_t compression_rule_count;
+	uint8_t fragmentation_rule_count;
+	uint8_t reserved;
+	uint32_t compression_rules;
+	uint32_t fragmentation_rules;
+} context_context_t;
+
+typedef struct context_compression_rule_t {
+	uint32_t rule_id;
+	uint8_t rule_id_size_bits;
+	uint8_t reserved[3];
+	/* the layer rules, indexed by schc_layer_t, or CONTEXT_NONE */
+	uint32_t layers[3];
+} context_compression_rule_t;
+
+/* the fields of a layer rule are consecutive in the fields section */
+typedef struct context_layer_rule_t {
+	uint8_t up;
+	uint8_t down;
+	uint8_t length;
+	uint8_t layer;
+	uint32_t fields;
+} context_layer_rule_t;
+
+/* the target value is stored in the values section, without its trailing zeros */
+typedef struct context_field_t {
+	uint16_t field;
+	uint8_t MO_param_length;
+	uint8_t field_length;
+	uint8_t field_pos;
+	uint8_t dir;
+	uint8_t MO;
+	uint8_t action;
+	uint32_t value;
+	uint16_t value_length;
+	uint16_t reserved;
+} context_field_t;
+
+typedef struct context_fragmentation_rule_t {
+	uint32_t rule_id;
+	uint8_t rule_id_size_bits;
+	uint8_t mode;
+	uint8_t dir;
+	uint8_t FCN_SIZE;
+	uint8_t MAX_WND_FCN;
+	uint8_t WINDOW_SIZE;
+	uint8_t DTAG_SIZE;
+	uint8_t reserved;
+} context_fragmentation_rule_t;
+
+uint8_t schc_context_file_write(FILE* file, uint32_t device_count,
+		struct schc_device* (*get_device)(uint32_t index));
+uint8_t schc_context_file_load(const char* path);
+void schc_context_file_unload(void);
+
+uint8_t schc_context_file_loaded(void);
+uint32_t schc_context_file_device_count(void);
+struct schc_device* schc_context_file_device_by_index(uint32_t index);
+struct schc_device* schc_context_file_device_by_id(schc_device_id_t device_id);
+void schc_context_file_prefetch(schc_device_id_t device_id, uint8_t step);
+uint32_t schc_context_file_context_count(void);
+struct schc_device* schc_context_file_context_by_index(uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * (c) 2018 - 2022  idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * This example compresses and decompresses a burst of packets
+ * of several devices with the batch API, checks the result against
+ * the single packet API and compares the throughput of both,
+ * for the devices of the rules and for a million devices of a context file
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../compressor.h"
+#include "../context_file.h"
+
+#define MAX_PACKET_LENGTH		128
+#define BURST_LENGTH			64
+#define ROUNDS					2000
+
+#define DEVICES					1000000 /* devices in the context file */
+#define GENERATED_ID			0x100000000ULL /* the id of the first generated device */
+#define COLD_PACKETS			(64 * 1024) /* packets of random devices */
+#define COLD_ROUNDS				4
+
+#define DIRECTION 				1 /* 0 = UP, 1 = DOWN */
+
+/* the IPv6/UDP/CoAP packet of compress.c, direction DOWN */
+static const uint8_t msg[] = {
+		/* IPv6 header */
+		0x60, 0x00, 0x00, 0x00, 0x00, 0x1E, 0x11, 0x40, 0xAA, 0xAA,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x01, 0xCC, 0xCC, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+		/* UDP header */
+		0x33, 0x16, 0x33, 0x16, 0x00, 0x1E, 0x05, 0x2C,
+		/* CoAP header */
+		0x54, 0x03, 0x23, 0xBB, 0x21, 0xFA, 0x01, 0xFB, 0xB5, 0x75,
+		0x73, 0x61, 0x67, 0x65, 0xD1, 0xEA, 0x1A, 0xFF,
+		/* Data */
+		0x01, 0x02, 0x03, 0x04 };
+
+/* the devices of rules_example.h, interleaved in the burst */
+static const schc_device_id_t device_ids[] = { 0x06, 0x01 };
+
+static uint8_t packets[BURST_LENGTH][sizeof(msg)];
+static uint8_t compressed[BURST_LENGTH][MAX_PACKET_LENGTH];
+static uint8_t reference[BURST_LENGTH][MAX_PACKET_LENGTH];
+static uint8_t decompressed[BURST_LENGTH][MAX_PACKET_LENGTH];
+static uint8_t reference_packets[BURST_LENGTH][MAX_PACKET_LENGTH];
+static schc_bitarray_t bit_arr[BURST_LENGTH];
+static schc_packet_t burst[BURST_LENGTH];
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* every packet has its own token and payload, the decompressor sets the UDP checksum */
+static void init_burst(void) {
+	int i;
+	for (i = 0; i < BURST_LENGTH; i++) {
+		memcpy(packets[i], msg, sizeof(msg));
+		packets[i][55] = (uint8_t) i; /* the last byte of the token */
+		packets[i][sizeof(msg) - 1] = (uint8_t) (i * 7);
+		burst[i].data = packets[i];
+		burst[i].length = sizeof(msg);
+		burst[i].bit_arr = &bit_arr[i];
+		burst[i].device_id = device_ids[(i / 3) % 2];
+	}
+}
+
+static void reset_bit_arrays(void) {
+	int i;
+	for (i = 0; i < BURST_LENGTH; i++) {
+		bit_arr[i] = (schc_bitarray_t) SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, compressed[i]);
+	}
+}
+
+/*
+ * compress and decompress the burst with both APIs
+ *
+ * @return 	the number of packets that differ
+ */
+static int check_burst(schc_compressor_context_t* ctx) {
+	int i, err = 0;
+	uint16_t len[BURST_LENGTH], packet_len[BURST_LENGTH];
+
+	for (i = 0; i < BURST_LENGTH; i++) {
+		schc_bitarray_t arr = SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, reference[i]);
+		schc_compress(packets[i], sizeof(msg), &arr, burst[i].device_id, DIRECTION);
+		len[i] = arr.len;
+		packet_len[i] = schc_decompress(&arr, reference_packets[i], burst[i].device_id, arr.len,
+				DIRECTION);
+	}
+
+	reset_bit_arrays();
+	if (schc_compress_batch(ctx, burst, BURST_LENGTH, DIRECTION) != BURST_LENGTH) {
+		printf("main(): not every packet of the burst was compressed\n");
+		return BURST_LENGTH;
+	}
+	for (i = 0; i < BURST_LENGTH; i++) {
+		if (bit_arr[i].len != len[i] || memcmp(compressed[i], reference[i], len[i])) {
+			printf("main(): packet %d is compressed differently by the batch\n", i);
+			err++;
+		}
+		burst[i].data = decompressed[i];
+	}
+
+	if (schc_decompress_batch(burst, BURST_LENGTH, DIRECTION) != BURST_LENGTH) {
+		printf("main(): not every packet of the burst was decompressed\n");
+		err = BURST_LENGTH;
+	}
+	for (i = 0; i < BURST_LENGTH; i++) {
+		if (burst[i].length != packet_len[i]
+				|| memcmp(decompressed[i], reference_packets[i], packet_len[i])) {
+			printf("main(): packet %d is decompressed differently by the batch\n", i);
+			err++;
+		}
+		burst[i].data = packets[i];
+	}
+
+	return err;
+}
+
+static void time_single(void) {
+	int r, i;
+	uint64_t ns = now_ns();
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < BURST_LENGTH; i++) {
+			bit_arr[i] = (schc_bitarray_t) SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, compressed[i]);
+			schc_compress(packets[i], sizeof(msg), &bit_arr[i], burst[i].device_id, DIRECTION);
+		}
+	}
+	uint64_t compress_ns = now_ns() - ns;
+
+	ns = now_ns();
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < BURST_LENGTH; i++) {
+			schc_decompress(&bit_arr[i], decompressed[i], burst[i].device_id, bit_arr[i].len,
+					DIRECTION);
+		}
+	}
+	uint64_t decompress_ns = now_ns() - ns;
+
+	printf("%-10s%16.1f%16.1f\n", "single",
+			(double) compress_ns / (ROUNDS * BURST_LENGTH),
+			(double) decompress_ns / (ROUNDS * BURST_LENGTH));
+}
+
+static void time_batch(schc_compressor_context_t* ctx) {
+	int r, i;
+	uint64_t ns = now_ns();
+	for (r = 0; r < ROUNDS; r++) {
+		reset_bit_arrays();
+		schc_compress_batch(ctx, burst, BURST_LENGTH, DIRECTION);
+	}
+	uint64_t compress_ns = now_ns() - ns;
+
+	for (i = 0; i < BURST_LENGTH; i++) {
+		burst[i].data = decompressed[i];
+	}
+	ns = now_ns();
+	for (r = 0; r < ROUNDS; r++) {
+		schc_decompress_batch(burst, BURST_LENGTH, DIRECTION);
+	}
+	uint64_t decompress_ns = now_ns() - ns;
+	for (i = 0; i < BURST_LENGTH; i++) {
+		burst[i].data = packets[i];
+	}
+
+	printf("%-10s%16.1f%16.1f\n", "batch",
+			(double) compress_ns / (ROUNDS * BURST_LENGTH),
+			(double) decompress_ns / (ROUNDS * BURST_LENGTH));
+}
+
+#if USE_CONTEXT_FILE == 1
+static uint32_t configured_devices;
+static uint8_t (*cold_packets)[sizeof(msg)];
+static uint8_t (*cold_compressed)[MAX_PACKET_LENGTH];
+static schc_bitarray_t* cold_bit_arr;
+static schc_packet_t* cold_burst;
+
+/* the devices of the rule configuration, followed by copies with a generated id */
+static struct schc_device* get_device(uint32_t index) {
+	static struct schc_device device;
+	if (index < configured_devices) {
+		return get_device_by_index(index);
+	}
+	device = *get_device_by_index(index % configured_devices);
+	device.device_id = GENERATED_ID + index;
+	return &device;
+}
+
+/* the packets go to random devices, in runs of packets_per_device */
+static void init_cold_packets(uint8_t packets_per_device) {
+	int i;
+	for (i = 0; i < COLD_PACKETS; i++) {
+		memcpy(cold_packets[i], msg, sizeof(msg));
+		cold_packets[i][55] = (uint8_t) i; /* the last byte of the token */
+		cold_burst[i].data = cold_packets[i];
+		cold_burst[i].length = sizeof(msg);
+		cold_burst[i].bit_arr = &cold_bit_arr[i];
+		cold_burst[i].device_id = (i % packets_per_device) ? cold_burst[i - 1].device_id
+				: GENERATED_ID + configured_devices + ((uint32_t) rand() % (DEVICES - configured_devices));
+	}
+}
+
+/*
+ * compress the packets of many devices, a burst at a time,
+ * with both APIs in turn, so both see the same cache misses and noise
+ *
+ * @return 	the number of packets that differ
+ */
+static int time_cold(schc_compressor_context_t* ctx, uint8_t packets_per_device) {
+	uint64_t ns[2] = { 0, 0 };
+	int r, i, j, err = 0;
+
+	for (r = 0; r < COLD_ROUNDS; r++) {
+		init_cold_packets(packets_per_device);
+		for (i = 0; i < COLD_PACKETS; i += BURST_LENGTH) {
+			uint8_t batch = ((i / BURST_LENGTH) + r) % 2;
+			uint64_t start = now_ns();
+			for (j = i; j < i + BURST_LENGTH; j++) {
+				cold_bit_arr[j] = (schc_bitarray_t) SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, cold_compressed[j]);
+				if (!batch) {
+					schc_compress_ctx(ctx, cold_packets[j], sizeof(msg), &cold_bit_arr[j],
+							cold_burst[j].device_id, DIRECTION);
+				}
+			}
+			if (batch) {
+				schc_compress_batch(ctx, cold_burst + i, BURST_LENGTH, DIRECTION);
+			}
+			ns[batch] += now_ns() - start;
+		}
+		for (i = 0; i < COLD_PACKETS; i++) { // both APIs compress a packet alike
+			uint8_t single[MAX_PACKET_LENGTH];
+			schc_bitarray_t arr = SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, single);
+			schc_compress_ctx(ctx, cold_packets[i], sizeof(msg), &arr, cold_burst[i].device_id, DIRECTION);
+			err += (arr.len == 0 || arr.len != cold_bit_arr[i].len
+					|| memcmp(single, cold_compressed[i], arr.len));
+		}
+	}
+
+	printf("%-10u%16.1f%16.1f\n", packets_per_device,
+			(double) ns[0] / (COLD_ROUNDS * COLD_PACKETS / 2),
+			(double) ns[1] / (COLD_ROUNDS * COLD_PACKETS / 2));
+	return err;
+}
+#endif
+
+int main() {
+	schc_compressor_context_t ctx;
+
+	if(!schc_compressor_init()) {
+		return 1;
+	}
+	schc_compressor_context_init(&ctx);
+	init_burst();
+
+	int err = check_burst(&ctx);
+	if (err) {
+		printf("main(): %d packets differ\n", err);
+		return 1;
+	}
+	printf("main(): the batch matches the single packet API\n");
+
+	printf("\n%-10s%16s%16s\n", "api", "compress ns", "decompress ns");
+	time_single();
+	time_batch(&ctx);
+
+#if USE_CONTEXT_FILE == 1
+	/* a gateway with many devices, of which a burst holds a few packets each */
+	const char* path = "batch.bin";
+	configured_devices = get_device_count();
+	FILE* file = fopen(path, "wb");
+	if (file == NULL || !schc_context_file_write(file, DEVICES, &get_device)) {
+		printf("main(): could not write %s\n", path);
+		return 1;
+	}
+	fclose(file);
+	uint8_t loaded = schc_context_file_load(path) && schc_compressor_init();
+	remove(path);
+	if (!loaded) {
+		printf("main(): could not load %s\n", path);
+		return 1;
+	}
+
+	cold_packets = malloc(COLD_PACKETS * sizeof(*cold_packets));
+	cold_compressed = malloc(COLD_PACKETS * sizeof(*cold_compressed));
+	cold_bit_arr = malloc(COLD_PACKETS * sizeof(*cold_bit_arr));
+	cold_burst = malloc(COLD_PACKETS * sizeof(*cold_burst));
+	if (!cold_packets || !cold_compressed || !cold_bit_arr || !cold_burst) {
+		return 1;
+	}
+
+	printf("\n%d devices, %d packets of random devices\n", DEVICES, COLD_PACKETS);
+	printf("%-10s%16s%16s\n", "packets", "single ns", "batch ns");
+	srand(1);
+	err = time_cold(&ctx, 1) + time_cold(&ctx, 4);
+	schc_context_file_unload();
+	if (err) {
+		printf("main(): %d packets of the context file differ\n", err);
+		return 1;
+	}
+	printf("main(): the batch matches the single packet API for the devices of the context file\n");
+#endif
+
+	return 0;
+}
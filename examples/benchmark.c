@@ -0,0 +1,456 @@
+/*
+ * (c) 2018 - 2022  idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * This example benchmarks the bit operations and the MIC backends
+ * and checks every kernel against a naive, bit by bit reference
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../bit_operations.h"
+#include "../mic.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS()					__rdtsc()
+#define TICK_UNIT				"cycle"
+#else
+#define TICKS()					now_ns()
+#define TICK_UNIT				"ns"
+#endif
+
+/* the number of bytes to run through each MIC backend per packet size */
+#define BYTES_PER_RUN			(16 * 1024 * 1024)
+#define MAX_BUFFER_LENGTH		65536
+
+/* the bit kernels run on lengths of 1 bit up to 2 KB */
+#define MAX_KERNEL_BITS			(2048 * 8)
+#define KERNEL_BUFFER_LENGTH	((MAX_KERNEL_BITS / 8) + 64)
+#define BYTES_PER_KERNEL		(4 * 1024 * 1024)
+#define MIN_KERNEL_OPS			20000
+#define RANDOM_CHECKS			200
+
+typedef uint32_t (*mic_backend_t)(uint32_t crc, const uint8_t* data, uint32_t len);
+
+struct backend {
+	const char* name;
+	mic_backend_t update;
+};
+
+static const struct backend backends[] = {
+	{ "bitwise", mic_crc32_bitwise },
+	{ "nibble", mic_crc32_nibble },
+	{ "slicing8", mic_crc32_slicing8 },
+	{ "hw", mic_crc32_hw },
+};
+
+/* packet sizes: a LoRaWAN tile, a small MTU, an Ethernet frame, a bulk transfer */
+static const uint32_t sizes[] = { 11, 51, 242, 1500, MAX_BUFFER_LENGTH };
+
+/* bit lengths for the kernel timings */
+static const uint32_t kernel_bits[] = { 1, 7, 32, 100, 1024, 4096, MAX_KERNEL_BITS };
+
+typedef enum {
+	COPY_BITS,
+	COMPARE_BITS,
+	COMPARE_BITS_ALIGNED,
+	COMPARE_BIT_SEQUENCE,
+	GET_BITS,
+	SHIFT_BITS_LEFT,
+	SHIFT_BITS_RIGHT,
+	XOR_BITS,
+	MIC_UPDATE,
+	KERNEL_CNT
+} kernel_t;
+
+static const char* kernel_names[KERNEL_CNT] = {
+	"copy_bits",
+	"compare_bits",
+	"compare_bits_aligned",
+	"compare_bit_sequence",
+	"get_bits",
+	"shift_bits_left",
+	"shift_bits_right",
+	"xor_bits",
+	"mic_update",
+};
+
+static uint8_t buffer[MAX_BUFFER_LENGTH];
+
+static uint8_t src[KERNEL_BUFFER_LENGTH];
+static uint8_t cmp[KERNEL_BUFFER_LENGTH];
+static uint8_t dst[KERNEL_BUFFER_LENGTH];
+static uint8_t ref[KERNEL_BUFFER_LENGTH];
+
+static volatile uint32_t sink;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void fill_random(uint8_t* p, uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		p[i] = (uint8_t) rand();
+	}
+}
+
+/*
+ * the naive reference implementations
+ * bits are numbered msb first, unless noted otherwise
+ */
+static uint8_t ref_get_bit(const uint8_t* a, uint32_t i) {
+	return (a[i / 8] >> (7 - (i % 8))) & 1;
+}
+
+static void ref_put_bit(uint8_t* a, uint32_t i, uint8_t bit) {
+	if (bit) {
+		a[i / 8] |= 128 >> (i % 8);
+	} else {
+		a[i / 8] &= ~(128 >> (i % 8));
+	}
+}
+
+static void ref_copy_bits(uint8_t* d, uint32_t dst_pos, const uint8_t* s, uint32_t src_pos,
+		uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		if (ref_get_bit(s, src_pos + i)) {
+			ref_put_bit(d, dst_pos + i, 1);
+		}
+	}
+}
+
+static uint8_t ref_compare_bits(const uint8_t* s1, uint32_t pos1, const uint8_t* s2,
+		uint32_t pos2, uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		if (ref_get_bit(s1, pos1 + i) != ref_get_bit(s2, pos2 + i)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* compare_bit_sequence() numbers the bits of a byte lsb first */
+static uint8_t ref_compare_bit_sequence(const uint8_t* s1, uint32_t pos1, const uint8_t* s2,
+		uint32_t pos2, uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		if (((s1[(pos1 + i) / 8] >> ((pos1 + i) % 8)) & 1)
+				!= ((s2[(pos2 + i) / 8] >> ((pos2 + i) % 8)) & 1)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint32_t ref_get_bits(const uint8_t* a, uint32_t pos, uint8_t len) {
+	uint32_t i, value = 0;
+	for (i = 0; i < len; i++) {
+		value = (value << 1) | ref_get_bit(a, pos + i);
+	}
+	return value;
+}
+
+/* shift a byte array towards the first bit, zero filled */
+static void ref_shift_bits_left(uint8_t* a, uint16_t len, uint32_t shift) {
+	uint8_t tmp[KERNEL_BUFFER_LENGTH];
+	uint32_t i, bits = (uint32_t) len * 8;
+	memcpy(tmp, a, len);
+	for (i = 0; i < bits; i++) {
+		ref_put_bit(a, i, ((i + shift) < bits) ? ref_get_bit(tmp, i + shift) : 0);
+	}
+}
+
+/* shift a byte array towards the last bit, zero filled */
+static void ref_shift_bits_right(uint8_t* a, uint16_t len, uint32_t shift) {
+	uint8_t tmp[KERNEL_BUFFER_LENGTH];
+	uint32_t i, bits = (uint32_t) len * 8;
+	memcpy(tmp, a, len);
+	for (i = 0; i < bits; i++) {
+		ref_put_bit(a, i, (i >= shift) ? ref_get_bit(tmp, i - shift) : 0);
+	}
+}
+
+static void ref_xor_bits(uint8_t* d, const uint8_t* s1, const uint8_t* s2, uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		if (ref_get_bit(s1, i) ^ ref_get_bit(s2, i)) {
+			ref_put_bit(d, i, 1);
+		}
+	}
+}
+
+/*
+ * prepare the compare buffer so the sequences match,
+ * or differ in a single bit
+ */
+static void prepare_compare(kernel_t k, uint32_t dst_off, uint32_t src_off, uint32_t len,
+		uint8_t differ) {
+	uint32_t i, flip = (len > 1) ? (uint32_t) rand() % len : 0;
+
+	fill_random(cmp, BITS_TO_BYTES(dst_off + len) + 16);
+	for (i = 0; i < len; i++) {
+		uint32_t s = src_off + i, d = dst_off + i;
+		uint8_t bit = (k == COMPARE_BIT_SEQUENCE) ?
+				(src[s / 8] >> (s % 8)) & 1 : ref_get_bit(src, s);
+		if (differ && (i == flip)) {
+			bit ^= 1;
+		}
+		if (k == COMPARE_BIT_SEQUENCE) {
+			cmp[d / 8] = (cmp[d / 8] & ~(1 << (d % 8))) | (bit << (d % 8));
+		} else {
+			ref_put_bit(cmp, d, bit);
+		}
+	}
+}
+
+/*
+ * run a kernel once
+ * the offsets are ignored by the byte aligned kernels,
+ * the shifts use them as the shift (0 - 63 bits)
+ * and mic_update uses the source offset as byte misalignment
+ */
+static void run_kernel(kernel_t k, uint32_t dst_off, uint32_t src_off, uint32_t len) {
+	switch (k) {
+	case COPY_BITS:
+		copy_bits(dst, dst_off, src, src_off, len);
+		break;
+	case COMPARE_BITS:
+		sink += compare_bits(src, cmp, len);
+		break;
+	case COMPARE_BITS_ALIGNED:
+		sink += compare_bits_aligned(src, src_off, cmp, dst_off, len);
+		break;
+	case COMPARE_BIT_SEQUENCE:
+		sink += compare_bit_sequence(src, src_off, cmp, dst_off, len);
+		break;
+	case GET_BITS:
+		sink += get_bits(src, src_off, (len > 32) ? 32 : len);
+		break;
+	case SHIFT_BITS_LEFT:
+		shift_bits_left(dst, BITS_TO_BYTES(len), (dst_off * 8) + src_off);
+		break;
+	case SHIFT_BITS_RIGHT:
+		shift_bits_right(dst, BITS_TO_BYTES(len), (dst_off * 8) + src_off);
+		break;
+	case XOR_BITS:
+		xor_bits(dst, src, cmp, len);
+		break;
+	case MIC_UPDATE:
+		sink += mic_update(mic_init(), src + src_off, BITS_TO_BYTES(len));
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * run a kernel and its reference on the same input
+ *
+ * @return 	1			the kernel matches the reference
+ * 			0			the kernel differs
+ */
+static uint8_t check_kernel(kernel_t k, uint32_t dst_off, uint32_t src_off, uint32_t len) {
+	uint32_t bytes = BITS_TO_BYTES(len);
+	uint8_t differ = rand() & 1;
+
+	fill_random(src, bytes + 16);
+	fill_random(dst, bytes + 16);
+	fill_random(cmp, bytes + 16);
+	memcpy(ref, dst, sizeof(ref));
+
+	switch (k) {
+	case COPY_BITS:
+		copy_bits(dst, dst_off, src, src_off, len);
+		ref_copy_bits(ref, dst_off, src, src_off, len);
+		break;
+	case COMPARE_BITS:
+		prepare_compare(k, 0, 0, len, differ);
+		return compare_bits(src, cmp, len) == ref_compare_bits(src, 0, cmp, 0, len);
+	case COMPARE_BITS_ALIGNED:
+		prepare_compare(k, dst_off, src_off, len, differ);
+		return compare_bits_aligned(src, src_off, cmp, dst_off, len)
+				== ref_compare_bits(src, src_off, cmp, dst_off, len);
+	case COMPARE_BIT_SEQUENCE:
+		prepare_compare(k, dst_off, src_off, len, differ);
+		return compare_bit_sequence(src, src_off, cmp, dst_off, len)
+				== ref_compare_bit_sequence(src, src_off, cmp, dst_off, len);
+	case GET_BITS:
+		len = (len > 32) ? 32 : len;
+		return get_bits(src, src_off, len) == ref_get_bits(src, src_off, len);
+	case SHIFT_BITS_LEFT:
+		shift_bits_left(dst, bytes, (dst_off * 8) + src_off);
+		ref_shift_bits_left(ref, bytes, (dst_off * 8) + src_off);
+		break;
+	case SHIFT_BITS_RIGHT:
+		shift_bits_right(dst, bytes, (dst_off * 8) + src_off);
+		ref_shift_bits_right(ref, bytes, (dst_off * 8) + src_off);
+		break;
+	case XOR_BITS:
+		xor_bits(dst, src, cmp, len);
+		ref_xor_bits(ref, src, cmp, len);
+		break;
+	case MIC_UPDATE:
+		return mic_update(mic_init(), src + src_off, bytes)
+				== mic_crc32_bitwise(mic_init(), src + src_off, bytes);
+	default:
+		break;
+	}
+
+	/* the bytes following the kernel output must be left untouched too */
+	return memcmp(dst, ref, sizeof(dst)) == 0;
+}
+
+/*
+ * check a kernel at every length up to 300 bits and at random lengths up to 2 KB,
+ * each with all 8 x 8 destination and source bit offsets
+ *
+ * @return 	the number of mismatches
+ */
+static uint32_t check_bit_kernel(kernel_t k) {
+	uint32_t len, n, dst_off, src_off, errors = 0;
+
+	for (n = 0; n < (300 + RANDOM_CHECKS); n++) {
+		len = (n < 300) ? n + 1 : 1 + ((uint32_t) rand() % MAX_KERNEL_BITS);
+		for (dst_off = 0; dst_off < 8; dst_off++) {
+			for (src_off = 0; src_off < 8; src_off++) {
+				if (!check_kernel(k, dst_off, src_off, len)) {
+					if (!errors) {
+						printf("%s differs from the reference for %u bits at offsets %u, %u\n",
+								kernel_names[k], len, dst_off, src_off);
+					}
+					errors++;
+				}
+			}
+		}
+	}
+
+	return errors;
+}
+
+/*
+ * time a kernel over all 8 x 8 offset pairs,
+ * the compares run on equal sequences (the slowest case),
+ * with the second sequence 3 bits further than the first
+ */
+static void time_bit_kernel(kernel_t k, uint32_t len) {
+	uint8_t compare = (k == COMPARE_BITS_ALIGNED || k == COMPARE_BIT_SEQUENCE);
+	uint32_t i, ops = BYTES_PER_KERNEL / BITS_TO_BYTES(len);
+	if (ops < MIN_KERNEL_OPS) {
+		ops = MIN_KERNEL_OPS;
+	}
+
+	fill_random(src, sizeof(src));
+	fill_random(dst, sizeof(dst));
+	prepare_compare(k, compare ? 3 : 0, 0, len + 8, 0);
+
+	uint64_t ns = now_ns();
+	uint64_t start = TICKS();
+	for (i = 0; i < ops; i++) {
+		if (compare) {
+			run_kernel(k, (i % 8) + 3, i % 8, len);
+		} else {
+			run_kernel(k, (i % 64) / 8, i % 8, len);
+		}
+	}
+	uint64_t ticks = TICKS() - start;
+	ns = now_ns() - ns;
+
+	printf("%-22s%10u%12.2f%14.3f\n", kernel_names[k], len,
+			(double) ns / (double) ops,
+			((double) len / 8.0 * ops) / (double) (ticks ? ticks : 1));
+}
+
+static int bench_bit_kernels(void) {
+	uint32_t j, k, errors = 0;
+
+	for (k = 0; k < KERNEL_CNT; k++) {
+		uint32_t e = check_bit_kernel((kernel_t) k);
+		if (e) {
+			printf("%s: %u mismatches\n", kernel_names[k], e);
+		}
+		errors += e;
+	}
+
+	printf("\n%-22s%10s%12s%14s\n", "kernel", "bits", "ns/op", "bytes/" TICK_UNIT);
+	for (k = 0; k < KERNEL_CNT; k++) {
+		for (j = 0; j < sizeof(kernel_bits) / sizeof(kernel_bits[0]); j++) {
+			if (k == GET_BITS && kernel_bits[j] > 32) {
+				break; // get_bits() returns at most 32 bits
+			}
+			time_bit_kernel((kernel_t) k, kernel_bits[j]);
+		}
+	}
+
+	return errors ? 1 : 0;
+}
+
+static int bench_mic_backends(void) {
+	uint32_t i, j, k;
+
+	for (i = 0; i < MAX_BUFFER_LENGTH; i++) {
+		buffer[i] = (uint8_t) rand();
+	}
+
+	printf("\nhardware MIC path: %s\n", mic_hw_available() ? "yes" : "no");
+
+	/* every backend must produce the reference MIC, at every length and alignment */
+	for (i = 0; i < 300; i++) {
+		uint32_t offset = i % 16;
+		uint32_t ref = mic_final(mic_crc32_bitwise(mic_init(), buffer + offset, i));
+		for (k = 1; k < sizeof(backends) / sizeof(backends[0]); k++) {
+			uint32_t crc = mic_final(backends[k].update(mic_init(), buffer + offset, i));
+			if (crc != ref) {
+				printf("main(): %s MIC %08X differs from %08X for %d bytes\n",
+						backends[k].name, crc, ref, i);
+				return 1;
+			}
+		}
+	}
+
+	printf("%-10s", "bytes");
+	for (k = 0; k < sizeof(backends) / sizeof(backends[0]); k++) {
+		printf("%12s", backends[k].name);
+	}
+	printf("   (bytes/%s)\n", TICK_UNIT);
+
+	for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		uint32_t runs = BYTES_PER_RUN / sizes[j];
+		printf("%-10u", sizes[j]);
+		for (k = 0; k < sizeof(backends) / sizeof(backends[0]); k++) {
+			uint32_t n = (k == 0) ? (runs / 8) + 1 : runs; // the bitwise loop is slow
+			uint64_t start = TICKS();
+			for (i = 0; i < n; i++) {
+				sink ^= backends[k].update(mic_init(), buffer, sizes[j]);
+			}
+			uint64_t ticks = TICKS() - start;
+			printf("%12.3f", ((double) n * sizes[j]) / (double) (ticks ? ticks : 1));
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
+
+int main() {
+	int ret;
+
+	srand(1);
+	ret = bench_bit_kernels();
+	ret |= bench_mic_backends();
+
+	return ret;
+}
@@ -12,8 +12,10 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "../compressor.h"
+#include "../trace.h"
 
 #define MAX_PACKET_LENGTH		128
 
@@ -53,7 +55,7 @@ uint8_t msg[] = {
 				/* Data */
 				0x01, 0x02, 0x03, 0x04 };
 
-int main() {
+int main(int argc, char *argv[]) {
 	/* COMPRESSION */
 	/* initialize the client compressor */
 	if(!schc_compressor_init()) {
@@ -61,7 +63,7 @@ int main() {
 	}
 
 	uint8_t compressed_buf[MAX_PACKET_LENGTH] = { 0 };
-	uint32_t device_id = 0x06;
+	schc_device_id_t device_id = 0x06;
 
 	/* compress packet */
 	struct schc_compression_rule_t *schc_rule;
@@ -155,5 +157,37 @@ int main() {
 		printf("main(): decompression succeeded\n");
 	}
 
+	/* decompress again, leaving the payload in the compressed packet */
+	unsigned char header_buf[MAX_PACKET_LENGTH] = { 0 };
+	unsigned char gathered[MAX_PACKET_LENGTH];
+	schc_iovec_t iov[2];
+	uint16_t gathered_len = 0;
+	uint8_t iov_count = schc_decompress_iov(&c_bit_arr, header_buf, iov, device_id,
+			c_bit_arr.len, DIRECTION);
+	for (int i = 0; i < iov_count; i++) { /* or writev(fd, iov, iov_count) */
+		memcpy(gathered + gathered_len, iov[i].iov_base, iov[i].iov_len);
+		gathered_len += iov[i].iov_len;
+	}
+	if (iov_count == 0 || gathered_len != new_packet_len || memcmp(gathered, decomp_buf, gathered_len)) {
+		printf("main(): an error occured while decompressing to an iovec\n");
+		err = 1;
+	} else {
+		printf("main(): decompression to %d iovec succeeded\n", iov_count);
+	}
+
+	/* print the tracepoints, or write them to be decoded by trace_decode */
+	printf("\n");
+	schc_trace_dump(schc_trace_ring(), stdout);
+	if (argc > 1) {
+		FILE* trace_file = fopen(argv[1], "wb");
+		if (trace_file == NULL || !schc_trace_write(schc_trace_ring(), trace_file)) {
+			printf("main(): could not write the trace to %s\n", argv[1]);
+			err = 1;
+		}
+		if (trace_file != NULL) {
+			fclose(trace_file);
+		}
+	}
+
 	return err;
 }
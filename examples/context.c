@@ -0,0 +1,148 @@
+/*
+ * (c) 2018 - 2022  idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * This example writes the rule configuration, extended with generated devices,
+ * to a context file, loads it and checks that the devices of the file
+ * compress a packet as the rule configuration does
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../compressor.h"
+#include "../context_file.h"
+
+#define MAX_PACKET_LENGTH		128
+#define DEVICES					1000000 /* devices in the context file */
+#define LOOKUPS					100000
+#define GENERATED_ID			0x100000000ULL /* the id of the first generated device */
+
+/* the IPv6/UDP/CoAP packet of compress.c, direction DOWN */
+static const uint8_t msg[] = {
+		/* IPv6 header */
+		0x60, 0x00, 0x00, 0x00, 0x00, 0x1E, 0x11, 0x40, 0xAA, 0xAA,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x01, 0xCC, 0xCC, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+		/* UDP header */
+		0x33, 0x16, 0x33, 0x16, 0x00, 0x1E, 0x05, 0x2C,
+		/* CoAP header */
+		0x54, 0x03, 0x23, 0xBB, 0x21, 0xFA, 0x01, 0xFB, 0xB5, 0x75,
+		0x73, 0x61, 0x67, 0x65, 0xD1, 0xEA, 0x1A, 0xFF,
+		/* Data */
+		0x01, 0x02, 0x03, 0x04 };
+
+static uint32_t configured_devices;
+static uint8_t reference[4][MAX_PACKET_LENGTH];
+static uint16_t reference_length[4];
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* the devices of the rule configuration, followed by copies with a generated id */
+static struct schc_device* get_device(uint32_t index) {
+	static struct schc_device device;
+	if (index < configured_devices) {
+		return get_device_by_index(index);
+	}
+	device = *get_device_by_index(index % configured_devices);
+	device.device_id = GENERATED_ID + index;
+	return &device;
+}
+
+static uint16_t compress(schc_device_id_t device_id, uint8_t* out) {
+	uint8_t packet[sizeof(msg)];
+	memcpy(packet, msg, sizeof(msg));
+	schc_bitarray_t bit_arr = SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, out);
+	schc_compress(packet, sizeof(msg), &bit_arr, device_id, DOWN);
+	return bit_arr.len;
+}
+
+/* compress with a device of the file, compare with the device of the configuration */
+static int check_device(schc_device_id_t device_id, uint32_t configured_index) {
+	uint8_t out[MAX_PACKET_LENGTH] = { 0 };
+	uint16_t len = compress(device_id, out);
+	if (len != reference_length[configured_index] || memcmp(out, reference[configured_index], len)) {
+		printf("device %llx: compressed packet differs from the rule configuration\n",
+				(unsigned long long) device_id);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char* path = (argc > 1) ? argv[1] : "context.bin";
+	uint32_t i, err = 0;
+
+	if (!schc_compressor_init()) {
+		return 1;
+	}
+	configured_devices = get_device_count();
+	if (configured_devices > 4) {
+		configured_devices = 4;
+	}
+	for (i = 0; i < configured_devices; i++) {
+		reference_length[i] = compress(get_device_by_index(i)->device_id, reference[i]);
+	}
+
+	FILE* file = fopen(path, "wb");
+	uint64_t start = now_ns();
+	if (file == NULL || !schc_context_file_write(file, DEVICES, &get_device)) {
+		printf("main(): could not write %s\n", path);
+		return 1;
+	}
+	fclose(file);
+	printf("wrote %d devices to %s in %.1f ms\n", DEVICES, path, (now_ns() - start) / 1e6);
+
+	start = now_ns();
+	if (!schc_context_file_load(path) || !schc_compressor_init()) {
+		printf("main(): could not load %s\n", path);
+		return 1;
+	}
+	printf("loaded %u devices in %.3f ms\n", get_device_count(), (now_ns() - start) / 1e6);
+
+	/* the configured devices and a sample of the generated ones */
+	for (i = 0; i < configured_devices; i++) {
+		err += check_device(get_device_by_index(i)->device_id, i);
+	}
+	srand(1);
+	start = now_ns();
+	for (i = 0; i < LOOKUPS; i++) {
+		uint32_t index = configured_devices + ((uint32_t) rand() % (DEVICES - configured_devices));
+		struct schc_device* device = get_device_by_id(GENERATED_ID + index);
+		if (device == NULL || device != get_device_by_index(index)) {
+			printf("device %u was not found\n", index);
+			err++;
+			break;
+		}
+	}
+	printf("looked up %d devices in %.1f ns per device\n", LOOKUPS,
+			(double) (now_ns() - start) / LOOKUPS);
+	for (i = configured_devices; i < DEVICES; i += DEVICES / 16) {
+		err += check_device(GENERATED_ID + i, i % configured_devices);
+	}
+	if (get_device_by_id(GENERATED_ID + DEVICES) != NULL) {
+		printf("an unknown device was found\n");
+		err++;
+	}
+
+	schc_context_file_unload();
+	if (argc < 2) {
+		remove(path);
+	}
+
+	printf("%s\n", err ? "the context file differs from the rule configuration" :
+			"the context file compresses as the rule configuration");
+	return err ? 1 : 0;
+}
@@ -17,10 +17,12 @@
 
 #include "../compressor.h"
 #include "../fragmenter.h"
+#include "../metrics.h"
 
 #include "timer.h"
 
 #define COMPRESS				1 /* indicate to start fragmentation with or without compression first */
+#define DETACHED				1 /* leave the payload in msg, the fragmenter shifts it into the fragments */
 
 #define MAX_PACKET_LENGTH		256
 #define MAX_TIMERS				256
@@ -239,10 +241,10 @@ static void set_rx_timer(schc_fragmentation_t *conn, void (*callback)(void* arg)
  * (required by some timer libraries)
  */
 void remove_timer_entry(schc_fragmentation_t *conn) {
-	DEBUG_PRINTF("remove_timer_entry(): remove timer entry for device with id %d \n", conn->device_id);
+	DEBUG_PRINTF("remove_timer_entry(): remove timer entry for device with id %" PRIu64 " \n", conn->device_id);
 }
 
-void received_packet(uint8_t* data, uint16_t length, uint32_t device_id, schc_fragmentation_t* receiving_conn) {
+void received_packet(uint8_t* data, uint16_t length, schc_device_id_t device_id, schc_fragmentation_t* receiving_conn) {
 
 	DEBUG_PRINTF("\n+-------- RX  %02d --------+\n", counter);
 
@@ -271,20 +273,20 @@ void received_packet(uint8_t* data, uint16_t length, uint32_t device_id, schc_fr
  * whether the network driver is busy or not
  *
  */
-uint8_t tx_send_callback(uint8_t* data, uint16_t length, uint32_t device_id) {
-	DEBUG_PRINTF("tx_send_callback(): transmitting packet with length %d for device %d \n", length, device_id);
+uint8_t tx_send_callback(uint8_t* data, uint16_t length, schc_device_id_t device_id) {
+	DEBUG_PRINTF("tx_send_callback(): transmitting packet with length %d for device %" PRIu64 " \n", length, device_id);
 	received_packet(data, length, device_id, &tx_conn_nwgw); // send packet to network gateway
 	return 1;
 }
 
-uint8_t rx_send_callback(uint8_t* data, uint16_t length, uint32_t device_id) {
-	DEBUG_PRINTF("rx_send_callback(): transmitting packet with length %d for device %d \n", length, device_id);
+uint8_t rx_send_callback(uint8_t* data, uint16_t length, schc_device_id_t device_id) {
+	DEBUG_PRINTF("rx_send_callback(): transmitting packet with length %d for device %" PRIu64 " \n", length, device_id);
 	// received_packet(data, length, device_id, &tx_conn); // send packet to constrained device
 	return 1;
 }
 
 void free_callback(schc_fragmentation_t *conn) {
-	DEBUG_PRINTF("free_callback(): freeing connections for device %d\n", conn->device_id);
+	DEBUG_PRINTF("free_callback(): freeing connections for device %" PRIu64 "\n", conn->device_id);
 }
 
 void init() {
@@ -311,13 +313,22 @@ void init() {
 int main() {
 	init();
 
-	uint32_t device_id = 0x01;
+	schc_device_id_t device_id = 0x01;
 	struct schc_compression_rule_t* schc_rule;
 
 #if COMPRESS
 	uint8_t compressed_packet[MAX_PACKET_LENGTH];
 	schc_bitarray_t bit_arr		= SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, compressed_packet);
+#if DETACHED
+	schc_compressor_context_t compressor_ctx;
+	schc_iovec_t payload;
+	schc_compressor_context_init(&compressor_ctx);
+	schc_rule 					= schc_compress_detached(&compressor_ctx, msg, sizeof(msg), &bit_arr,
+			&payload, device_id, UP); /* only the compressed header is written to bit_arr */
+	tx_conn.payload 			= payload.iov_base;
+#else
 	schc_rule 					= schc_compress(msg, sizeof(msg), &bit_arr, device_id, UP); /* first compress the packet */
+#endif
 #else /* do not compress */
 	schc_bitarray_t bit_arr		= SCHC_DEFAULT_BIT_ARRAY(252, &msg); /* use the original message as a pointer in the bit array */
 #endif
@@ -354,6 +365,13 @@ int main() {
 	cleanup();
 	finalize_timer_thread();
 
+#if USE_METRICS == 1
+	/* the counters of the main and the timer thread */
+	schc_metrics_t metrics;
+	schc_metrics_snapshot(&metrics);
+	schc_metrics_print(&metrics, stdout);
+#endif
+
 	DEBUG_PRINTF("main(): end program \n");
 
 	return 0;
@@ -52,7 +52,7 @@ int main() {
 	}
 
 	uint8_t compressed_buf[MAX_PACKET_LENGTH] = { 0 };
-	uint32_t device_id = 0x01;
+	schc_device_id_t device_id = 0x01;
 
 	/* compress packet */
 	struct schc_compression_rule_t *schc_rule;
@@ -203,10 +203,10 @@ static void set_rx_timer(schc_fragmentation_t* conn, void (*callback)(void* arg)
  * (required by some timer libraries)
  */
 void remove_timer_entry(schc_fragmentation_t* conn) {
-	DEBUG_PRINTF("remove_timer_entry(): remove timer entry for device with id %d \n", conn->device_id);
+	DEBUG_PRINTF("remove_timer_entry(): remove timer entry for device with id %" PRIu64 " \n", conn->device_id);
 }
 
-void received_packet(uint8_t* data, uint16_t length, uint32_t device_id, schc_fragmentation_t* receiving_conn) {
+void received_packet(uint8_t* data, uint16_t length, schc_device_id_t device_id, schc_fragmentation_t* receiving_conn) {
 
 	DEBUG_PRINTF("\n+-------- RX  %02d --------+\n", counter);
 
@@ -235,14 +235,14 @@ void received_packet(uint8_t* data, uint16_t length, uint32_t device_id, schc_fr
  * whether the network driver is busy or not
  *
  */
-uint8_t tx_send_callback(uint8_t* data, uint16_t length, uint32_t device_id) {
-	DEBUG_PRINTF("tx_send_callback(): transmitting packet with length %d for device %d \n", length, device_id);
+uint8_t tx_send_callback(uint8_t* data, uint16_t length, schc_device_id_t device_id) {
+	DEBUG_PRINTF("tx_send_callback(): transmitting packet with length %d for device %" PRIu64 " \n", length, device_id);
 	received_packet(data, length, device_id, &tx_conn_ngw); // send packet to network gateway
 	return 1;
 }
 
-uint8_t rx_send_callback(uint8_t* data, uint16_t length, uint32_t device_id) {
-	DEBUG_PRINTF("rx_send_callback(): transmitting packet with length %d for device %d \n", length, device_id);
+uint8_t rx_send_callback(uint8_t* data, uint16_t length, schc_device_id_t device_id) {
+	DEBUG_PRINTF("rx_send_callback(): transmitting packet with length %d for device %" PRIu64 " \n", length, device_id);
 	// received_packet(data, length, device_id, &tx_conn); // send packet to constrained device
 	return 1;
 }
@@ -269,12 +269,11 @@ int main() {
 	init();
 
 	uint8_t compressed_packet[MAX_PACKET_LENGTH] = { 0x00 };
-	uint32_t device_id = 0x01;
+	schc_device_id_t device_id = 0x01;
 
 	// compress packet
 	struct schc_rule_t* schc_rule;
-	schc_bitarray_t bit_arr;
-	bit_arr.ptr = (uint8_t*) (compressed_packet);
+	schc_bitarray_t bit_arr = SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, compressed_packet);
 
 	schc_rule = schc_compress(msg, sizeof(msg), &bit_arr, device_id, DOWN);
 
@@ -99,14 +99,16 @@ int main() {
 	schc_compressor_init(src);
 	
 	uint8_t compressed_buf[MAX_PACKET_LENGTH] = { 0 };
-	uint32_t device_id = 0x01;
+	schc_device_id_t device_id = 0x01;
 
 	// compress packet
 	struct schc_rule_t* schc_rule;
-	schc_bitarray_t bit_arr;
-	bit_arr.ptr = (uint8_t*) (compressed_buf);
+	schc_bitarray_t bit_arr = SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, compressed_buf);
 
 	schc_rule = schc_compress(msg, sizeof(msg), &bit_arr, device_id, DOWN);
+	if (bit_arr.len == 0) { // the packet could not be compressed
+		return 1;
+	}
 
 	// DECOMPRESSION
 	uint8_t new_packet_len = 0;
@@ -0,0 +1,51 @@
+/*
+ * (c) 2018 - 2022  idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * This tool prints the records of a trace file,
+ * written by schc_trace_write()
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../trace.h"
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s <trace file>\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+	if (file == NULL) {
+		printf("main(): could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	int32_t count = schc_trace_read_header(file);
+	if (count < 0) {
+		printf("main(): %s is not a trace of version %d\n", argv[1], TRACE_FILE_VERSION);
+		fclose(file);
+		return 1;
+	}
+
+	schc_trace_record_t record;
+	int32_t read = 0;
+	while (schc_trace_read(file, &record)) {
+		schc_trace_print(&record, stdout);
+		read++;
+	}
+	fclose(file);
+
+	if (read != count) {
+		printf("main(): the trace is truncated, %d of %d records\n", read, count);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * (c) 2018 - 2022  idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * This example compresses and decompresses the packets of many devices
+ * with a pool of workers, checks the results and the order of the packets
+ * of each device, and reports the throughput for each number of workers
+ * The devices are generated in a context file, so the packets are spread
+ * over all workers; without USE_CONTEXT_FILE the devices of the rules are used.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "../worker.h"
+#include "../context_file.h"
+
+#define MAX_PACKET_LENGTH		128
+#define JOBS					4096
+#define ROUNDS					50
+#define MAX_DEVICES				1024 /* the devices the packets are sent to */
+#define GENERATED_ID			0x100000000ULL /* the id of the first generated device */
+
+#define DIRECTION 				1 /* 0 = UP, 1 = DOWN */
+
+/* the IPv6/UDP/CoAP packet of compress.c, direction DOWN */
+static const uint8_t msg[] = {
+		/* IPv6 header */
+		0x60, 0x00, 0x00, 0x00, 0x00, 0x1E, 0x11, 0x40, 0xAA, 0xAA,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x01, 0xCC, 0xCC, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+		/* UDP header */
+		0x33, 0x16, 0x33, 0x16, 0x00, 0x1E, 0x05, 0x2C,
+		/* CoAP header */
+		0x54, 0x03, 0x23, 0xBB, 0x21, 0xFA, 0x01, 0xFB, 0xB5, 0x75,
+		0x73, 0x61, 0x67, 0x65, 0xD1, 0xEA, 0x1A, 0xFF,
+		/* Data */
+		0x01, 0x02, 0x03, 0x04 };
+
+static schc_device_id_t device_ids[MAX_DEVICES];
+static uint32_t device_count;
+static uint32_t configured_devices;
+static uint16_t job_devices[JOBS]; /* the position of the device of each job in device_ids */
+
+static uint8_t packets[JOBS][sizeof(msg)];
+static uint8_t compressed[JOBS][MAX_PACKET_LENGTH];
+static uint8_t reference[JOBS][MAX_PACKET_LENGTH];
+static uint16_t reference_len[JOBS];
+static uint8_t decompressed[JOBS][MAX_PACKET_LENGTH];
+static schc_bitarray_t bit_arr[JOBS];
+static schc_worker_job_t jobs[JOBS];
+static schc_worker_pool_t pool;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+#if USE_CONTEXT_FILE == 1
+/* the devices of the rule configuration, followed by copies with a generated id */
+static struct schc_device* get_device(uint32_t index) {
+	static struct schc_device device;
+	if (index < configured_devices) {
+		return get_device_by_index(index);
+	}
+	device = *get_device_by_index(index % configured_devices);
+	device.device_id = GENERATED_ID + index;
+	return &device;
+}
+#endif
+
+/*
+ * use MAX_DEVICES devices of a context file or, without one,
+ * the devices of the rule configuration
+ *
+ * @return 	0 if the context file could not be written or loaded
+ */
+static uint8_t init_devices(void) {
+	uint32_t i;
+
+	configured_devices = get_device_count();
+	device_count = (configured_devices > MAX_DEVICES) ? MAX_DEVICES : configured_devices;
+#if USE_CONTEXT_FILE == 1
+	const char* path = "workers.bin";
+	FILE* file = fopen(path, "wb");
+	if (file == NULL || !schc_context_file_write(file, MAX_DEVICES, &get_device)) {
+		printf("main(): could not write %s\n", path);
+		return 0;
+	}
+	fclose(file);
+	uint8_t loaded = schc_context_file_load(path) && schc_compressor_init();
+	remove(path);
+	if (!loaded) {
+		printf("main(): could not load %s\n", path);
+		return 0;
+	}
+	device_count = MAX_DEVICES;
+#endif
+	for (i = 0; i < device_count; i++) {
+		device_ids[i] = get_device_by_index(i)->device_id;
+	}
+
+	return 1;
+}
+
+static void init_jobs(void) {
+	int i;
+	for (i = 0; i < JOBS; i++) {
+		memcpy(packets[i], msg, sizeof(msg));
+		packets[i][55] = (uint8_t) i; /* the last byte of the token */
+		job_devices[i] = (uint16_t) ((uint32_t) rand() % device_count);
+		jobs[i].packet.device_id = device_ids[job_devices[i]];
+		jobs[i].arg = (void*) (uintptr_t) i;
+
+		schc_bitarray_t arr = SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, reference[i]);
+		schc_compress(packets[i], sizeof(msg), &arr, jobs[i].packet.device_id, DIRECTION);
+		reference_len[i] = arr.len;
+	}
+}
+
+/*
+ * run all jobs through the pool
+ *
+ * @return 	the number of jobs with a wrong result or out of order
+ */
+static int run_jobs(schc_worker_op_t op) {
+	schc_worker_job_t* done[JOBS];
+	int last[MAX_DEVICES];
+	int submitted = 0, collected = 0, err = 0;
+	uint16_t i, n;
+
+	for (i = 0; i < device_count; i++) {
+		last[i] = -1;
+	}
+	for (i = 0; i < JOBS; i++) {
+		jobs[i].op = op;
+		jobs[i].dir = DIRECTION;
+		if (op == SCHC_WORKER_COMPRESS) {
+			bit_arr[i] = (schc_bitarray_t) SCHC_DEFAULT_BIT_ARRAY(MAX_PACKET_LENGTH, compressed[i]);
+			jobs[i].packet.data = packets[i];
+			jobs[i].packet.length = sizeof(msg);
+		} else {
+			jobs[i].packet.data = decompressed[i];
+		}
+		jobs[i].packet.bit_arr = &bit_arr[i];
+	}
+
+	while (collected < JOBS) {
+		while (submitted < JOBS && schc_worker_pool_submit(&pool, &jobs[submitted])) {
+			submitted++;
+		}
+		n = schc_worker_pool_collect(&pool, done, JOBS);
+		if (n == 0) {
+			sched_yield(); // leave the core to the workers
+		}
+		for (i = 0; i < n; i++) {
+			int k = (int) (uintptr_t) done[i]->arg;
+			int d = job_devices[k];
+			if (k <= last[d] || !done[i]->packet.done) {
+				err++;
+			}
+			last[d] = k;
+			if (op == SCHC_WORKER_COMPRESS) {
+				err += (bit_arr[k].len != reference_len[k]
+						|| memcmp(compressed[k], reference[k], reference_len[k]) != 0);
+			} else {
+				err += (done[i]->packet.length != sizeof(msg));
+			}
+		}
+		collected += n;
+	}
+
+	return err;
+}
+
+/*
+ * run the jobs with a number of workers and print the throughput
+ *
+ * @return 	the number of jobs with a wrong result or out of order,
+ * 			-1 if the pool could not be started
+ */
+static int run_pool(uint8_t workers) {
+	int r, err = 0;
+
+	if (!schc_worker_pool_start(&pool, workers)) {
+		return -1;
+	}
+	uint64_t compress_ns = 0, decompress_ns = 0;
+	for (r = 0; r < ROUNDS; r++) {
+		uint64_t ns = now_ns();
+		err += run_jobs(SCHC_WORKER_COMPRESS);
+		compress_ns += now_ns() - ns;
+		ns = now_ns();
+		err += run_jobs(SCHC_WORKER_DECOMPRESS);
+		decompress_ns += now_ns() - ns;
+	}
+	schc_worker_pool_stop(&pool);
+
+	printf("%-10d%18.0f%18.0f\n", workers,
+			(double) JOBS * ROUNDS * 1e9 / (double) compress_ns,
+			(double) JOBS * ROUNDS * 1e9 / (double) decompress_ns);
+	return err;
+}
+
+/*
+ * the number of workers is doubled up to the number of cores,
+ * or up to the number given as argument, which is run last
+ */
+int main(int argc, char** argv) {
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	long cores = (argc > 1) ? atol(argv[1]) : online;
+	uint8_t workers;
+	int r, err = 0;
+
+	if(!schc_compressor_init() || !init_devices()) {
+		return 1;
+	}
+	srand(1);
+	init_jobs();
+
+	if (cores > WORKER_THREADS) {
+		cores = WORKER_THREADS;
+	}
+	printf("%u devices, %ld cores online\n", device_count, online);
+	printf("%-10s%18s%18s\n", "workers", "compress pkt/s", "decompress pkt/s");
+	for (workers = 1; workers <= cores; workers *= 2) {
+		if ((r = run_pool(workers)) < 0) {
+			return 1;
+		}
+		err += r;
+	}
+	if ((workers / 2) != cores) { // the number of cores is not a power of 2
+		if ((r = run_pool((uint8_t) cores)) < 0) {
+			return 1;
+		}
+		err += r;
+	}
+
+	if (err) {
+		printf("main(): %d jobs were wrong or out of order\n", err);
+		return 1;
+	}
+	printf("main(): the results of the workers match schc_compress()\n");
+
+	return 0;
+}
@@ -14,6 +14,9 @@
 
 #include "fragmenter.h"
 #include "bit_operations.h"
+#include "mic.h"
+#include "trace.h"
+#include "metrics.h"
 
 uint8_t ATTEMPTS = 0; // for debugging
 
@@ -21,20 +24,26 @@ uint8_t ATTEMPTS = 0; // for debugging
 #include <click/config.h>
 #endif
 
-// keep track of the active connections
-static uint8_t FRAGMENTATION_BUF[MAX_MTU_LENGTH] = { 0 };
-
-#if DYNAMIC_MEMORY
-struct schc_fragmentation_t *schc_rx_conns;
-#else
-struct schc_fragmentation_t schc_rx_conns[SCHC_CONF_RX_CONNS];
-static uint8_t buf_ptr = 0;
-uint8_t schc_buf[STATIC_MEMORY_BUFFER_LENGTH] = { 0 };
-static struct schc_mbuf_t MBUF_POOL[SCHC_CONF_MBUF_POOL_LEN];
-#endif
+// the context of schc_fragmenter_init(), keeps track of the active connections
+static schc_fragmenter_context_t fragmenter_context;
 
 static void schc_free_connection(schc_fragmentation_t *conn);
 
+/**
+ * get the context of a connection
+ * connections that were not initialized with a context use the default context
+ *
+ * @param conn			a pointer to the connection
+ *
+ * @return	ctx			the context of the connection
+ */
+static schc_fragmenter_context_t* get_context(schc_fragmentation_t* conn) {
+	if(conn->ctx == NULL) {
+		return &fragmenter_context;
+	}
+	return conn->ctx;
+}
+
 /**
  * get the FCN value
  *
@@ -67,39 +76,34 @@ static uint16_t get_max_fcn_value(schc_fragmentation_t* conn) {
 }
 
 /**
- * print the complete mbuf chain
+ * trace the complete mbuf chain
  *
  * @param  head			the head of the list
  *
  */
-static void mbuf_print(schc_mbuf_t *head) {
-	uint8_t i = 0; uint8_t j;
+static void mbuf_trace(schc_mbuf_t *head) {
 	schc_mbuf_t *curr = head;
 	while (curr != NULL) {
-		DEBUG_PRINTF("%d: %p\n", curr->frag_cnt, curr->ptr);
-		// DEBUG_PRINTF("0x%X", curr);
-		for (j = 0; j < curr->len; j++) {
-			DEBUG_PRINTF("0x%02X ", curr->ptr[j]);
-		}
-		DEBUG_PRINTF("\n");
+		TRACE_DEBUG(TRACE_MBUF, curr->frag_cnt, curr->len);
+		TRACE_BYTES(TRACE_MBUF_PACKET, curr->ptr, curr->len);
 		curr = curr->next;
-		i++;
 	}
 }
 
-static schc_mbuf_t *mbuf_alloc(void)
+static schc_mbuf_t *mbuf_alloc(schc_fragmenter_context_t *ctx)
 {
 #if !DYNAMIC_MEMORY
 	uint32_t i;
 
 	for(i = 0; i < SCHC_CONF_MBUF_POOL_LEN; i++) {
-		if(MBUF_POOL[i].len == 0 && MBUF_POOL[i].ptr == NULL) {
+		if(ctx->mbuf_pool[i].len == 0 && ctx->mbuf_pool[i].ptr == NULL) {
 			DEBUG_PRINTF("mbuf_push(): selected mbuf slot %d \n", (int) i);
-			return &MBUF_POOL[i];
+			return &ctx->mbuf_pool[i];
 		}
 	}
 	return NULL;
 #else
+	(void) ctx;
 	schc_mbuf_t *res = malloc(sizeof(schc_mbuf_t));
 
 	*res = (schc_mbuf_t){ .len = 0, .ptr = NULL };
@@ -112,6 +116,7 @@ static schc_mbuf_t *mbuf_alloc(void)
  * if head is NULL, the first item of the list
  * will be set
  *
+ * @param ctx			the context holding the mbuf pool
  * @param head			the head of the list
  * @param data			a pointer to the data pointer
  * @param len			the length of the data
@@ -119,9 +124,10 @@ static schc_mbuf_t *mbuf_alloc(void)
  * @return	-1			no free mbuf slot was found
  * 			 0			ok
  */
-static int8_t mbuf_push(schc_mbuf_t **head, uint8_t* data, uint16_t len) {
+static int8_t mbuf_push(schc_fragmenter_context_t *ctx, schc_mbuf_t **head,
+		uint8_t* data, uint16_t len) {
 	// scroll to next free mbuf slot
-	schc_mbuf_t *mbuf = mbuf_alloc();
+	schc_mbuf_t *mbuf = mbuf_alloc(ctx);
 
 	if(mbuf == NULL) {
 		DEBUG_PRINTF("mbuf_push(): no free mbuf slots found \n");
@@ -208,7 +214,7 @@ static void mbuf_delete(schc_mbuf_t **head, schc_mbuf_t *mbuf) {
 	free(mbuf->ptr);
 	free(mbuf);
 #else
-	DEBUG_PRINTF("mbuf_delete(): clear slot %li in mbuf pool \n", mbuf - MBUF_POOL);
+	DEBUG_PRINTF("mbuf_delete(): clear mbuf %p in mbuf pool \n", (void *)mbuf);
 	memset(mbuf->ptr, 0, mbuf->len);
 	mbuf->next = NULL;
 	mbuf->frag_cnt = 0;
@@ -420,28 +426,51 @@ static void mbuf_sort(schc_mbuf_t **head) {
 }
 
 /**
- * Calculates the Message Integrity Check (MIC) over an unformatted mbuf chain
- * without formatting the mbuf chain, as the last window might contain corrupted fragments
+ * reset the running MIC of a connection
  *
- * this is the 8- 16- or 32- bit Cyclic Redundancy Check (CRC)
+ * @param  conn			a pointer to the connection
  *
- * @param  head			the head of the list
+ */
+static void mic_reset(schc_fragmentation_t *conn) {
+	conn->mic_crc = mic_init();
+	conn->mic_offset = 0;
+	conn->mic_mbuf = NULL;
+	conn->mic_prev = NULL;
+	conn->mic_last = NULL;
+	conn->mic_deferred = 0;
+}
+
+/**
+ * add the bytes of an mbuf chain to a running MIC,
+ * starting from a position in the chain
  *
- * @return checksum 	the computed checksum
+ * @param  conn			a pointer to the connection
+ * @param  prev			the mbuf before curr, NULL when curr is the head
+ * @param  curr			the mbuf to continue from, is NULL at the end of the chain
+ * @param  offset		the bit offset in curr to continue from
+ * @param  crc			the running crc
+ * @param  partial		stop at the last byte of the tail, as the next mbuf
+ * 						may still have to arrive
+ *
+ * @return crc			the running crc
  *
  */
-static unsigned int mbuf_compute_mic(schc_fragmentation_t *conn) {
-	schc_mbuf_t *curr = conn->head;
-	schc_mbuf_t *prev = NULL;
-
-	uint32_t crc, crc_mask; int8_t k = 0;
-
-	uint8_t byte = 0; uint32_t curr_bit_offset = 0;
-	crc = 0xFFFFFFFF;
-
-	while (curr != NULL) {
-		uint32_t temp_offset = curr_bit_offset;
-		byte = mbuf_get_byte(prev, curr, conn, &curr_bit_offset);
+static uint32_t mbuf_update_mic(schc_fragmentation_t *conn, schc_mbuf_t **prev,
+		schc_mbuf_t **curr, uint32_t *offset, uint32_t crc, uint8_t partial) {
+	uint8_t bytes[64]; uint8_t n = 0;
+
+	while (*curr != NULL) {
+		uint32_t temp_offset = *offset;
+		if (partial && (*curr)->next == NULL) {
+			uint32_t start = *offset;
+			if (*prev == NULL && start < get_fragmentation_header_length(*curr, conn)) {
+				start = get_fragmentation_header_length(*curr, conn);
+			}
+			if (((int32_t) ((*curr)->len * 8) - (int32_t) start) <= 8) { // last byte may continue in the next mbuf
+				break;
+			}
+		}
+		bytes[n++] = mbuf_get_byte(*prev, *curr, conn, offset);
 		/*if (curr->next->next == NULL
 				&& curr_bit_offset >= ((curr->next->len * 8) - 8)) { // last byte always contains payload + padding
 			// rare case where
@@ -451,23 +480,80 @@ static unsigned int mbuf_compute_mic(schc_fragmentation_t *conn) {
 		// when mtu is very small (e.g. 6 or 7), final mbuf > second last mbuf
 		// and curr_bit_offset will never be larger than temp_offset
 		// resulting in an endless loop
-		if ( (curr_bit_offset < temp_offset) ) { // partially included bits of next mbuf
-			prev = curr;
-			curr = curr->next;
+		if ( (*offset < temp_offset) ) { // partially included bits of next mbuf
+			*prev = *curr;
+			*curr = (*curr)->next;
 		}
-		crc = crc ^ byte;
-		for (k = 7; k >= 0; k--) { // do eight times.
-			crc_mask = -(crc & 1);
-			crc = (crc >> 1) ^ (0xEDB88320 & crc_mask);
+		if (n == sizeof(bytes)) {
+			crc = mic_update(crc, bytes, n);
+			n = 0;
 		}
-		// printf("0x%02X ", byte);
 	}
 
-	// printf("\n");
+	return mic_update(crc, bytes, n);
+}
 
-	crc = ~crc;
-	uint8_t mic[MIC_SIZE_BYTES] = { ((crc & 0xFF000000) >> 24),
-			((crc & 0xFF0000) >> 16), ((crc & 0xFF00) >> 8), ((crc & 0xFF)) };
+/**
+ * add a newly received fragment to the running MIC of the connection
+ * if it follows the fragments received so far (the chain stays sorted),
+ * otherwise the MIC is computed over the sorted mbuf chain at the end
+ *
+ * @param  conn			a pointer to the connection
+ * @param  tail			the mbuf of the received fragment, with frag_cnt set
+ *
+ */
+static void mbuf_accept_mic(schc_fragmentation_t *conn, schc_mbuf_t *tail) {
+	if (conn->mic_deferred || tail == conn->mic_last) {
+		return;
+	}
+
+	if ((conn->mic_last == NULL && tail != conn->head)
+			|| (conn->mic_last != NULL && (conn->mic_last->next != tail
+					|| tail->frag_cnt <= conn->mic_last->frag_cnt))) {
+		DEBUG_PRINTF("mbuf_accept_mic(): fragment %d out of order, defer MIC \n", tail->frag_cnt);
+		conn->mic_deferred = 1;
+		return;
+	}
+
+	conn->mic_last = tail;
+	if (conn->mic_mbuf == NULL) {
+		conn->mic_mbuf = conn->head;
+	}
+	conn->mic_crc = mbuf_update_mic(conn, &conn->mic_prev, &conn->mic_mbuf,
+			&conn->mic_offset, conn->mic_crc, 1);
+}
+
+/**
+ * Calculates the Message Integrity Check (MIC) over an unformatted mbuf chain
+ * without formatting the mbuf chain, as the last window might contain corrupted fragments
+ * continues from the running MIC if all fragments were received in order
+ *
+ * this is the 8- 16- or 32- bit Cyclic Redundancy Check (CRC)
+ *
+ * @param  head			the head of the list
+ *
+ * @return checksum 	the computed checksum
+ *
+ */
+static unsigned int mbuf_compute_mic(schc_fragmentation_t *conn) {
+	schc_mbuf_t *curr = conn->head;
+	schc_mbuf_t *prev = NULL;
+	uint32_t curr_bit_offset = 0;
+	uint32_t crc = mic_init();
+
+	if (!conn->mic_deferred && conn->mic_last != NULL
+			&& conn->mic_last == get_mbuf_tail(conn->head)) { // continue the running MIC
+		curr = (conn->mic_mbuf != NULL) ? conn->mic_mbuf : conn->head;
+		prev = conn->mic_prev;
+		curr_bit_offset = conn->mic_offset;
+		crc = conn->mic_crc;
+	}
+
+	crc = mbuf_update_mic(conn, &prev, &curr, &curr_bit_offset, crc, 0);
+
+	crc = mic_final(crc);
+	uint8_t mic[MIC_SIZE_BYTES];
+	mic_to_bytes(mic, crc);
 
 	memcpy((uint8_t *) conn->mic, mic, MIC_SIZE_BYTES);
 
@@ -486,9 +572,72 @@ static uint8_t calculate_byte_padding(uint32_t total_bits) {
 	return (8U - (total_bits % 8U)) % 8U;
 }
 
+/*
+ * copy bits of the compressed packet, which is either the bit array
+ * or the compressed header in the bit array followed by a detached payload,
+ * so the payload is shifted once, straight into the fragment
+ * the bits after the end of the packet are not copied
+ */
+static void tx_copy_bits(schc_fragmentation_t *conn, uint8_t* dst, uint32_t dst_pos,
+		uint32_t src_pos, uint32_t len) {
+	uint32_t header_bits = conn->bit_arr->offset;
+
+	if (conn->payload == NULL) {
+		copy_bits(dst, dst_pos, conn->bit_arr->ptr, src_pos, len);
+		return;
+	}
+	if (src_pos < header_bits) {
+		uint32_t n = ((header_bits - src_pos) < len) ? (header_bits - src_pos) : len;
+		copy_bits(dst, dst_pos, conn->bit_arr->ptr, src_pos, n);
+		dst_pos += n; src_pos += n; len -= n;
+	}
+	if ((src_pos + len) > conn->bit_arr->bit_len) { // the padding of the last byte
+		len = (src_pos < conn->bit_arr->bit_len) ? (conn->bit_arr->bit_len - src_pos) : 0;
+	}
+	if (len) {
+		copy_bits(dst, dst_pos, conn->payload, src_pos - header_bits, len);
+	}
+}
+
+/*
+ * add the bytes from .. to of the compressed packet to a MIC, see tx_copy_bits()
+ * a detached payload behind a byte aligned header is read in place,
+ * otherwise it is shifted in chunks
+ */
+static uint32_t tx_mic_update(schc_fragmentation_t *conn, uint32_t crc, uint32_t from,
+		uint32_t to) {
+	uint32_t header_bits = conn->bit_arr->offset;
+
+	if (conn->payload == NULL) {
+		return mic_update(crc, conn->bit_arr->ptr + from, to - from);
+	}
+	if (!(header_bits % 8)) {
+		uint32_t header_len = header_bits / 8;
+		if (from < header_len) {
+			uint32_t n = (to < header_len) ? to : header_len;
+			crc = mic_update(crc, conn->bit_arr->ptr + from, n - from);
+			from = n;
+		}
+		return mic_update(crc, conn->payload + (from - header_len), to - from);
+	}
+
+	uint8_t bytes[64];
+	while (from < to) {
+		uint32_t n = ((to - from) < sizeof(bytes)) ? (to - from) : sizeof(bytes);
+		memset(bytes, 0, n);
+		tx_copy_bits(conn, bytes, 0, BYTES_TO_BITS(from), BYTES_TO_BITS(n));
+		crc = mic_update(crc, bytes, n);
+		from += n;
+	}
+
+	return crc;
+}
+
 /**
  * Calculates the Message Integrity Check (MIC)
  * which is the 8- 16- or 32- bit Cyclic Redundancy Check (CRC)
+ * the running MIC of the connection is left untouched,
+ * as the last tile may be sent again
  *
  * @param conn 			pointer to the connection
  *
@@ -496,16 +645,12 @@ static uint8_t calculate_byte_padding(uint32_t total_bits) {
  *
  */
 static unsigned int compute_mic(schc_fragmentation_t *conn, uint8_t last_tile_padding) {
-	int i, j; uint8_t byte;
-	unsigned int crc, mask;
+	uint32_t crc;
 
 	// ToDo
 	// check conn->mic length
 	// and calculate appropriate crc
 
-	i = 0;
-	crc = 0xFFFFFFFF;
-
 	// the MIC is computed over the complete, compressed packet
 	// + padding of the last tile, which may result in a non-byte aligned packet
 	// so, extra padding might be added before computing the MIC
@@ -517,31 +662,18 @@ static unsigned int compute_mic(schc_fragmentation_t *conn, uint8_t last_tile_pa
 
 	uint16_t padded_length = (((conn->bit_arr->len * 8) + last_tile_padding + extra_padding) / 8);
 
-	while (i < padded_length) {
-		if (i < conn->bit_arr->len) {
-			byte = conn->bit_arr->ptr[i];
-		}
-		else {
-			byte = 0U;
-		}
-		crc = crc ^ byte;
-		for (j = 7; j >= 0; j--) {    // do eight times.
-			mask = -(crc & 1);
-			crc = (crc >> 1) ^ (0xEDB88320 & mask);
-		}
-		i++;
-		// printf("0x%02X ", byte);
-	}
-	// printf("\n");
+	// continue from the bytes added while sending the previous tiles
+	crc = tx_mic_update(conn, conn->mic_crc, conn->mic_offset, conn->bit_arr->len);
+	crc = mic_update_zeros(crc, padded_length - conn->bit_arr->len); // the padding bytes
 
-	crc = ~crc;
-	uint8_t mic[MIC_SIZE_BYTES] = { ((crc & 0xFF000000) >> 24), ((crc & 0xFF0000) >> 16),
-			((crc & 0xFF00) >> 8), ((crc & 0xFF)) };
+	crc = mic_final(crc);
+	uint8_t mic[MIC_SIZE_BYTES];
+	mic_to_bytes(mic, crc);
 
 	memcpy((uint8_t *) conn->mic, mic, MIC_SIZE_BYTES);
 
-	DEBUG_PRINTF("compute_mic(): MIC for device %d is %02X%02X%02X%02X \n",
-			(int) conn->device_id, mic[0], mic[1], mic[2], mic[3]);
+	DEBUG_PRINTF("compute_mic(): MIC for device %" PRIu64 " is %02X%02X%02X%02X \n",
+			conn->device_id, mic[0], mic[1], mic[2], mic[3]);
 
 	return crc;
 }
@@ -607,12 +739,12 @@ static void set_conn_frag_cnt(schc_fragmentation_t* conn, uint8_t frag) {
  *
  */
 struct schc_fragmentation_rule_t* get_fragmentation_rule_by_reliability_mode(reliability_mode mode,
-		uint32_t device_id) {
+		schc_device_id_t device_id) {
 	struct schc_device *device = get_device_by_id(device_id);
 
 	if (device == NULL) {
 		DEBUG_PRINTF(
-				"get_schc_rule(): no device was found for the id: %d\n", (int) device_id);
+				"get_schc_rule(): no device was found for the id: %" PRIu64 "\n", device_id);
 		return NULL;
 	}
 
@@ -624,43 +756,8 @@ struct schc_fragmentation_rule_t* get_fragmentation_rule_by_reliability_mode(rel
 		}
 	}
 
-	DEBUG_PRINTF("get_schc_rule(): no fragmentation rule was found for device with id=%d\n",
-				(int ) device_id);
-	return NULL;
-}
-
-// todo move to schc.c generic function for both this method and get_compression_rule_by_rule_id
-
-/*
- * Find a SCHC rule entry for a device
- *
- * @param 	rule_arr 		the rule id in uint8_t array
- * @param 	device_id		the device to find a rule for
- *
- * @return 	schc_rule		the rule that was found
- * 			NULL			if no rule was found
- *
- */
-static struct schc_fragmentation_rule_t* get_fragmentation_rule_by_rule_id(uint8_t* rule_arr, uint32_t device_id) {
-	int i;
-	struct schc_device *device = get_device_by_id(device_id);
-
-	if (device == NULL) {
-		DEBUG_PRINTF("get_schc_rule(): no device was found for this id \n");
-		return NULL;
-	}
-
-	for (i = 0; i < device->fragmentation_rule_count; i++) {
-		struct schc_fragmentation_rule_t* curr_rule = (struct schc_fragmentation_rule_t*) (*device->fragmentation_context)[i];
-		uint8_t curr_rule_pos = get_position_in_first_byte(curr_rule->rule_id_size_bits);
-		uint8_t rule_id[4] = { 0 };
-		little_end_uint8_from_uint32(rule_id, curr_rule->rule_id); /* copy the uint32_t to a uint8_t array */
-		if( compare_bits_aligned(rule_id, curr_rule_pos, rule_arr, 0, curr_rule->rule_id_size_bits)) {
-			DEBUG_PRINTF("get_fragmentation_rule(): curr rule %p \n", (void*) curr_rule);
-			return curr_rule;
-		}
-	}
-
+	DEBUG_PRINTF("get_schc_rule(): no fragmentation rule was found for device with id=%" PRIu64 "\n",
+				device_id);
 	return NULL;
 }
 
@@ -724,6 +821,7 @@ static int8_t init_tx_connection(schc_fragmentation_t* conn) {
 	conn->window_cnt = 0;
 	conn->frag_cnt = 0;
 	conn->attempts = 0;
+	mic_reset(conn);
 
 	if (conn->bit_arr->len < conn->mtu
 			&& conn->fragmentation_rule->mode != NOT_FRAGMENTED) { // should not fragment; change rule
@@ -754,7 +852,7 @@ static int8_t init_tx_connection(schc_fragmentation_t* conn) {
 
 
 	conn->fcn = conn->fragmentation_rule->MAX_WND_FCN;
-	memset(conn->bitmap, 0, BITMAP_SIZE_BYTES); // clear bitmap
+	bitmap_clear(&conn->bitmap); // clear bitmap
 
 	return 1;
 }
@@ -775,13 +873,14 @@ void schc_reset(schc_fragmentation_t* conn) {
 #endif
 	conn->device_id = 0;
 	conn->tail_ptr = 0;
+	conn->payload = NULL;
 	conn->dc = 0;
 	conn->mtu = 0;
 	conn->fcn = 0;
 	conn->dtag = 0;
 	conn->frag_cnt = 0;
 	conn->fragmentation_rule = NULL;
-	memset(conn->bitmap, 0, BITMAP_SIZE_BYTES);
+	bitmap_clear(&conn->bitmap);
 	conn->attempts = 0;
 	conn->TX_STATE = INIT_TX;
 	conn->RX_STATE = RECV_WINDOW;
@@ -790,10 +889,11 @@ void schc_reset(schc_fragmentation_t* conn) {
 	conn->timer_flag = 0;
 	conn->input = 0;
 	memset(conn->mic, 0, MIC_SIZE_BYTES);
+	mic_reset(conn);
 
 	/* reset ack structure */
 	memset(conn->ack.rule_id, 0, 4); /* rule id can be maximum of 4 bytes */
-	memset(conn->ack.bitmap, 0, BITMAP_SIZE_BYTES);
+	bitmap_clear(&conn->ack.bitmap);
 	memset(conn->ack.window, 0, 1);
 	memset(conn->ack.dtag, 0, 1);
 	conn->ack.mic = 0;
@@ -848,31 +948,21 @@ static uint32_t has_no_more_fragments(schc_fragmentation_t* conn) {
  */
 static uint16_t set_fragmentation_header(schc_fragmentation_t* conn,
 		uint8_t* fragmentation_buffer) {
-	uint8_t bit_offset = conn->fragmentation_rule->rule_id_size_bits;
+	schc_bitarray_t header = SCHC_DEFAULT_BIT_ARRAY(MAX_MTU_LENGTH, fragmentation_buffer);
+	schc_bitwriter_t writer;
+	bitwriter_init(&writer, &header);
 
 	 // set rule id
 	uint8_t src_pos = get_position_in_first_byte(conn->fragmentation_rule->rule_id_size_bits);
 	uint8_t fragmenter_id[4] = { 0 };
 	little_end_uint8_from_uint32(fragmenter_id, conn->fragmentation_rule->rule_id); /* copy the uint32_t to a uint8_t array */
-	copy_bits(fragmentation_buffer, 0, fragmenter_id, src_pos, bit_offset);
-
-	// set dtag field
-	uint8_t dtag[1] = { conn->dtag << (8 - conn->fragmentation_rule->DTAG_SIZE) };
-	copy_bits(fragmentation_buffer, bit_offset, dtag, 0, conn->fragmentation_rule->DTAG_SIZE); // right after rule id
-
-	bit_offset += conn->fragmentation_rule->DTAG_SIZE;
-
-	// set window bit
-	uint8_t window[1] = { conn->window << (8 - conn->fragmentation_rule->WINDOW_SIZE) };
-	copy_bits(fragmentation_buffer, bit_offset, window, 0, conn->fragmentation_rule->WINDOW_SIZE); // right after dtag
+	bitwriter_put_array(&writer, fragmenter_id, src_pos, conn->fragmentation_rule->rule_id_size_bits);
 
-	bit_offset += conn->fragmentation_rule->WINDOW_SIZE;
+	bitwriter_put_bits(&writer, conn->dtag, conn->fragmentation_rule->DTAG_SIZE); // set dtag field, right after rule id
+	bitwriter_put_bits(&writer, conn->window, conn->fragmentation_rule->WINDOW_SIZE); // set window bit, right after dtag
+	bitwriter_put_bits(&writer, conn->fcn, conn->fragmentation_rule->FCN_SIZE); // set fcn value, right after window bits
 
-	// set fcn value
-	uint8_t fcn[1] = { conn->fcn << (8 - conn->fragmentation_rule->FCN_SIZE) };
-	copy_bits(fragmentation_buffer, bit_offset, fcn, 0, conn->fragmentation_rule->FCN_SIZE); // right after window bits
-
-	bit_offset += conn->fragmentation_rule->FCN_SIZE;
+	uint16_t bit_offset = bitwriter_offset(&writer);
 
 	uint32_t bits_transmitted = has_no_more_fragments(conn);
 	if (bits_transmitted) { // all-1 fragment
@@ -893,11 +983,12 @@ static uint16_t set_fragmentation_header(schc_fragmentation_t* conn,
 		compute_mic(conn, padding); // calculate RCS over compressed, (possibly double) padded packet
 
 		// shift in RCS
-		copy_bits(fragmentation_buffer, bit_offset, conn->mic, 0, (MIC_SIZE_BYTES * 8));
-		bit_offset += (MIC_SIZE_BYTES * 8);
+		bitwriter_put_bytes(&writer, conn->mic, MIC_SIZE_BYTES);
 	}
 
-	return bit_offset;
+	bitwriter_flush(&writer);
+
+	return bitwriter_offset(&writer);
 }
 
 /**
@@ -913,10 +1004,10 @@ static void set_local_bitmap(schc_fragmentation_t* conn) {
 	if(frag < 0) {
 		frag = conn->fragmentation_rule->MAX_WND_FCN;
 	}
-	set_bits(conn->bitmap, frag, 1);
+	bitmap_set(&conn->bitmap, frag);
 
 	DEBUG_PRINTF("set_local_bitmap(): for fcn %d at index %d \n", conn->fcn, frag);
-	print_bitmap(conn->bitmap, conn->fragmentation_rule->MAX_WND_FCN + 1);
+	bitmap_print(&conn->bitmap, conn->fragmentation_rule->MAX_WND_FCN + 1);
 }
 
 /**
@@ -926,8 +1017,8 @@ static void set_local_bitmap(schc_fragmentation_t* conn) {
  *
  */
 static void clear_bitmap(schc_fragmentation_t* conn) {
-	memset(conn->bitmap, 0, BITMAP_SIZE_BYTES); // clear local bitmap
-	memset(conn->ack.bitmap, 0, BITMAP_SIZE_BYTES); // clear received bitmap
+	bitmap_clear(&conn->bitmap); // clear local bitmap
+	bitmap_clear(&conn->ack.bitmap); // clear received bitmap
 }
 
 /**
@@ -939,7 +1030,7 @@ static void clear_bitmap(schc_fragmentation_t* conn) {
  */
 /*static void encode_bitmap(schc_fragmentation_t* conn) {
 	// ToDo
-	DEBUG_PRINTF("encode_bitmap(): for device %d", (int) conn->device_id);
+	DEBUG_PRINTF("encode_bitmap(): for device %" PRIu64, conn->device_id);
 }*/
 
 /**
@@ -950,25 +1041,18 @@ static void clear_bitmap(schc_fragmentation_t* conn) {
  */
 /*static void decode_bitmap(schc_fragmentation_t* conn) {
 	// ToDo
-	DEBUG_PRINTF("decode_bitmap(): for device %d", (int) conn->device_id);
+	DEBUG_PRINTF("decode_bitmap(): for device %" PRIu64, conn->device_id);
 }*/
 
 /**
- * loop over a bitmap to check if all bits are set to
- * 1, starting from MAX_WIND_FCN
+ * check if all bits of the local bitmap are set to 1
  *
  * @param conn 			a pointer to the connection
  * @param len			the length of the bitmap
  *
  */
 static uint8_t is_bitmap_full(schc_fragmentation_t* conn, uint8_t len) {
-	uint8_t i;
-	for (i = 0; i < len; i++) {
-		if (!(conn->bitmap[i / 8] & 128 >> (i % 8))) {
-			return 0;
-		}
-	}
-	return 1;
+	return bitmap_is_full(&conn->bitmap, len);
 }
 
 /**
@@ -981,14 +1065,12 @@ static uint8_t is_bitmap_full(schc_fragmentation_t* conn, uint8_t len) {
  *
  */
 static uint16_t get_next_fragment_from_bitmap(schc_fragmentation_t* conn) {
-	uint16_t i;
-
+	uint16_t len = conn->fragmentation_rule->MAX_WND_FCN + 1;
 	uint8_t start = (conn->frag_cnt) - ((conn->fragmentation_rule->MAX_WND_FCN + 1)* conn->window_cnt);
-	for (i = start; i <= conn->fragmentation_rule->MAX_WND_FCN; i++) {
-		uint8_t bit = conn->ack.bitmap[i / 8] & 128 >> (i % 8);
-		if(bit) {
-			return (i + 1);
-		}
+	uint16_t i = bitmap_find_next(&conn->ack.bitmap, start, len);
+
+	if (i < len) {
+		return (i + 1);
 	}
 
 	return 0;
@@ -1003,6 +1085,7 @@ static void discard_fragment(schc_fragmentation_t* conn) {
 	DEBUG_PRINTF("discard_fragment(): \n");
 	schc_mbuf_t* tail = get_mbuf_tail(conn->head); // get last received fragment
 	mbuf_delete(&conn->head, tail);
+	conn->mic_deferred = 1; // the running MIC may include the deleted fragment
 	return;
 }
 
@@ -1016,6 +1099,7 @@ static void discard_fragment(schc_fragmentation_t* conn) {
 static void abort_connection(schc_fragmentation_t* conn) {
 	// todo
 	DEBUG_PRINTF("abort_connection(): inactivity timer expired \n");
+	METRIC_ADD_ID(conn->device_id, SCHC_METRIC_ABORTS, 1);
 	schc_reset(conn);
 	return;
 }
@@ -1132,9 +1216,10 @@ static uint8_t empty_all_1(schc_mbuf_t* mbuf, schc_fragmentation_t* conn) {
  *
  */
 static uint8_t send_fragment(schc_fragmentation_t* conn) {
-	memset(FRAGMENTATION_BUF, 0, MAX_MTU_LENGTH); // set and reset buffer
+	uint8_t* fragmentation_buf = get_context(conn)->fragmentation_buf;
+	memset(fragmentation_buf, 0, MAX_MTU_LENGTH); // set and reset buffer
 
-	uint16_t header_bits = set_fragmentation_header(conn, FRAGMENTATION_BUF); // set fragmentation header
+	uint16_t header_bits = set_fragmentation_header(conn, fragmentation_buf); // set fragmentation header
 	uint32_t packet_bits_tx = has_no_more_fragments(conn); // the number of bits already transmitted
 
 	uint16_t packet_len = 0; uint32_t packet_bit_offset = 0; int32_t remaining_bits;
@@ -1169,7 +1254,7 @@ static uint8_t send_fragment(schc_fragmentation_t* conn) {
 			header_bits += (MIC_SIZE_BYTES * 8); // include MIC bytes
 		}
 
-		remaining_bits = calculate_byte_padding(header_bits + packet_bits_tx); // padding variable (padding is already set by memset(FRAGMENTATION_BUF))
+		remaining_bits = calculate_byte_padding(header_bits + packet_bits_tx); // padding variable (padding is already set by the memset of the buffer)
 
 		packet_len = BITS_TO_BYTES(header_bits + remaining_bits + packet_bits_tx); // last packet length
 
@@ -1179,19 +1264,21 @@ static uint8_t send_fragment(schc_fragmentation_t* conn) {
 		}
 	}
 
-	copy_bits(FRAGMENTATION_BUF, header_bits, conn->bit_arr->ptr, packet_bit_offset, packet_bits_tx); // copy bits
-
-	DEBUG_PRINTF(
-			"send_fragment(): sending fragment %d with length %d to device %d \n",
-			conn->frag_cnt, packet_len, (int) conn->device_id);
+	tx_copy_bits(conn, fragmentation_buf, header_bits, packet_bit_offset, packet_bits_tx); // copy bits
 
-	int j;
-	for (j = 0; j < packet_len; j++) {
-		DEBUG_PRINTF("0x%02X ", FRAGMENTATION_BUF[j]);
+	uint32_t mic_bytes = (packet_bit_offset + packet_bits_tx) / 8; // whole bytes sent so far
+	if (mic_bytes > conn->bit_arr->len) {
+		mic_bytes = conn->bit_arr->len;
 	}
-	DEBUG_PRINTF("\n");
+	if (mic_bytes > conn->mic_offset) { // add the new tile to the running MIC
+		conn->mic_crc = tx_mic_update(conn, conn->mic_crc, conn->mic_offset, mic_bytes);
+		conn->mic_offset = mic_bytes;
+	}
+
+	TRACE_INFO(TRACE_FRAGMENT_SENT, conn->frag_cnt, packet_len, conn->device_id);
+	TRACE_BYTES(TRACE_FRAGMENT_PACKET, fragmentation_buf, packet_len);
 
-	return conn->send(FRAGMENTATION_BUF, packet_len, conn->device_id);
+	return conn->send(fragmentation_buf, packet_len, conn->device_id);
 }
 
 /**
@@ -1206,32 +1293,30 @@ static uint8_t send_fragment(schc_fragmentation_t* conn) {
  */
 static uint8_t send_ack(schc_fragmentation_t* conn) {
 	uint8_t ack[RULE_SIZE_BYTES + DTAG_SIZE_BYTES + BITMAP_SIZE_BYTES] = { 0 };
-	uint8_t offset = conn->fragmentation_rule->rule_id_size_bits;
+	schc_bitarray_t ack_arr = SCHC_DEFAULT_BIT_ARRAY(sizeof(ack), ack);
+	schc_bitwriter_t writer;
+	bitwriter_init(&writer, &ack_arr);
 
-	copy_bits(ack, 0, conn->ack.rule_id, 0, offset); // set rule id
-	copy_bits(ack, offset, conn->ack.dtag, 0, conn->fragmentation_rule->DTAG_SIZE); // set dtag
-	offset += conn->fragmentation_rule->DTAG_SIZE;
-
-	uint8_t window[1] = { conn->window << (8 - conn->fragmentation_rule->WINDOW_SIZE) }; // set window
-	copy_bits(ack, offset, window, 0, conn->fragmentation_rule->WINDOW_SIZE);
-	offset += conn->fragmentation_rule->WINDOW_SIZE;
+	bitwriter_put_array(&writer, conn->ack.rule_id, 0, conn->fragmentation_rule->rule_id_size_bits); // set rule id
+	bitwriter_put_array(&writer, conn->ack.dtag, 0, conn->fragmentation_rule->DTAG_SIZE); // set dtag
+	bitwriter_put_bits(&writer, conn->window, conn->fragmentation_rule->WINDOW_SIZE); // set window
 
 	if(conn->ack.fcn == get_max_fcn_value(conn)) { // all-1 window
-		uint8_t c[1] = { conn->ack.mic << (8 - MIC_C_SIZE_BITS) }; // set mic c bit
-		copy_bits(ack, offset, c, 0, MIC_C_SIZE_BITS);
-		offset += MIC_C_SIZE_BITS;
+		bitwriter_put_bits(&writer, conn->ack.mic, MIC_C_SIZE_BITS); // set mic c bit
 	}
 
 	if(!conn->ack.mic) { // if mic c bit is 0 (zero by default)
 		DEBUG_PRINTF("send_ack(): sending bitmap \n");
-		copy_bits(ack, offset, conn->bitmap, 0, conn->fragmentation_rule->MAX_WND_FCN + 1); // copy the bitmap
-		offset += conn->fragmentation_rule->MAX_WND_FCN + 1; // todo must be encoded
-		print_bitmap(conn->bitmap, conn->fragmentation_rule->MAX_WND_FCN + 1);
+		bitwriter_put_bitmap(&writer, &conn->bitmap, conn->fragmentation_rule->MAX_WND_FCN + 1); // copy the bitmap, todo must be encoded
+		bitmap_print(&conn->bitmap, conn->fragmentation_rule->MAX_WND_FCN + 1);
 	}
 
+	bitwriter_flush(&writer);
+	uint8_t offset = bitwriter_offset(&writer);
+
 	uint8_t packet_len = ((offset - 1) / 8) + 1;
-	DEBUG_PRINTF("send_ack(): sending ack to device %d for fragment %d with length %d (%d b) \n",
-			(int) conn->device_id, conn->frag_cnt + 1, packet_len, offset);
+	DEBUG_PRINTF("send_ack(): sending ack to device %" PRIu64 " for fragment %d with length %d (%d b) \n",
+			conn->device_id, conn->frag_cnt + 1, packet_len, offset);
 
 	int i;
 	for(i = 0; i < packet_len; i++) {
@@ -1240,7 +1325,12 @@ static uint8_t send_ack(schc_fragmentation_t* conn) {
 
 	DEBUG_PRINTF("\n");
 
-	return conn->send(ack, packet_len, conn->device_id);
+	if (!conn->send(ack, packet_len, conn->device_id)) {
+		return 0;
+	}
+	METRIC_ADD_ID(conn->device_id, SCHC_METRIC_ACKS_SENT, 1);
+
+	return 1;
 }
 
 /**
@@ -1255,22 +1345,28 @@ static uint8_t send_ack(schc_fragmentation_t* conn) {
  *
  */
 static uint8_t send_empty(schc_fragmentation_t* conn) {
+	uint8_t* fragmentation_buf = get_context(conn)->fragmentation_buf;
 	// set and reset buffer
-	memset(FRAGMENTATION_BUF, 0, MAX_MTU_LENGTH);
+	memset(fragmentation_buf, 0, MAX_MTU_LENGTH);
 
 	// set fragmentation header
-	uint16_t header_offset = set_fragmentation_header(conn, FRAGMENTATION_BUF);
+	uint16_t header_offset = set_fragmentation_header(conn, fragmentation_buf);
 
 	uint8_t padding = header_offset % 8;
 	uint8_t zerobuf[1] = { 0 };
-	copy_bits(FRAGMENTATION_BUF, header_offset, zerobuf, 0, padding); // add padding
+	copy_bits(fragmentation_buf, header_offset, zerobuf, 0, padding); // add padding
 
 	uint8_t packet_len = (padding + header_offset) / 8;
 
-	DEBUG_PRINTF("send_empty(): sending all-x empty to device %d with length %d (%d b)\n",
-			(int) conn->device_id, packet_len, header_offset);
+	DEBUG_PRINTF("send_empty(): sending all-x empty to device %" PRIu64 " with length %d (%d b)\n",
+			conn->device_id, packet_len, header_offset);
+
+	if (!conn->send(fragmentation_buf, packet_len, conn->device_id)) {
+		return 0;
+	}
+	METRIC_ADD_ID(conn->device_id, SCHC_METRIC_ACK_REQUESTS_SENT, 1);
 
-	return conn->send(FRAGMENTATION_BUF, packet_len, conn->device_id);
+	return 1;
 }
 
 /**
@@ -1285,7 +1381,7 @@ static uint8_t send_empty(schc_fragmentation_t* conn) {
  *
  */
 static uint8_t send_tx_empty(schc_fragmentation_t* conn) {
-	DEBUG_PRINTF("send_tx_empty() for device %d \n", (int) conn->device_id);
+	DEBUG_PRINTF("send_tx_empty() for device %" PRIu64 " \n", conn->device_id);
 	return 0;
 }
 
@@ -1293,23 +1389,33 @@ static uint8_t send_tx_empty(schc_fragmentation_t* conn) {
 //                               GLOBAL FUNCIONS                                  //
 ////////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * find a connection of the fragmenter initialized with schc_fragmenter_init()
+ * See schc_get_connection_ctx()
+ */
+schc_fragmentation_t* schc_get_connection(schc_device_id_t device_id) {
+	return schc_get_connection_ctx(&fragmenter_context, device_id);
+}
+
 /**
  * find a connection based on a device id
  * or open a new connection if there was no connection
  * for this device yet
  *
+ * @param 	ctx			the fragmenter context holding the connections
  * @param 	device_id	the id of the device to open a connection for
  *
  * @return 	conn		a pointer to the selected connection
  * 			0 			if no free connections are available
  *
  */
-schc_fragmentation_t* schc_get_connection(uint32_t device_id) {
+schc_fragmentation_t* schc_get_connection_ctx(schc_fragmenter_context_t *ctx,
+		schc_device_id_t device_id) {
 	uint32_t i; schc_fragmentation_t *conn;
 	conn = 0;
 
 #if DYNAMIC_MEMORY
-	schc_fragmentation_t *ptr = schc_rx_conns;
+	schc_fragmentation_t *ptr = ctx->rx_conns;
 	while (ptr) {
 		if (ptr->device_id == device_id) {
 			conn = ptr;
@@ -1326,9 +1432,11 @@ schc_fragmentation_t* schc_get_connection(uint32_t device_id) {
 		DEBUG_PRINTF("schc_get_connection(): malloc'd %p\n", (void *)conn);
 		*conn = (schc_fragmentation_t){ 0 };
 		conn->device_id = device_id;
+		conn->ctx = ctx;
+		mic_reset(conn);
 
 		/* append to list of connections */
-		ptr = schc_rx_conns;
+		ptr = ctx->rx_conns;
 		while (ptr && ptr->next) {
 			ptr = ptr->next;
 		}
@@ -1336,33 +1444,33 @@ schc_fragmentation_t* schc_get_connection(uint32_t device_id) {
 			ptr->next = conn;
 		}
 		else {
-			schc_rx_conns = conn;
+			ctx->rx_conns = conn;
 		}
 	}
 	if(conn) {
-		DEBUG_PRINTF("schc_get_connection(): selected connection %p for device %d\n", (void *) conn, (int) device_id);
+		DEBUG_PRINTF("schc_get_connection(): selected connection %p for device %" PRIu64 "\n", (void *) conn, device_id);
 	}
 #else
 	for (i = 0; i < SCHC_CONF_RX_CONNS; i++) {
 		// first look for the the old connection
-		if (schc_rx_conns[i].device_id == device_id) {
-			conn = &schc_rx_conns[i];
+		if (ctx->rx_conns[i].device_id == device_id) {
+			conn = &ctx->rx_conns[i];
 			break;
 		}
 	}
 
 	if (conn == 0) { // check if we were given an old connection
 		for (i = 0; i < SCHC_CONF_RX_CONNS; i++) {
-			if (schc_rx_conns[i].device_id == 0) { // look for an empty connection
-				conn = &schc_rx_conns[i];
-				schc_rx_conns[i].device_id = device_id;
+			if (ctx->rx_conns[i].device_id == 0) { // look for an empty connection
+				conn = &ctx->rx_conns[i];
+				ctx->rx_conns[i].device_id = device_id;
 				break;
 			}
 		}
 	}
 
 	if(conn) {
-		DEBUG_PRINTF("schc_get_connection(): selected connection %d for device %d\n", (int) i, (int) device_id);
+		DEBUG_PRINTF("schc_get_connection(): selected connection %d for device %" PRIu64 "\n", (int) i, device_id);
 	}
 #endif
 
@@ -1375,14 +1483,15 @@ static void schc_free_connection(schc_fragmentation_t *conn)
 	if(conn->free_conn_cb) {
 		conn->free_conn_cb(conn);
 	}
-	schc_fragmentation_t *ptr = schc_rx_conns, *last = NULL;
+	schc_fragmenter_context_t *ctx = get_context(conn);
+	schc_fragmentation_t *ptr = ctx->rx_conns, *last = NULL;
 
 	conn->timer_ctx = NULL;
 	DEBUG_PRINTF("schc_free_connection(): trying to free %p\n", (void *)conn);
 	while (ptr) {
 		if (ptr == conn) {
 			if (last == NULL) {
-				schc_rx_conns = ptr->next;
+				ctx->rx_conns = ptr->next;
 			}
 			else {
 				last->next = ptr->next;
@@ -1424,11 +1533,12 @@ static int8_t mic_correct(schc_fragmentation_t* rx_conn) {
 	DEBUG_PRINTF("mic_correct(): received MIC is %02X%02X%02X%02X\n", recv_mic[0], recv_mic[1],
 			recv_mic[2], recv_mic[3]);
 
-	mbuf_print(rx_conn->head);
+	mbuf_trace(rx_conn->head);
 	mbuf_compute_mic(rx_conn); // compute the mic over the mbuf chain
 
 	if (!compare_bits(rx_conn->mic, recv_mic, (MIC_SIZE_BYTES * 8))) { // mic wrong
 		DEBUG_PRINTF("mic_correct(): message integrity check failed! \n");
+		METRIC_ADD_ID(rx_conn->device_id, SCHC_METRIC_MIC_FAILURES, 1);
 		return 0;
 	}
 
@@ -1532,6 +1642,11 @@ int8_t schc_reassemble(schc_fragmentation_t* rx_conn) {
 	}
 
 	tail->frag_cnt = rx_conn->frag_cnt; // update tail frag count
+	mbuf_accept_mic(rx_conn, tail); // add the tile to the running MIC
+
+	if (rx_conn->timer_flag && !rx_conn->input) { // inactivity timer expired
+		METRIC_ADD_ID(rx_conn->device_id, SCHC_METRIC_INACTIVITY_TIMEOUTS, 1);
+	}
 
 	if(rx_conn->input) { // set inactivity timer if the loop was triggered by a fragment input
 		rx_conn->remove_timer_entry(rx_conn); // remove previously set inactivity timer
@@ -1859,42 +1974,65 @@ int8_t schc_reassemble(schc_fragmentation_t* rx_conn) {
 	return 0;
 }
 
+/**
+ * Initializes the SCHC fragmenter with the default context
+ * and builds the lookup tables of the devices and rule ids, which are shared
+ * by all contexts, so this is called once, before other threads use the fragmenter
+ * See schc_fragmenter_init_ctx()
+ */
+int8_t schc_fragmenter_init(schc_fragmentation_t* tx_conn) {
+	// the devices and rule ids of incoming fragments are looked up in these tables
+	rm_build_tables();
+
+	return schc_fragmenter_init_ctx(&fragmenter_context, tx_conn);
+}
+
 /**
  * Initializes the SCHC fragmenter
- *
+ * The tx connection is bound to the context: the fragments it sends are
+ * composed in the buffer of the context and the connections opened for
+ * the fragments passed to schc_input() with it are kept in the context.
+ * Each thread or gateway instance fragmenting and reassembling packets
+ * uses its own context and tx connection. Only the context is initialized,
+ * the shared tables are built by schc_compressor_init() or schc_fragmenter_init().
+ *
+ * @param ctx					the context to hold the connections and buffers
  * @param tx_conn				a pointer to the tx initialization structure
  *
  * @return error codes on error
  *
  */
-int8_t schc_fragmenter_init(schc_fragmentation_t* tx_conn) {
+int8_t schc_fragmenter_init_ctx(schc_fragmenter_context_t* ctx, schc_fragmentation_t* tx_conn) {
 	uint32_t i;
 
 	// initializes the schc tx connection
 	tx_conn->head = NULL;
+	tx_conn->ctx = ctx;
 	schc_reset(tx_conn);
 
 #if DYNAMIC_MEMORY
-	schc_rx_conns = NULL;
+	ctx->rx_conns = NULL;
 #else
 	// initializes the schc rx connections
 	for (i = 0; i < SCHC_CONF_RX_CONNS; i++) {
-		schc_reset(&schc_rx_conns[i]);
-		schc_rx_conns[i].frag_cnt = 0;
-		schc_rx_conns[i].window_cnt = 0;
-		schc_rx_conns[i].input = 0;
-		schc_rx_conns[i].fragmentation_rule = NULL;
+		ctx->rx_conns[i].ctx = ctx;
+		schc_reset(&ctx->rx_conns[i]);
+		ctx->rx_conns[i].frag_cnt = 0;
+		ctx->rx_conns[i].window_cnt = 0;
+		ctx->rx_conns[i].input = 0;
+		ctx->rx_conns[i].fragmentation_rule = NULL;
 	}
 #endif
 
 #if !DYNAMIC_MEMORY
 	// initializes the mbuf pool
 	for(i = 0; i < SCHC_CONF_MBUF_POOL_LEN; i++) {
-		MBUF_POOL[i].ptr = NULL;
-		MBUF_POOL[i].len = 0;
-		MBUF_POOL[i].next = NULL;
-		MBUF_POOL[i].offset = 0;
+		ctx->mbuf_pool[i].ptr = NULL;
+		ctx->mbuf_pool[i].len = 0;
+		ctx->mbuf_pool[i].next = NULL;
+		ctx->mbuf_pool[i].offset = 0;
 	}
+	ctx->buf_ptr = 0;
 #endif
 
 	return 1;
@@ -1916,6 +2054,7 @@ static void tx_fragment_send(schc_fragmentation_t *tx_conn) {
 		fcn = tx_conn->fcn;
 		tx_conn->fcn = (pow(2, tx_conn->fragmentation_rule->FCN_SIZE) - 1); // all 1-window
 		if (send_fragment(tx_conn)) { // only continue when packet was transmitted
+			METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_FRAGMENTS_SENT, 1);
 			tx_conn->TX_STATE = WAIT_BITMAP;
 			set_local_bitmap(tx_conn); // set bitmap according to fcn
 			set_retrans_timer(tx_conn);
@@ -1929,6 +2068,7 @@ static void tx_fragment_send(schc_fragmentation_t *tx_conn) {
 	} else if (tx_conn->fcn == 0 && !has_no_more_fragments(tx_conn)) { // all-0 window
 		DEBUG_PRINTF("schc_fragment(): all-0 window\n");
 		if (send_fragment(tx_conn)) {
+			METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_FRAGMENTS_SENT, 1);
 			tx_conn->TX_STATE = WAIT_BITMAP;
 			set_local_bitmap(tx_conn); // set bitmap according to fcn
 			tx_conn->fcn = tx_conn->fragmentation_rule->MAX_WND_FCN; // reset the FCN
@@ -1942,6 +2082,7 @@ static void tx_fragment_send(schc_fragmentation_t *tx_conn) {
 	} else if (tx_conn->fcn != 0 && !has_no_more_fragments(tx_conn)) { // normal fragment
 		DEBUG_PRINTF("schc_fragment(): normal fragment\n");
 		if (send_fragment(tx_conn)) {
+			METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_FRAGMENTS_SENT, 1);
 			tx_conn->TX_STATE = SEND;
 			set_local_bitmap(tx_conn); // set bitmap according to fcn
 			tx_conn->fcn--;
@@ -1978,14 +2119,16 @@ static void tx_fragment_resend(schc_fragmentation_t *tx_conn) {
 		}
 	}
 
-	DEBUG_PRINTF("schc_fragment(): sending missing fragments for bitmap: \n");
-	print_bitmap(tx_conn->ack.bitmap, (tx_conn->fragmentation_rule->MAX_WND_FCN + 1));
+	DEBUG_PRINTF("schc_fragment(): sending %d missing fragments for bitmap: \n",
+			bitmap_count(&tx_conn->ack.bitmap, (tx_conn->fragmentation_rule->MAX_WND_FCN + 1)));
+	bitmap_print(&tx_conn->ack.bitmap, (tx_conn->fragmentation_rule->MAX_WND_FCN + 1));
 	DEBUG_PRINTF("with FCN %d, window count %d, frag count %d\n", tx_conn->fcn,
 			tx_conn->window_cnt, tx_conn->frag_cnt);
 
 	if (last) { // check if this was the last fragment
 		DEBUG_PRINTF("schc_fragment(): last missing fragment to send\n");
 		if (send_fragment(tx_conn)) { // retransmit the fragment
+			METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_FRAGMENTS_RESENT, 1);
 			tx_conn->TX_STATE = WAIT_BITMAP;
 			tx_conn->frag_cnt = (tx_conn->window_cnt + 1)
 					* (tx_conn->fragmentation_rule->MAX_WND_FCN + 1);
@@ -1997,6 +2140,7 @@ static void tx_fragment_resend(schc_fragmentation_t *tx_conn) {
 
 	} else {
 		if (send_fragment(tx_conn)) { // retransmit the fragment
+			METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_FRAGMENTS_RESENT, 1);
 			tx_conn->TX_STATE = RESEND;
 		} else {
 			tx_conn->frag_cnt = frag_cnt;
@@ -2039,8 +2183,13 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 		if (!ret) {
 			return SCHC_FAILURE;
 		} else if (ret < 0) {
-			tx_conn->send(tx_conn->bit_arr->ptr, tx_conn->bit_arr->len,
-					tx_conn->device_id); // send packet right away
+			uint8_t* packet = tx_conn->bit_arr->ptr;
+			if (tx_conn->payload != NULL) { // join the detached payload, the packet fits the mtu
+				packet = get_context(tx_conn)->fragmentation_buf;
+				memset(packet, 0, tx_conn->bit_arr->len);
+				tx_copy_bits(tx_conn, packet, 0, 0, BYTES_TO_BITS(tx_conn->bit_arr->len));
+			}
+			tx_conn->send(packet, tx_conn->bit_arr->len, tx_conn->device_id); // send packet right away
 			return SCHC_NO_FRAGMENTATION;
 		}
 		tx_conn->TX_STATE = SEND;
@@ -2068,11 +2217,11 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 		}
 		case WAIT_BITMAP: {
 			DEBUG_PRINTF("WAIT_BITMAP\n");
-			uint8_t resend_window[BITMAP_SIZE_BYTES] = { 0 }; // if ack.bitmap is all-0, there are no packets to retransmit
 
 			if (tx_conn->attempts >= MAX_ACK_REQUESTS) {
 				DEBUG_PRINTF(
 						"tx_conn->attempts >= MAX_ACK_REQUESTS: send abort\n"); // todo
+				METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_ABORTS, 1);
 				tx_conn->TX_STATE = ERR;
 				tx_conn->timer_flag = 0; // stop retransmission timer
 				// send_abort();
@@ -2088,7 +2237,7 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 			if (tx_conn->ack.window[0] == tx_conn->window) {
 				DEBUG_PRINTF("w == w\n");
 				if (!has_no_more_fragments(tx_conn)
-						&& compare_bits(resend_window, tx_conn->ack.bitmap,
+						&& bitmap_is_empty(&tx_conn->ack.bitmap,
 								(tx_conn->fragmentation_rule->MAX_WND_FCN + 1))) { // no missing fragments & more fragments
 					no_missing_fragments_more_to_come(tx_conn);
 					schc_fragment(tx_conn);
@@ -2101,7 +2250,7 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 					break;
 				}
 			}
-			if (!compare_bits(resend_window, tx_conn->ack.bitmap,
+			if (!bitmap_is_empty(&tx_conn->ack.bitmap,
 					(tx_conn->fragmentation_rule->MAX_WND_FCN + 1))) { //ack.bitmap contains the missing fragments
 				DEBUG_PRINTF("bitmap contains the missing fragments: \n");
 				tx_conn->attempts++;
@@ -2114,6 +2263,7 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 			}
 			if (tx_conn->timer_flag) { // timer expired
 				DEBUG_PRINTF("timer expired\n"); // todo
+				METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_RETRANSMISSION_TIMEOUTS, 1);
 				if (send_empty(tx_conn)) { // requests retransmission of all-x ack with empty all-x
 					tx_conn->attempts++;
 					set_retrans_timer(tx_conn);
@@ -2162,6 +2312,8 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 						"schc_fragment(): radio occupied retrying in %d ms\n",
 						(int) tx_conn->dc);
 				tx_conn->frag_cnt--;
+			} else {
+				METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_FRAGMENTS_SENT, 1);
 			}
 			set_dc_timer(tx_conn); // send next fragment in dc ms or end transmission
 			break;
@@ -2194,11 +2346,11 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 		}
 		case WAIT_BITMAP: {
 			DEBUG_PRINTF("WAIT_BITMAP\n");
-			uint8_t resend_window[BITMAP_SIZE_BYTES] = { 0 }; // if ack.bitmap is all-0, there are no packets to retransmit
 
 			if (tx_conn->attempts >= MAX_ACK_REQUESTS) {
 				DEBUG_PRINTF(
 						"tx_conn->attempts >= MAX_ACK_REQUESTS: send abort\n"); // todo
+				METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_ABORTS, 1);
 				tx_conn->TX_STATE = ERR;
 				tx_conn->timer_flag = 0; // stop retransmission timer
 				// send_abort();
@@ -2207,6 +2359,7 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 			}
 			if (tx_conn->timer_flag && !tx_conn->input) { // timer expired
 				DEBUG_PRINTF("timer expired\n"); // todo
+				METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_RETRANSMISSION_TIMEOUTS, 1);
 
 				if (!has_no_more_fragments(tx_conn)) { // more fragments to come
 					no_missing_fragments_more_to_come(tx_conn);
@@ -2225,7 +2378,7 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 				tx_conn->TX_STATE = WAIT_BITMAP;
 				break;
 			}
-			if (!compare_bits(resend_window, tx_conn->ack.bitmap,
+			if (!bitmap_is_empty(&tx_conn->ack.bitmap,
 					(tx_conn->fragmentation_rule->MAX_WND_FCN + 1))) { //ack.bitmap contains the missing fragments
 				DEBUG_PRINTF("bitmap contains the missing fragments\n");
 				tx_conn->attempts++;
@@ -2235,8 +2388,7 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
 				tx_conn->TX_STATE = RESEND;
 				schc_fragment(tx_conn);
 				break;
-			} else if (compare_bits(resend_window, tx_conn->ack.bitmap,
-					(tx_conn->fragmentation_rule->MAX_WND_FCN + 1))) {
+			} else {
 				DEBUG_PRINTF("received bitmap == local bitmap\n");
 				tx_conn->timer_flag = 0; // stop retransmission timer
 				tx_conn->TX_STATE = END_TX;
@@ -2274,7 +2426,7 @@ int8_t schc_fragment(schc_fragmentation_t *tx_conn) {
  *
  */
 schc_fragmentation_t* schc_input(uint8_t* data, uint16_t len, schc_fragmentation_t* tx_conn,
-		uint32_t device_id) {
+		schc_device_id_t device_id) {
 	if ((tx_conn->TX_STATE == WAIT_BITMAP || tx_conn->TX_STATE == RESEND)
 			&& compare_bits(tx_conn->rule_id, data, tx_conn->fragmentation_rule->rule_id_size_bits)) { // acknowledgment
 		schc_ack_input(data, tx_conn);
@@ -2298,6 +2450,8 @@ void schc_ack_input(uint8_t* data, schc_fragmentation_t* tx_conn) {
 	uint8_t bit_offset = tx_conn->fragmentation_rule->rule_id_size_bits;
 	tx_conn->input = 1;
 
+	METRIC_ADD_ID(tx_conn->device_id, SCHC_METRIC_ACKS_RECEIVED, 1);
+
 	memset(tx_conn->ack.dtag, 0, 1); // clear dtag from prev reception
 	copy_bits(tx_conn->ack.dtag, (8 - tx_conn->fragmentation_rule->DTAG_SIZE), (uint8_t*) data,
 			bit_offset, tx_conn->fragmentation_rule->DTAG_SIZE); // get dtag
@@ -2309,7 +2463,7 @@ void schc_ack_input(uint8_t* data, schc_fragmentation_t* tx_conn) {
 	bit_offset += tx_conn->fragmentation_rule->WINDOW_SIZE;
 
 	uint8_t bitmap_len = (tx_conn->fragmentation_rule->MAX_WND_FCN + 1);
-	memset(tx_conn->ack.bitmap, 0, BITMAP_SIZE_BYTES); // clear bitmap from prev reception
+	bitmap_clear(&tx_conn->ack.bitmap); // clear bitmap from prev reception
 
 	if(has_no_more_fragments(tx_conn)) { // all-1 window
 		uint8_t mic[1] = { 0 };
@@ -2325,18 +2479,11 @@ void schc_ack_input(uint8_t* data, schc_fragmentation_t* tx_conn) {
 
 	// ToDo
 	// decode_bitmap(tx_conn);
-	copy_bits(tx_conn->ack.bitmap, 0, (uint8_t*) data, bit_offset,
-			bitmap_len);
-
-	// copy bits for retransmit bitmap to intermediate buffer
-	uint8_t resend_window[BITMAP_SIZE_BYTES] = { 0 };
+	bitmap_read(&tx_conn->ack.bitmap, (uint8_t*) data, bit_offset, bitmap_len);
 
-	xor_bits(resend_window, tx_conn->bitmap, tx_conn->ack.bitmap,
-			bitmap_len); // to indicate which fragments to retransmit
-
-	// copy retransmit bitmap for current window to ack.bitmap
-	memset(tx_conn->ack.bitmap, 0, BITMAP_SIZE_BYTES);
-	copy_bits(tx_conn->ack.bitmap, 0, resend_window, 0, bitmap_len);
+	// keep the fragments to retransmit for the current window in ack.bitmap
+	bitmap_xor(&tx_conn->ack.bitmap, &tx_conn->bitmap, &tx_conn->ack.bitmap,
+			bitmap_len);
 
 	// continue with state machine
 	schc_fragment(tx_conn);
@@ -2349,17 +2496,18 @@ void schc_ack_input(uint8_t* data, schc_fragmentation_t* tx_conn) {
  *
  * @param 	data			a pointer to the data packet
  * @param 	len				the length of the received packet
+ * @param 	tx_conn			the tx connection, the connection is opened in its context
  * @param 	device_id		the device id from the rx source
  *
  * @return 	conn			the connection
  *
  */
 schc_fragmentation_t* schc_fragment_input(uint8_t* data, uint16_t len,
-		schc_fragmentation_t *tx_conn, uint32_t device_id) {
+		schc_fragmentation_t *tx_conn, schc_device_id_t device_id) {
 	schc_fragmentation_t *conn;
 
-	// get a connection for the device
-	conn = schc_get_connection(device_id);
+	// get a connection for the device, from the context of the tx connection
+	conn = schc_get_connection_ctx(get_context(tx_conn), device_id);
 	if (!conn) { // return if there was no connection available
 		DEBUG_PRINTF("schc_fragment_input(): no free connections found!\n");
 		return NULL;
@@ -2371,7 +2519,7 @@ schc_fragmentation_t* schc_fragment_input(uint8_t* data, uint16_t len,
 	conn->free_conn_cb 			= tx_conn->free_conn_cb;
 #endif
 
-	conn->fragmentation_rule 	= get_fragmentation_rule_by_rule_id(data, device_id);
+	conn->fragmentation_rule 	= get_fragmentation_rule_by_rule_id(get_device_by_id(device_id), data);
 
 	// todo
 	// if no rule was found
@@ -2381,21 +2529,22 @@ schc_fragmentation_t* schc_fragment_input(uint8_t* data, uint16_t len,
 #if DYNAMIC_MEMORY
 	fragment = (uint8_t*) malloc(len); // allocate memory for fragment
 #else
-	fragment = (uint8_t*) (schc_buf + buf_ptr); // take fixed memory block
-	buf_ptr += len;
+	fragment = (uint8_t*) (conn->ctx->buf + conn->ctx->buf_ptr); // take fixed memory block
+	conn->ctx->buf_ptr += len;
 #endif
 
 	memcpy(fragment, data, len);
 
-	int8_t err = mbuf_push(&conn->head, fragment, len);
+	int8_t err = mbuf_push(conn->ctx, &conn->head, fragment, len);
 
-	mbuf_print(conn->head);
+	mbuf_trace(conn->head);
 
 	if(err != SCHC_SUCCESS) {
 		schc_free_connection(conn);
 		return NULL;
 	}
 
+	METRIC_ADD_ID(device_id, SCHC_METRIC_FRAGMENTS_RECEIVED, 1);
 	conn->input = 1; // set fragment input to 1, to distinguish between inactivity callbacks
 
 	return conn;
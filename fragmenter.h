@@ -14,6 +14,7 @@ extern "C" {
 #endif
 
 #include "schc.h"
+#include "bit_operations.h"
 
 /**
  * Return code: Indicator. Generic indication that a fragment was received
@@ -74,7 +75,7 @@ typedef struct schc_fragmentation_ack_t {
 	/* the rule id included in the ack */
 	uint8_t rule_id[RULE_SIZE_BYTES];
 	/* the encoded bitmap included in the ack */
-	uint8_t bitmap[BITMAP_SIZE_BYTES];
+	schc_bitmap_t bitmap;
 	/* the window included in the ack */
 	uint8_t window[1];
 	/* the DTAG received in the ack */
@@ -87,6 +88,7 @@ typedef struct schc_fragmentation_ack_t {
 } schc_fragmentation_ack_t;
 
 typedef struct schc_fragmentation_t schc_fragmentation_t;
+typedef struct schc_fragmenter_context_t schc_fragmenter_context_t;
 
 struct schc_fragmentation_t {
 #if DYNAMIC_MEMORY
@@ -94,10 +96,16 @@ struct schc_fragmentation_t {
 	/* this callback is called upon freeing the connections that were allocated */
 	void (*free_conn_cb)(struct schc_fragmentation_t *conn);
 #endif
+	/* the fragmenter context the connection belongs to */
+	schc_fragmenter_context_t *ctx;
 	/* the device id of the connection */
-	uint32_t device_id;
+	schc_device_id_t device_id;
 	/* a pointer to the start of the unfragmented, compressed packet in a bit array */
 	schc_bitarray_t* bit_arr;
+	/* tx: the payload left in the original packet by schc_compress_detached(),
+	 * following the bits of bit_arr from bit_arr->offset on,
+	 * NULL if bit_arr holds the complete packet */
+	const uint8_t* payload;
 	/* the start of the packet + the total length */
 	uint8_t* tail_ptr;
 	/* the maximum transfer unit of this connection */
@@ -106,6 +114,18 @@ struct schc_fragmentation_t {
 	uint32_t dc;
 	/* the message integrity check over the full, compressed packet */
 	uint8_t mic[MIC_SIZE_BYTES];
+	/* the running MIC over the tiles sent or received in order */
+	uint32_t mic_crc;
+	/* tx: the number of packet bytes in mic_crc
+	 * rx: the bit offset in mic_mbuf to continue mic_crc from */
+	uint32_t mic_offset;
+	/* rx: the mbuf to continue mic_crc from and its predecessor */
+	struct schc_mbuf_t *mic_mbuf;
+	struct schc_mbuf_t *mic_prev;
+	/* rx: the last mbuf that was received in order */
+	struct schc_mbuf_t *mic_last;
+	/* rx: tiles arrived out of order, compute the MIC over the sorted chain */
+	uint8_t mic_deferred;
 	/* the fragment counter in the current window
 	 * ToDo: we only support fixed FCN length
 	 * */
@@ -119,7 +139,7 @@ struct schc_fragmentation_t {
 	/* the total number of fragments sent */
 	uint8_t frag_cnt;
 	/* the bitmap of the fragments sent */
-	uint8_t bitmap[BITMAP_SIZE_BYTES];
+	schc_bitmap_t bitmap;
 	/* the number of transmission attempts */
 	uint8_t attempts;
 	/* the current state for the sending device */
@@ -127,7 +147,7 @@ struct schc_fragmentation_t {
 	/* the current state for the receiving device */
 	rx_state RX_STATE;
 	/* the function to call when the fragmenter has something to send */
-	uint8_t (*send)(uint8_t* data, uint16_t length, uint32_t device_id);
+	uint8_t (*send)(uint8_t* data, uint16_t length, schc_device_id_t device_id);
 	/* the timer task */
 	void (*post_timer_task)(struct schc_fragmentation_t *conn,
 			void (*timer_task)(void* arg), uint32_t time_ms, void *arg);
@@ -153,20 +173,44 @@ struct schc_fragmentation_t {
 	uint8_t rule_id[4];
 };
 
+/*
+ * The connections and buffers of a fragmenter.
+ * The fragmentation rules and the tables built by schc_fragmenter_init()
+ * are shared and only read, so each thread or gateway instance
+ * fragmenting and reassembling packets uses its own context.
+ */
+struct schc_fragmenter_context_t {
+	/* the buffer the fragments are composed in before they are sent */
+	uint8_t fragmentation_buf[MAX_MTU_LENGTH];
+#if DYNAMIC_MEMORY
+	/* the list of rx connections */
+	schc_fragmentation_t *rx_conns;
+#else
+	schc_fragmentation_t rx_conns[SCHC_CONF_RX_CONNS];
+	/* the received fragments are stored in buf, from buf_ptr on */
+	uint8_t buf_ptr;
+	uint8_t buf[STATIC_MEMORY_BUFFER_LENGTH];
+	schc_mbuf_t mbuf_pool[SCHC_CONF_MBUF_POOL_LEN];
+#endif
+};
+
 int8_t schc_fragmenter_init(schc_fragmentation_t* tx_conn);
+int8_t schc_fragmenter_init_ctx(schc_fragmenter_context_t* ctx, schc_fragmentation_t* tx_conn);
 int8_t schc_fragment(schc_fragmentation_t *tx_conn);
 int8_t schc_reassemble(schc_fragmentation_t* rx_conn);
 void schc_reset(schc_fragmentation_t* conn);
 
 schc_fragmentation_t* schc_input(uint8_t* data, uint16_t len,
-		schc_fragmentation_t* rx_conn, uint32_t device_id);
+		schc_fragmentation_t* rx_conn, schc_device_id_t device_id);
 void schc_ack_input(uint8_t* data, schc_fragmentation_t* tx_conn);
 schc_fragmentation_t* schc_fragment_input(uint8_t* data, uint16_t len,
-		schc_fragmentation_t *tx_conn, uint32_t device_id);
-schc_fragmentation_t* schc_get_connection(uint32_t device_id);
+		schc_fragmentation_t *tx_conn, schc_device_id_t device_id);
+schc_fragmentation_t* schc_get_connection(schc_device_id_t device_id);
+schc_fragmentation_t* schc_get_connection_ctx(schc_fragmenter_context_t *ctx,
+		schc_device_id_t device_id);
 
 struct schc_fragmentation_rule_t* get_fragmentation_rule_by_reliability_mode(reliability_mode mode,
-		uint32_t device_id);
+		schc_device_id_t device_id);
 
 uint16_t get_mbuf_len(schc_fragmentation_t *conn);
 void mbuf_copy(schc_fragmentation_t *conn, uint8_t* ptr);
@@ -0,0 +1,283 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * Counters of the compressor and fragmenter, kept per thread without locks
+ * and added up when they are read
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include "metrics.h"
+
+#if CLICK
+#include <click/config.h>
+#endif
+
+#if USE_METRICS == 1
+
+#if defined(__GNUC__)
+#define METRICS_THREAD_LOCAL			__thread
+#else
+#define METRICS_THREAD_LOCAL			_Thread_local
+#endif
+
+/*
+ * The counters of a device, only written by the thread that owns them
+ * A slot is taken by the first device that hashes to it, its id is
+ * set before used, so a snapshot reads the id of a used slot.
+ */
+struct metrics_device_t {
+	_Atomic uint8_t used;
+	schc_device_id_t device_id;
+	_Atomic uint64_t counters[SCHC_METRICS];
+	_Atomic uint64_t size_histogram[METRICS_SIZE_BUCKETS];
+	_Atomic uint64_t rule_hits[METRICS_RULES];
+	_Atomic uint64_t rule_misses[METRICS_RULES];
+};
+
+struct metrics_thread_t {
+	struct metrics_device_t devices[METRICS_DEVICES + 1];
+};
+
+/* indexed by schc_metric_t */
+static const char* metric_names[SCHC_METRICS] = {
+	"schc_compressed_packets",
+	"schc_uncompressed_packets",
+	"schc_compress_bytes_in",
+	"schc_compress_bytes_out",
+	"schc_decompressed_packets",
+	"schc_fragments_sent",
+	"schc_fragments_resent",
+	"schc_fragments_received",
+	"schc_acks_sent",
+	"schc_acks_received",
+	"schc_ack_requests_sent",
+	"schc_mic_failures",
+	"schc_aborts",
+	"schc_inactivity_timeouts",
+	"schc_retransmission_timeouts"
+};
+
+static struct metrics_thread_t metrics_threads[METRICS_THREADS];
+static _Atomic uint32_t metrics_thread_count;
+static METRICS_THREAD_LOCAL struct metrics_thread_t* thread_metrics;
+
+/*
+ * Get the counters of the calling thread
+ * The threads after the first METRICS_THREADS share the last counters,
+ * of which increments can get lost.
+ */
+static struct metrics_thread_t* get_thread_metrics(void) {
+	if (thread_metrics == NULL) {
+		uint32_t index = atomic_fetch_add(&metrics_thread_count, 1);
+		thread_metrics = &metrics_threads[(index < METRICS_THREADS) ? index : (METRICS_THREADS - 1)];
+	}
+	return thread_metrics;
+}
+
+/*
+ * Get the counters of a device for the calling thread, in the slot at the
+ * hash of its id or one of the next METRICS_PROBES - 1 slots
+ * The devices that find no slot share the last counters.
+ */
+static struct metrics_device_t* get_device_metrics(const struct schc_device* device) {
+	struct metrics_thread_t* metrics = get_thread_metrics();
+	uint32_t i, slot;
+
+	if (device == NULL) {
+		return &metrics->devices[METRICS_DEVICES];
+	}
+
+	slot = (uint32_t) (device_id_hash(device->device_id) % METRICS_DEVICES);
+	for (i = 0; i < METRICS_PROBES && i < METRICS_DEVICES; i++) {
+		struct metrics_device_t* entry = &metrics->devices[slot];
+		if (!atomic_load_explicit(&entry->used, memory_order_relaxed)) {
+			entry->device_id = device->device_id;
+			atomic_store_explicit(&entry->used, 1, memory_order_release);
+			return entry;
+		}
+		if (entry->device_id == device->device_id) {
+			return entry;
+		}
+		slot = (slot + 1) % METRICS_DEVICES;
+	}
+
+	return &metrics->devices[METRICS_DEVICES];
+}
+
+/* increment a counter, by its own thread only */
+static inline void counter_add(_Atomic uint64_t* counter, uint64_t n) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+			memory_order_relaxed);
+}
+
+/**
+ * Add to a counter of a device, use METRIC_ADD() instead
+ *
+ * @param 	device			the device, NULL if not found
+ * @param 	metric			the counter
+ * @param 	n				the number to add
+ */
+void schc_metric_add(const struct schc_device* device, schc_metric_t metric, uint32_t n) {
+	counter_add(&get_device_metrics(device)->counters[metric], n);
+}
+
+/**
+ * Count a compressed packet in the size histogram, use METRIC_SIZE() instead
+ *
+ * @param 	device			the device
+ * @param 	len				the length of the compressed packet in bytes
+ */
+void schc_metric_size(const struct schc_device* device, uint16_t len) {
+	uint8_t bucket = 0;
+	while (bucket < (METRICS_SIZE_BUCKETS - 1) && len >= (8U << bucket)) {
+		bucket++;
+	}
+	counter_add(&get_device_metrics(device)->size_histogram[bucket], 1);
+}
+
+/**
+ * Count a rule that was found or that did not match, use METRIC_RULE() instead
+ *
+ * @param 	device			the device
+ * @param 	index			the position of the rule in the context of the device
+ * @param 	hit				1 if the rule was found, 0 if it did not match
+ */
+void schc_metric_rule(const struct schc_device* device, uint8_t index, uint8_t hit) {
+	if (index >= METRICS_RULES) {
+		return;
+	}
+	struct metrics_device_t* metrics = get_device_metrics(device);
+	counter_add(hit ? &metrics->rule_hits[index] : &metrics->rule_misses[index], 1);
+}
+
+/*
+ * Get the counters of a snapshot for a slot of a thread, by the id of its
+ * device, the devices after the first METRICS_DEVICES share the last counters
+ */
+static schc_device_metrics_t* get_snapshot_device(schc_metrics_t* snapshot,
+		struct metrics_device_t* src) {
+	uint32_t d;
+
+	if (!atomic_load_explicit(&src->used, memory_order_acquire)) {
+		return &snapshot->devices[METRICS_DEVICES];
+	}
+	for (d = 0; d < snapshot->device_count; d++) {
+		if (snapshot->devices[d].device_id == src->device_id) {
+			return &snapshot->devices[d];
+		}
+	}
+	if (snapshot->device_count == METRICS_DEVICES) {
+		return &snapshot->devices[METRICS_DEVICES];
+	}
+
+	snapshot->devices[snapshot->device_count].device_id = src->device_id;
+	return &snapshot->devices[snapshot->device_count++];
+}
+
+/**
+ * Add up the counters of all threads, per device
+ * The counters of a thread are read while they are counted,
+ * so a snapshot is consistent per counter, not between counters.
+ *
+ * @param 	snapshot		set to the sum of the counters
+ */
+void schc_metrics_snapshot(schc_metrics_t* snapshot) {
+	uint32_t t, d, i, threads = atomic_load(&metrics_thread_count);
+
+	if (threads > METRICS_THREADS) {
+		threads = METRICS_THREADS;
+	}
+	memset(snapshot, 0, sizeof(schc_metrics_t));
+	snapshot->threads = (uint8_t) threads;
+
+	for (t = 0; t < threads; t++) {
+		for (d = 0; d <= METRICS_DEVICES; d++) {
+			struct metrics_device_t* src = &metrics_threads[t].devices[d];
+			schc_device_metrics_t* dst = get_snapshot_device(snapshot, src);
+			for (i = 0; i < SCHC_METRICS; i++) {
+				dst->counters[i] += atomic_load_explicit(&src->counters[i], memory_order_relaxed);
+			}
+			for (i = 0; i < METRICS_SIZE_BUCKETS; i++) {
+				dst->size_histogram[i] += atomic_load_explicit(&src->size_histogram[i], memory_order_relaxed);
+			}
+			for (i = 0; i < METRICS_RULES; i++) {
+				dst->rule_hits[i] += atomic_load_explicit(&src->rule_hits[i], memory_order_relaxed);
+				dst->rule_misses[i] += atomic_load_explicit(&src->rule_misses[i], memory_order_relaxed);
+			}
+		}
+	}
+}
+
+/* print the device label of a line, the shared counters have an empty id */
+static void print_labels(const schc_metrics_t* snapshot, uint32_t d, FILE* out) {
+	if (d < snapshot->device_count) {
+		fprintf(out, "{device=\"%" PRIu64 "\"", (uint64_t) snapshot->devices[d].device_id);
+	} else {
+		fprintf(out, "{device=\"\"");
+	}
+}
+
+/**
+ * Print a snapshot as text, one counter per line in the
+ * Prometheus text format, the counters that are 0 are left out
+ * The rules are labelled with their rule id.
+ *
+ * @param 	snapshot		the snapshot of schc_metrics_snapshot()
+ * @param 	out				the file to print to
+ */
+void schc_metrics_print(const schc_metrics_t* snapshot, FILE* out) {
+	uint32_t d, i;
+
+	for (d = 0; d <= METRICS_DEVICES; d++) {
+		const schc_device_metrics_t* metrics = &snapshot->devices[d];
+		const struct schc_device* device = (d < snapshot->device_count) ?
+				get_device_by_id(metrics->device_id) : NULL;
+
+		for (i = 0; i < SCHC_METRICS; i++) {
+			if (metrics->counters[i]) {
+				fprintf(out, "%s", metric_names[i]);
+				print_labels(snapshot, d, out);
+				fprintf(out, "} %" PRIu64 "\n", metrics->counters[i]);
+			}
+		}
+		for (i = 0; i < METRICS_SIZE_BUCKETS; i++) {
+			if (metrics->size_histogram[i]) {
+				fprintf(out, "schc_compressed_size");
+				print_labels(snapshot, d, out);
+				if (i < METRICS_SIZE_BUCKETS - 1) {
+					fprintf(out, ",lt=\"%u\"} %" PRIu64 "\n", 8U << i, metrics->size_histogram[i]);
+				} else {
+					fprintf(out, ",lt=\"+Inf\"} %" PRIu64 "\n", metrics->size_histogram[i]);
+				}
+			}
+		}
+		for (i = 0; i < METRICS_RULES && device != NULL && i < device->compression_rule_count; i++) {
+			uint32_t rule_id = (*device->compression_context)[i]->rule_id;
+			if (metrics->rule_hits[i]) {
+				fprintf(out, "schc_rule_hits");
+				print_labels(snapshot, d, out);
+				fprintf(out, ",rule=\"%" PRIu32 "\"} %" PRIu64 "\n", rule_id, metrics->rule_hits[i]);
+			}
+			if (metrics->rule_misses[i]) {
+				fprintf(out, "schc_rule_misses");
+				print_labels(snapshot, d, out);
+				fprintf(out, ",rule=\"%" PRIu32 "\"} %" PRIu64 "\n", rule_id, metrics->rule_misses[i]);
+			}
+		}
+	}
+}
+
+#endif
+
+#if CLICK
+ELEMENT_PROVIDES(schcMETRICS)
+#endif
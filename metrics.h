@@ -0,0 +1,109 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ */
+#ifndef _SCHC_METRICS_H_
+#define _SCHC_METRICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "schc.h"
+
+#ifndef USE_METRICS
+#define USE_METRICS						0
+#endif
+#ifndef METRICS_THREADS
+#define METRICS_THREADS					16 // threads with their own counters
+#endif
+#ifndef METRICS_DEVICES
+#define METRICS_DEVICES					8 // the devices with their own counters, per thread
+#endif
+#ifndef METRICS_PROBES
+#define METRICS_PROBES					4 // the slots tried for a device, from the hash of its id
+#endif
+#ifndef METRICS_RULES
+#define METRICS_RULES					32 // the first compression rules of a device
+#endif
+
+/* the compressed packet lengths, bucket i holds < 2^(i + 3) bytes, the last one the rest */
+#define METRICS_SIZE_BUCKETS			8
+
+/* the counters kept per device */
+typedef enum {
+	SCHC_METRIC_COMPRESSED = 0, // packets compressed with a rule
+	SCHC_METRIC_UNCOMPRESSED = 1, // packets sent with the uncompressed rule
+	SCHC_METRIC_BYTES_IN = 2, // bytes of the packets before compression
+	SCHC_METRIC_BYTES_OUT = 3, // bytes of the packets after compression
+	SCHC_METRIC_DECOMPRESSED = 4,
+	SCHC_METRIC_FRAGMENTS_SENT = 5,
+	SCHC_METRIC_FRAGMENTS_RESENT = 6,
+	SCHC_METRIC_FRAGMENTS_RECEIVED = 7,
+	SCHC_METRIC_ACKS_SENT = 8,
+	SCHC_METRIC_ACKS_RECEIVED = 9,
+	SCHC_METRIC_ACK_REQUESTS_SENT = 10, // empty all-x fragments
+	SCHC_METRIC_MIC_FAILURES = 11,
+	SCHC_METRIC_ABORTS = 12,
+	SCHC_METRIC_INACTIVITY_TIMEOUTS = 13,
+	SCHC_METRIC_RETRANSMISSION_TIMEOUTS = 14,
+	SCHC_METRICS
+} schc_metric_t;
+
+/*
+ * The counters of a device
+ * The devices without a slot of their own, and the
+ * devices that are not found, share one, with device_id 0.
+ */
+typedef struct schc_device_metrics_t {
+	schc_device_id_t device_id;
+	uint64_t counters[SCHC_METRICS];
+	uint64_t size_histogram[METRICS_SIZE_BUCKETS];
+	/* the rule was found by the rule search or the flow cache */
+	uint64_t rule_hits[METRICS_RULES];
+	/* the rule was compared and did not match */
+	uint64_t rule_misses[METRICS_RULES];
+} schc_device_metrics_t;
+
+/*
+ * The counters of all threads, see schc_metrics_snapshot()
+ * The first device_count devices have their own counters,
+ * devices[METRICS_DEVICES] holds the other devices.
+ */
+typedef struct schc_metrics_t {
+	uint8_t threads;
+	uint8_t device_count;
+	schc_device_metrics_t devices[METRICS_DEVICES + 1];
+} schc_metrics_t;
+
+#if USE_METRICS == 1
+#define METRIC_ADD(device, metric, n)	schc_metric_add(device, metric, n)
+#define METRIC_ADD_ID(device_id, metric, n)	schc_metric_add(get_device_by_id(device_id), metric, n)
+#define METRIC_SIZE(device, len)		schc_metric_size(device, len)
+#define METRIC_RULE(device, index, hit)	schc_metric_rule(device, index, hit)
+#else
+#define METRIC_ADD(device, metric, n)
+#define METRIC_ADD_ID(device_id, metric, n)
+#define METRIC_SIZE(device, len)
+#define METRIC_RULE(device, index, hit)
+#endif
+
+void schc_metric_add(const struct schc_device* device, schc_metric_t metric, uint32_t n);
+void schc_metric_size(const struct schc_device* device, uint16_t len);
+void schc_metric_rule(const struct schc_device* device, uint8_t index, uint8_t hit);
+
+void schc_metrics_snapshot(schc_metrics_t* snapshot);
+void schc_metrics_print(const schc_metrics_t* snapshot, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * (c) 2020 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ */
+#ifndef _SCHC_MIC_H_
+#define _SCHC_MIC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "schc.h"
+
+/* the MIC backends, all compute the same CRC32 */
+#define MIC_CRC32_BITWISE				0 // eight shifts per byte, no table
+#define MIC_CRC32_NIBBLE				1 // 16-entry table, for MCU builds
+#define MIC_CRC32_SLICING8				2 // 8 x 256-entry tables, 8 bytes per step
+#define MIC_CRC32_HW					3 // PCLMULQDQ or ARMv8 CRC32, slicing-by-8 otherwise
+
+#ifndef MIC_BACKEND
+#define MIC_BACKEND						MIC_CRC32_SLICING8
+#endif
+
+#define MIC_CRC32_INIT					0xFFFFFFFF
+
+// start a MIC computation
+#define mic_init()						(MIC_CRC32_INIT)
+
+// finish a MIC computation
+#define mic_final(crc)					(~(crc))
+
+// add bytes to a running MIC, using the configured backend
+uint32_t mic_update(uint32_t crc, const uint8_t* data, uint32_t len);
+
+// add zero bytes (padding) to a running MIC
+uint32_t mic_update_zeros(uint32_t crc, uint32_t len);
+
+// write the MIC to a byte array, most significant byte first
+void mic_to_bytes(uint8_t mic[MIC_SIZE_BYTES], uint32_t crc);
+
+// the individual backends
+uint32_t mic_crc32_bitwise(uint32_t crc, const uint8_t* data, uint32_t len);
+uint32_t mic_crc32_nibble(uint32_t crc, const uint8_t* data, uint32_t len);
+uint32_t mic_crc32_slicing8(uint32_t crc, const uint8_t* data, uint32_t len);
+uint32_t mic_crc32_hw(uint32_t crc, const uint8_t* data, uint32_t len);
+
+// 1 if mic_crc32_hw() runs on a hardware CRC path on this cpu
+uint8_t mic_hw_available(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,10 +7,79 @@
  *
  */
 
+#include <string.h>
+
 #include "schc.h"
 #include "bit_operations.h"
+#include "context_file.h"
+#include "trace.h"
 #include "rules/rule_config.h"
 
+#define RULE_ID_COMPRESSION			0
+#define RULE_ID_FRAGMENTATION		1
+
+#if USE_RULE_ID_TABLE == 1
+/*
+ * A table per rule context and kind of rule, indexed by the first byte of a packet.
+ * An entry holds the first rule in the context with a rule id of up to 8 bits
+ * that the byte starts with, so the rule is found with a single read.
+ * Rule ids longer than 8 bits hold the first rule with a longer rule id
+ * starting with the byte, with RULE_ID_SCAN set:
+ * the rules are compared one by one from there.
+ */
+#define RULE_ID_NONE				0xFFFF
+#define RULE_ID_SCAN				0x8000
+
+#define RULE_ID_TABLES				(2 * RULE_ID_TABLE_CONTEXTS)
+
+struct rule_id_table_t {
+	/* the rules of the devices this table is used for */
+	const void* context;
+	uint8_t rule_count;
+	uint8_t kind;
+	uint16_t entries[256];
+};
+
+static struct rule_id_table_t rule_id_tables[RULE_ID_TABLES];
+static uint16_t rule_id_table_count;
+/* the position of each table plus one, 0 if empty, at the hash of its context */
+static uint16_t rule_id_slots[2 * RULE_ID_TABLES];
+#endif
+
+/*
+ * An open addressing hash table of the devices, built at init,
+ * holding the position of each device in devices[] plus one, 0 if empty
+ */
+#define DEVICE_TABLE_SIZE			(2 * DEVICE_COUNT)
+
+static uint32_t device_table[DEVICE_TABLE_SIZE];
+static uint8_t device_table_built;
+
+/**
+ * Hash a device id for a device table
+ * The slot of a device is the hash modulo the size of the table,
+ * the next slots are tried when it is taken.
+ *
+ * @param device_id 	the id of the device
+ *
+ * @return the hash
+ *
+ */
+uint64_t device_id_hash(schc_device_id_t device_id) {
+	uint64_t h = device_id; // 64-bit finalizer, spreads sequential ids
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static uint32_t device_hash(schc_device_id_t device_id) {
+	return (uint32_t) (device_id_hash(device_id) % DEVICE_TABLE_SIZE);
+}
+
 /**
  * Get a device by it's id
  *
@@ -20,8 +89,22 @@
  *         NULL			if no device was found
  *
  */
-struct schc_device* get_device_by_id(uint32_t device_id) {
-	int i = 0;
+struct schc_device* get_device_by_id(schc_device_id_t device_id) {
+	uint32_t i = 0;
+
+#if USE_CONTEXT_FILE == 1
+	if (schc_context_file_loaded()) {
+		return schc_context_file_device_by_id(device_id);
+	}
+#endif
+	if (device_table_built) {
+		for (i = device_hash(device_id); device_table[i]; i = (i + 1) % DEVICE_TABLE_SIZE) {
+			if (devices[device_table[i] - 1]->device_id == device_id) {
+				return (struct schc_device*) devices[device_table[i] - 1];
+			}
+		}
+		return NULL;
+	}
 
 	for (i = 0; i < DEVICE_COUNT; i++) {
 		if (devices[i]->device_id == device_id) {
@@ -32,6 +115,326 @@ struct schc_device* get_device_by_id(uint32_t device_id) {
 	return NULL;
 }
 
+/**
+ * Prefetch what get_device_by_id() reads for a device, so the lookups
+ * of several devices wait for memory at once: prefetch step 0
+ * for all of them, then step 1, then look them up
+ *
+ * @param device_id 	the id of the device
+ * @param step 			0 for the slot of the device in the device table,
+ * 						1 for the device the slot refers to
+ *
+ */
+void prefetch_device_by_id(schc_device_id_t device_id, uint8_t step) {
+#if USE_CONTEXT_FILE == 1
+	if (schc_context_file_loaded()) {
+		schc_context_file_prefetch(device_id, step);
+		return;
+	}
+#endif
+#if defined(__GNUC__)
+	if (device_table_built && step == 0) {
+		__builtin_prefetch(&device_table[device_hash(device_id)]);
+	}
+#else
+	(void) device_id; (void) step;
+#endif
+}
+
+/**
+ * Get the number of devices
+ *
+ * @return count 		the number of devices in the rule configuration,
+ * 						or in the context file that was loaded
+ *
+ */
+uint32_t get_device_count(void) {
+#if USE_CONTEXT_FILE == 1
+	if (schc_context_file_loaded()) {
+		return schc_context_file_device_count();
+	}
+#endif
+	return DEVICE_COUNT;
+}
+
+/**
+ * Get a device by it's position in the rule configuration
+ *
+ * @param index 		the position of the device
+ *
+ * @return schc_device 	the device at this position
+ *         NULL			if there is no device at this position
+ *
+ */
+struct schc_device* get_device_by_index(uint32_t index) {
+#if USE_CONTEXT_FILE == 1
+	if (schc_context_file_loaded()) {
+		return schc_context_file_device_by_index(index);
+	}
+#endif
+	if (index >= DEVICE_COUNT) {
+		return NULL;
+	}
+
+	return (struct schc_device*) devices[index];
+}
+
+/**
+ * Get the number of rule contexts, the sets of rules shared by devices
+ *
+ * @return count 		the number of devices in the rule configuration,
+ * 						or the number of contexts in the context file that was loaded
+ *
+ */
+uint32_t get_rule_context_count(void) {
+#if USE_CONTEXT_FILE == 1
+	if (schc_context_file_loaded()) {
+		return schc_context_file_context_count();
+	}
+#endif
+	return DEVICE_COUNT;
+}
+
+/**
+ * Get a rule context, to go over the rules of all devices
+ * without going over every device
+ *
+ * @param index 		the position of the rule context
+ *
+ * @return schc_device 	a device with the rules of this context
+ *         NULL			if there is no context at this position
+ *
+ */
+struct schc_device* get_rule_context_by_index(uint32_t index) {
+#if USE_CONTEXT_FILE == 1
+	if (schc_context_file_loaded()) {
+		return schc_context_file_context_by_index(index);
+	}
+#endif
+	return get_device_by_index(index);
+}
+
+/*
+ * Get the rule id of a rule of a device
+ *
+ * @param device 		the device
+ * @param kind 			RULE_ID_COMPRESSION or RULE_ID_FRAGMENTATION
+ * @param index 		the position of the rule in the context
+ * @param rule_id 		set to the bits of the rule id, right aligned,
+ * 						as they are sent
+ *
+ * @return the rule id size in bits
+ */
+static uint8_t get_rule_id_bits(const struct schc_device *device, uint8_t kind, uint8_t index,
+		uint32_t* rule_id) {
+	uint32_t id; uint8_t size;
+	if (kind == RULE_ID_COMPRESSION) {
+		id = (*device->compression_context)[index]->rule_id;
+		size = (*device->compression_context)[index]->rule_id_size_bits;
+	} else {
+		id = (*device->fragmentation_context)[index]->rule_id;
+		size = (*device->fragmentation_context)[index]->rule_id_size_bits;
+	}
+
+	uint8_t rule_arr[RULE_SIZE_BYTES] = { 0 };
+	little_end_uint8_from_uint32(rule_arr, id); /* copy the uint32_t to a uint8_t array */
+	*rule_id = (size && size <= 32) ? get_bits(rule_arr, get_position_in_first_byte(size), size) : 0;
+
+	return size;
+}
+
+#if USE_RULE_ID_TABLE == 1
+/*
+ * Find the slot of the rule id table of the rules of a device
+ *
+ * @return the slot, holding 0 if the rules have no table
+ */
+static uint16_t rule_id_slot(const struct schc_device *device, uint8_t kind) {
+	const void* context = (kind == RULE_ID_COMPRESSION) ?
+			(const void*) device->compression_context : (const void*) device->fragmentation_context;
+	uint8_t count = (kind == RULE_ID_COMPRESSION) ?
+			device->compression_rule_count : device->fragmentation_rule_count;
+	uint16_t slot = (uint16_t) (((((uintptr_t) context) >> 3) * 2654435761u + kind) % (2 * RULE_ID_TABLES));
+
+	for (; rule_id_slots[slot]; slot = (slot + 1) % (2 * RULE_ID_TABLES)) {
+		const struct rule_id_table_t* table = &rule_id_tables[rule_id_slots[slot] - 1];
+		if (table->context == context && table->rule_count == count && table->kind == kind) {
+			break;
+		}
+	}
+
+	return slot;
+}
+#endif
+
+/*
+ * Find the first rule of a device with the rule id a packet starts with
+ *
+ * @param device 		the device
+ * @param kind 			RULE_ID_COMPRESSION or RULE_ID_FRAGMENTATION
+ * @param rule_arr 		the packet
+ *
+ * @return the position of the rule in the context
+ *         -1 if no rule was found
+ */
+static int16_t find_rule_by_rule_id(const struct schc_device *device, uint8_t kind,
+		const uint8_t* rule_arr) {
+	uint8_t i = 0;
+	uint8_t count = (kind == RULE_ID_COMPRESSION) ?
+			device->compression_rule_count : device->fragmentation_rule_count;
+
+#if USE_RULE_ID_TABLE == 1
+	uint16_t slot = rule_id_slot(device, kind);
+	if (rule_id_slots[slot]) {
+		uint16_t entry = rule_id_tables[rule_id_slots[slot] - 1].entries[rule_arr[0]];
+		if (entry == RULE_ID_NONE) {
+			return -1;
+		}
+		if (!(entry & RULE_ID_SCAN)) {
+			return entry;
+		}
+		i = (uint8_t) entry; // the rules before can not match
+	}
+#endif
+
+	for (; i < count; i++) {
+		uint32_t rule_id;
+		uint8_t size = get_rule_id_bits(device, kind, i, &rule_id);
+		if (size <= 32 && get_bits(rule_arr, 0, size) == rule_id) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Find a compression rule of a device by the rule id a packet starts with
+ *
+ * @param device 		the device to find a rule for
+ * @param rule_arr 		the packet
+ *
+ * @return schc_rule 	the rule that was found
+ *         NULL			if no rule was found
+ *
+ */
+struct schc_compression_rule_t* get_compression_rule_by_rule_id(struct schc_device *device,
+		const uint8_t* rule_arr) {
+	if (device == NULL) {
+		DEBUG_PRINTF("get_schc_rule(): no device was found for this id \n");
+		return NULL;
+	}
+
+	int16_t i = find_rule_by_rule_id(device, RULE_ID_COMPRESSION, rule_arr);
+	if (i < 0) {
+		return NULL;
+	}
+
+	struct schc_compression_rule_t* curr_rule = (struct schc_compression_rule_t*) (*device->compression_context)[i];
+	TRACE_DEBUG(TRACE_COMPRESSION_RULE_FOUND, device->device_id, curr_rule->rule_id);
+	return curr_rule;
+}
+
+/**
+ * Find a fragmentation rule of a device by the rule id a packet starts with
+ *
+ * @param device 		the device to find a rule for
+ * @param rule_arr 		the packet
+ *
+ * @return schc_rule 	the rule that was found
+ *         NULL			if no rule was found
+ *
+ */
+struct schc_fragmentation_rule_t* get_fragmentation_rule_by_rule_id(struct schc_device *device,
+		const uint8_t* rule_arr) {
+	if (device == NULL) {
+		DEBUG_PRINTF("get_schc_rule(): no device was found for this id \n");
+		return NULL;
+	}
+
+	int16_t i = find_rule_by_rule_id(device, RULE_ID_FRAGMENTATION, rule_arr);
+	if (i < 0) {
+		return NULL;
+	}
+
+	struct schc_fragmentation_rule_t* curr_rule = (struct schc_fragmentation_rule_t*) (*device->fragmentation_context)[i];
+	TRACE_DEBUG(TRACE_FRAGMENTATION_RULE_FOUND, device->device_id, curr_rule->rule_id);
+	return curr_rule;
+}
+
+/**
+ * Build the lookup tables for the devices and their rule ids
+ * Rule ids of devices that do not fit the rule id tables are compared rule by rule
+ * The tables are shared by all threads and only read by the lookups,
+ * so they are built once, by schc_compressor_init() or schc_fragmenter_init(),
+ * before other threads look up devices or rules
+ *
+ */
+void rm_build_tables(void) {
+	uint32_t n, slot;
+
+	/* the devices of a context file are found with the device table of the file */
+	device_table_built = 0;
+	memset(device_table, 0, sizeof(device_table));
+	for (n = 0; n < DEVICE_COUNT; n++) {
+		for (slot = device_hash(devices[n]->device_id); device_table[slot];
+				slot = (slot + 1) % DEVICE_TABLE_SIZE) {
+			if (devices[device_table[slot] - 1]->device_id == devices[n]->device_id) {
+				break; // the first device with an id is used
+			}
+		}
+		if (!device_table[slot]) {
+			device_table[slot] = n + 1;
+		}
+	}
+	device_table_built = 1;
+
+#if USE_RULE_ID_TABLE == 1
+	uint8_t kind, i;
+	uint16_t e;
+
+	rule_id_table_count = 0;
+	memset(rule_id_slots, 0, sizeof(rule_id_slots));
+	for (n = 0; n < get_rule_context_count(); n++) { // going over each rule context once
+		const struct schc_device* device = get_rule_context_by_index(n);
+		for (kind = RULE_ID_COMPRESSION; kind <= RULE_ID_FRAGMENTATION; kind++) {
+			slot = rule_id_slot(device, kind);
+			if (rule_id_slots[slot] || rule_id_table_count >= RULE_ID_TABLES) {
+				continue; // the rules of another device, or compared rule by rule
+			}
+			struct rule_id_table_t* rule_id_table = &rule_id_tables[rule_id_table_count];
+			rule_id_slots[slot] = ++rule_id_table_count;
+			uint16_t* table = rule_id_table->entries;
+			uint8_t count = (kind == RULE_ID_COMPRESSION) ?
+					device->compression_rule_count : device->fragmentation_rule_count;
+			rule_id_table->context = (kind == RULE_ID_COMPRESSION) ?
+					(const void*) device->compression_context : (const void*) device->fragmentation_context;
+			rule_id_table->rule_count = count;
+			rule_id_table->kind = kind;
+			for (e = 0; e < 256; e++) {
+				table[e] = RULE_ID_NONE;
+			}
+			for (i = 0; i < count; i++) {
+				uint32_t rule_id;
+				uint8_t size = get_rule_id_bits(device, kind, i, &rule_id);
+				if (size > 8) { // compared one by one, from the first rule for this byte
+					if (size <= 32 && table[rule_id >> (size - 8)] == RULE_ID_NONE) {
+						table[rule_id >> (size - 8)] = RULE_ID_SCAN | i;
+					}
+					continue;
+				}
+				uint16_t first = (uint16_t) (rule_id << (8 - size));
+				for (e = first; e < first + (1 << (8 - size)); e++) { // every byte starting with the rule id
+					if (table[e] == RULE_ID_NONE) {
+						table[e] = i;
+					}
+				}
+			}
+		}
+	}
+#endif
+}
+
 /**
  * Revise the rules for all devices
  * Uncompressed rule ids should not be used for other rules
@@ -41,13 +444,18 @@ struct schc_device* get_device_by_id(uint32_t device_id) {
  *
  */
 uint8_t rm_revise_rule_context(void) {
+#if USE_CONTEXT_FILE == 1
+	if (schc_context_file_loaded()) {
+		return 1; // revised by schc_context_file_load()
+	}
+#endif
 	/* compare uncompressed rule ids and rule entries for possible duplicates */
 	for (int i = 0; i < DEVICE_COUNT; i++) {
 		for (int j = 0; j < devices[i]->compression_rule_count; j++) {
 			const struct schc_compression_rule_t *curr_rule =
 					(*devices[i]->compression_context)[j];
 			if (devices[i]->uncomp_rule_id == curr_rule->rule_id) {
-				DEBUG_PRINTF("rm_revise_rule_context(): rule=%p uses device with id=%02" PRIu32 " uncompressed rule id=%d\n", (void*) curr_rule, devices[i]->device_id, devices[i]->uncomp_rule_id);
+				DEBUG_PRINTF("rm_revise_rule_context(): rule=%p uses device with id=%02" PRIu64 " uncompressed rule id=%d\n", (void*) curr_rule, devices[i]->device_id, devices[i]->uncomp_rule_id);
 				return 0;
 			}
 		}
@@ -23,6 +23,13 @@
 /* maximum number of bytes the ACK W field can be */
 #define WINDOW_SIZE_BYTES		1
 
+#ifndef USE_RULE_ID_TABLE
+#define USE_RULE_ID_TABLE		0
+#endif
+#ifndef RULE_ID_TABLE_CONTEXTS
+#define RULE_ID_TABLE_CONTEXTS	4
+#endif
+
 typedef struct schc_bitarray_t {
 	uint8_t* ptr;
 	uint32_t offset; // in bits
@@ -218,9 +225,12 @@ struct schc_fragmentation_rule_t {
 	uint8_t DTAG_SIZE;
 };
 
+/* a device id, wide enough for a 64-bit DevEUI */
+typedef uint64_t schc_device_id_t;
+
 struct schc_device {
 	/* the device id (e.g. EUI) */
-	uint32_t device_id;
+	schc_device_id_t device_id;
 	/* the rule id to use when a packet remains uncompressed */
 	uint32_t uncomp_rule_id;
 	/* the rule id size when a packet remains uncompressed in bits */
@@ -259,8 +269,19 @@ uint8_t mo_ignore(struct schc_field* target_field, unsigned char* field_value, u
 uint8_t mo_MSB(struct schc_field* target_field, unsigned char* field_value, uint16_t field_offset);
 uint8_t mo_matchmap(struct schc_field* target_field, unsigned char* field_value, uint16_t field_offset);
 
-struct schc_device* get_device_by_id(uint32_t device_id);
+struct schc_device* get_device_by_id(schc_device_id_t device_id);
+void prefetch_device_by_id(schc_device_id_t device_id, uint8_t step);
+uint32_t get_device_count(void);
+struct schc_device* get_device_by_index(uint32_t index);
+uint32_t get_rule_context_count(void);
+struct schc_device* get_rule_context_by_index(uint32_t index);
+uint64_t device_id_hash(schc_device_id_t device_id);
 void uint32_rule_id_to_uint8_buf(uint32_t rule_id, uint8_t* out, uint8_t len);
 uint8_t rm_revise_rule_context(void);
+void rm_build_tables(void);
+struct schc_compression_rule_t* get_compression_rule_by_rule_id(struct schc_device *device,
+		const uint8_t* rule_arr);
+struct schc_fragmentation_rule_t* get_fragmentation_rule_by_rule_id(struct schc_device *device,
+		const uint8_t* rule_arr);
 
 #endif
@@ -27,6 +27,48 @@
 
 #define MAX_HEADER_LENGTH				256
 
+/* compile the compression rules of each rule context into a decision tree at init,
+ * so a matching rule is found without testing every rule */
+#define USE_RULE_INDEX					1
+
+/* the size of the decision trees, shared by all devices
+ * rule contexts or layers that do not fit are matched rule by rule */
+#define RULE_INDEX_CONTEXTS				16
+#define RULE_INDEX_NODES				128
+#define RULE_INDEX_EDGES				256
+#define RULE_INDEX_RULES				1024
+
+/* compile the target values of the match-map fields into sorted tables at init,
+ * the index found while matching is sent without looking for it again */
+#define USE_MATCHMAP_INDEX				1
+#define MATCHMAP_FIELDS					32 // at most 254
+#define MATCHMAP_ENTRIES				256
+
+/* lower each layer rule at init into a program per direction,
+ * with the offsets of the fields computed and the residues joined */
+#define USE_RULE_PROGRAM				1
+#define RULE_PROGRAMS					32 // layer rules
+#define RULE_PROGRAM_INSTRUCTIONS		512
+
+/* try the rule found for the previous packet of a flow first,
+ * see schc_get_flow_cache_stats() for the hits and misses */
+#define USE_FLOW_CACHE					1
+#define FLOW_CACHE_SIZE					64 // flows of all devices
+
+/* find the rule of a received packet with a table per rule context,
+ * indexed by the first byte of the packet */
+#define USE_RULE_ID_TABLE				1
+#define RULE_ID_TABLE_CONTEXTS			16
+
+/* the packets of schc_compress_batch() and schc_decompress_batch()
+ * that are grouped by device at once */
+#define COMPRESS_BATCH_SIZE				32
+
+/* the compression workers of worker.c, see schc_worker_pool_start() */
+#define WORKER_THREADS					8 // workers of a pool
+#define WORKER_RING_SIZE				256 // jobs queued per worker, a power of 2
+#define WORKER_PIN_CORES				0 // run worker i on core i (Linux)
+
 #define MAX_COAP_HEADER_LENGTH			64
 #define MAX_PAYLOAD_LENGTH				256
 #define MAX_COAP_MSG_SIZE				(MAX_COAP_HEADER_LENGTH + MAX_PAYLOAD_LENGTH)
@@ -39,6 +81,22 @@
 
 #define DEBUG_PRINTF(...) 				printf(__VA_ARGS__)
 
+/* the tracepoints of trace.c that are recorded, in a ring per thread
+ * 0 off, 1 errors, 2 packets, 3 debug with the packet bytes */
+#define TRACE_LEVEL						2
+#define TRACE_RING_SIZE					256 // records per thread, a power of 2
+
+/* count the packets, rules and fragments of each device, see metrics.h */
+#define USE_METRICS						1
+#define METRICS_THREADS					16 // threads with their own counters
+#define METRICS_DEVICES					8 // the devices with their own counters, per thread
+#define METRICS_PROBES					4 // the slots tried for a device, from the hash of its id
+#define METRICS_RULES					32 // the first compression rules of a device
+
+/* look up the devices in the context file of schc_context_file_load(),
+ * when one was loaded, see context_file.h */
+#define USE_CONTEXT_FILE				1
+
 /* the number of ack attempts */
 #define MAX_ACK_REQUESTS				3
 
@@ -51,6 +109,10 @@
 /* the number of bytes the MIC consists of */
 #define MIC_SIZE_BYTES					4
 
+/* the CRC32 implementation used for the MIC, see mic.h
+ * MIC_CRC32_NIBBLE for small MCU builds, MIC_CRC32_HW on the gateway */
+#define MIC_BACKEND						MIC_CRC32_SLICING8
+
 // the length of the bitmap
 #define BITMAP_SIZE_BYTES				2 // pow(2, FCN_SIZE_BITS) / 8
 
@@ -0,0 +1,256 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * Tracepoints, recorded in a binary ring buffer per thread
+ * and only formatted when the records are printed or decoded
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "trace.h"
+
+#if CLICK
+#include <click/config.h>
+#endif
+
+#if (TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) != 0
+#error "TRACE_RING_SIZE must be a power of 2"
+#endif
+
+#if defined(__GNUC__)
+#define TRACE_THREAD_LOCAL				__thread
+#else
+#define TRACE_THREAD_LOCAL				_Thread_local
+#endif
+
+struct schc_trace_event_format_t {
+	const char* name;
+	/* the format of the arguments, always unsigned and 64 bits wide */
+	const char* args;
+};
+
+/* indexed by schc_trace_event_t */
+static const struct schc_trace_event_format_t trace_events[TRACE_EVENTS] = {
+	{ "compress", "device %" PRIu64 " rule %" PRIu64 ", %" PRIu64 " bits (%" PRIu64 "B)" },
+	{ "compress", "device %" PRIu64 " uncompressed, %" PRIu64 " bits (%" PRIu64 "B)" },
+	{ "compress", "no device was found for id %" PRIu64 },
+	{ "compress", "compressed header does not fit the buffer of %" PRIu64 "B" },
+	{ "compress", "SCHC packet" },
+	{ "find_rule", "skipped rule %" PRIu64 ", not in the rule index" },
+	{ "find_rule", "rule %" PRIu64 " from the flow cache" },
+	{ "decompress", "device %" PRIu64 " rule %" PRIu64 ", header length %" PRIu64 ", payload length %" PRIu64 },
+	{ "decompress", "no device was found for id %" PRIu64 },
+	{ "decompress", "original packet" },
+	{ "fragment", "sending fragment %" PRIu64 " with length %" PRIu64 " to device %" PRIu64 },
+	{ "fragment", "fragment" },
+	{ "mbuf", "fragment %" PRIu64 ", %" PRIu64 " bytes" },
+	{ "mbuf", "mbuf" },
+	{ "find_rule", "skipped rule %" PRIu64 ", %s does not match" },
+	{ "find_rule", "device %" PRIu64 " compression rule %" PRIu64 " found by its rule id" },
+	{ "find_rule", "device %" PRIu64 " fragmentation rule %" PRIu64 " found by its rule id" }
+};
+
+static const char* trace_levels[] = { "off", "error", "info", "debug" };
+
+/* the ring of the calling thread, unless an other one was attached */
+static TRACE_THREAD_LOCAL schc_trace_ring_t thread_ring;
+static TRACE_THREAD_LOCAL schc_trace_ring_t* current_ring;
+
+/**
+ * Get the ring the calling thread records to
+ *
+ * @return 	the ring of the thread
+ */
+schc_trace_ring_t* schc_trace_ring(void) {
+	if (current_ring == NULL) {
+		current_ring = &thread_ring;
+	}
+	return current_ring;
+}
+
+/**
+ * Record the tracepoints of the calling thread to a ring of the application,
+ * e.g. to read it after the thread ended
+ *
+ * @param 	ring			the ring, cleared by the application,
+ * 							or NULL for the ring of the thread
+ */
+void schc_trace_attach(schc_trace_ring_t* ring) {
+	current_ring = ring;
+}
+
+/**
+ * Record a tracepoint, use the TRACE_X macros instead
+ *
+ * @param 	level			the level of the tracepoint
+ * @param 	event			the event
+ * @param 	a0..a3			the arguments of the event
+ */
+void schc_trace_put(uint8_t level, schc_trace_event_t event, uint64_t a0, uint64_t a1,
+		uint64_t a2, uint64_t a3) {
+	schc_trace_ring_t* ring = schc_trace_ring();
+	schc_trace_record_t* record = &ring->records[ring->head & (TRACE_RING_SIZE - 1)];
+
+	record->sequence = ring->head++;
+	record->event = (uint16_t) event;
+	record->level = level;
+	record->reserved = 0;
+	record->args[0] = a0;
+	record->args[1] = a1;
+	record->args[2] = a2;
+	record->args[3] = a3;
+}
+
+/**
+ * Record the bytes of a packet, TRACE_BYTES_PER_RECORD bytes per record
+ *
+ * @param 	level			the level of the tracepoint
+ * @param 	event			a packet event
+ * @param 	data			the packet
+ * @param 	len				the length of the packet
+ */
+void schc_trace_bytes(uint8_t level, schc_trace_event_t event, const uint8_t* data,
+		uint16_t len) {
+	uint16_t offset, i;
+
+	for (offset = 0; offset < len; offset += TRACE_BYTES_PER_RECORD) {
+		uint64_t words[TRACE_ARGS - 1] = { 0 };
+		for (i = 0; i < TRACE_BYTES_PER_RECORD && (offset + i) < len; i++) {
+			words[i / 8] |= (uint64_t) data[offset + i] << (56 - ((i % 8) * 8));
+		}
+		schc_trace_put(level, event, ((uint32_t) len << 16) | offset, words[0], words[1],
+				words[2]);
+	}
+}
+
+/**
+ * Write the records of a ring to a file, oldest first
+ * The ring should not be recorded to while it is written.
+ *
+ * @param 	ring			the ring
+ * @param 	file			the binary file to write to
+ *
+ * @return 	the number of records written
+ */
+uint32_t schc_trace_write(const schc_trace_ring_t* ring, FILE* file) {
+	uint32_t count = (ring->head < TRACE_RING_SIZE) ? ring->head : TRACE_RING_SIZE;
+	uint32_t i, written = 0;
+
+	schc_trace_file_header_t header = { TRACE_FILE_MAGIC, TRACE_FILE_VERSION,
+			sizeof(schc_trace_record_t), count };
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		return 0;
+	}
+	for (i = ring->head - count; i != ring->head; i++) {
+		written += fwrite(&ring->records[i & (TRACE_RING_SIZE - 1)],
+				sizeof(schc_trace_record_t), 1, file);
+	}
+
+	return written;
+}
+
+/**
+ * Read the header of a trace file
+ *
+ * @param 	file			the binary file, written by schc_trace_write()
+ *
+ * @return 	the number of records in the file
+ * 			-1				the file is not a trace of this version
+ */
+int32_t schc_trace_read_header(FILE* file) {
+	schc_trace_file_header_t header;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_FILE_MAGIC
+			|| header.version != TRACE_FILE_VERSION
+			|| header.record_size != sizeof(schc_trace_record_t)) {
+		return -1;
+	}
+
+	return (int32_t) header.record_count;
+}
+
+/**
+ * Read the next record of a trace file
+ *
+ * @param 	file			the binary file, after the header was read
+ * @param 	record			set to the record
+ *
+ * @return 	1				a record was read
+ * 			0				the end of the file
+ */
+uint8_t schc_trace_read(FILE* file, schc_trace_record_t* record) {
+	return (uint8_t) fread(record, sizeof(schc_trace_record_t), 1, file);
+}
+
+/**
+ * Print a record as text
+ *
+ * @param 	record			the record
+ * @param 	out				the file to print to
+ */
+void schc_trace_print(const schc_trace_record_t* record, FILE* out) {
+	if (record->event >= TRACE_EVENTS) {
+		fprintf(out, "%8u unknown event %u\n", record->sequence, record->event);
+		return;
+	}
+
+	const struct schc_trace_event_format_t* format = &trace_events[record->event];
+	fprintf(out, "%8u %-5s %-10s ", record->sequence,
+			trace_levels[record->level & TRACE_LEVEL_DEBUG], format->name);
+
+	switch (record->event) {
+	case TRACE_COMPRESSED_PACKET:
+	case TRACE_DECOMPRESSED_PACKET:
+	case TRACE_FRAGMENT_PACKET:
+	case TRACE_MBUF_PACKET: {
+		uint16_t offset = record->args[0] & 0xFFFF, len = (record->args[0] >> 16) & 0xFFFF, i;
+		fprintf(out, "%s %3u/%-3u ", format->args, offset, len);
+		for (i = 0; i < TRACE_BYTES_PER_RECORD && (offset + i) < len; i++) {
+			fprintf(out, "%02X ", (unsigned) (record->args[1 + (i / 8)] >> (56 - ((i % 8) * 8))) & 0xFF);
+		}
+		break;
+	}
+	case TRACE_RULE_MISMATCH: {
+		uint64_t field = record->args[1];
+		if (field < (sizeof(schc_header_field_names) / sizeof(schc_header_field_names[0]))
+				&& schc_header_field_names[field] != NULL) {
+			fprintf(out, format->args, record->args[0], schc_header_field_names[field]);
+		} else { // a CoAP option
+			fprintf(out, "skipped rule %" PRIu64 ", field %" PRIu64 " does not match", record->args[0],
+					field);
+		}
+		break;
+	}
+	default:
+		fprintf(out, format->args, record->args[0], record->args[1], record->args[2],
+				record->args[3]);
+		break;
+	}
+	fprintf(out, "\n");
+}
+
+/**
+ * Print the records of a ring as text, oldest first
+ *
+ * @param 	ring			the ring
+ * @param 	out				the file to print to
+ */
+void schc_trace_dump(const schc_trace_ring_t* ring, FILE* out) {
+	uint32_t count = (ring->head < TRACE_RING_SIZE) ? ring->head : TRACE_RING_SIZE;
+	uint32_t i;
+
+	for (i = ring->head - count; i != ring->head; i++) {
+		schc_trace_print(&ring->records[i & (TRACE_RING_SIZE - 1)], out);
+	}
+}
+
+#if CLICK
+ELEMENT_PROVIDES(schcTRACE)
+#endif
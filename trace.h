@@ -0,0 +1,142 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ */
+#ifndef _SCHC_TRACE_H_
+#define _SCHC_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "schc.h"
+
+/* the trace levels, a tracepoint above TRACE_LEVEL is compiled out */
+#define TRACE_LEVEL_OFF					0
+#define TRACE_LEVEL_ERROR				1
+#define TRACE_LEVEL_INFO				2
+#define TRACE_LEVEL_DEBUG				3 // includes the packet bytes
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL						TRACE_LEVEL_OFF
+#endif
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE					256 // records per thread, a power of 2
+#endif
+
+#define TRACE_ARGS						4
+#define TRACE_BYTES_PER_RECORD			24
+
+#define TRACE_FILE_MAGIC				0x53434854 // "SCHT"
+#define TRACE_FILE_VERSION				2
+
+/*
+ * The events of the tracepoints
+ * The arguments of each event are listed in trace.c,
+ * append new events to keep the recorded traces readable
+ */
+typedef enum {
+	TRACE_COMPRESS = 0,
+	TRACE_COMPRESS_UNCOMPRESSED = 1,
+	TRACE_COMPRESS_NO_DEVICE = 2,
+	TRACE_COMPRESS_OVERFLOW = 3,
+	TRACE_COMPRESSED_PACKET = 4,
+	TRACE_RULE_SKIPPED = 5,
+	TRACE_FLOW_CACHE_HIT = 6,
+	TRACE_DECOMPRESS = 7,
+	TRACE_DECOMPRESS_NO_DEVICE = 8,
+	TRACE_DECOMPRESSED_PACKET = 9,
+	TRACE_FRAGMENT_SENT = 10,
+	TRACE_FRAGMENT_PACKET = 11,
+	TRACE_MBUF = 12,
+	TRACE_MBUF_PACKET = 13,
+	TRACE_RULE_MISMATCH = 14,
+	TRACE_COMPRESSION_RULE_FOUND = 15,
+	TRACE_FRAGMENTATION_RULE_FOUND = 16,
+	TRACE_EVENTS
+} schc_trace_event_t;
+
+/*
+ * A fixed size record, the arguments are decoded with the
+ * format of the event, so no string is formatted on the packet path
+ * The arguments are 64 bits wide, to hold a schc_device_id_t.
+ * The packet events hold TRACE_BYTES_PER_RECORD bytes each, with
+ * the offset in the lower and the length of the packet in the upper
+ * half of the first argument
+ */
+typedef struct schc_trace_record_t {
+	uint32_t sequence;
+	uint16_t event;
+	uint8_t level;
+	uint8_t reserved;
+	uint64_t args[TRACE_ARGS];
+} schc_trace_record_t;
+
+/*
+ * The records of a thread, written by that thread only
+ * When the ring is full, the oldest records are overwritten.
+ */
+typedef struct schc_trace_ring_t {
+	uint32_t head; // the sequence number of the next record
+	schc_trace_record_t records[TRACE_RING_SIZE];
+} schc_trace_ring_t;
+
+/* the header of a trace file, followed by the records */
+typedef struct schc_trace_file_header_t {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t record_count;
+} schc_trace_file_header_t;
+
+#define TRACE_PUT(level, event, a0, a1, a2, a3, ...)	\
+	schc_trace_put(level, event, (uint64_t) (a0), (uint64_t) (a1), (uint64_t) (a2), (uint64_t) (a3))
+
+/* a tracepoint that is compiled out, without evaluating the arguments */
+#define TRACE_NONE(event, a0, a1, a2, a3, ...)	\
+	((void) sizeof(event), (void) sizeof(a0), (void) sizeof(a1), (void) sizeof(a2), (void) sizeof(a3))
+
+/* TRACE_X(event, up to TRACE_ARGS arguments) */
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(...)				TRACE_PUT(TRACE_LEVEL_ERROR, __VA_ARGS__, 0, 0, 0, 0, 0)
+#else
+#define TRACE_ERROR(...)				TRACE_NONE(__VA_ARGS__, 0, 0, 0, 0, 0)
+#endif
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(...)					TRACE_PUT(TRACE_LEVEL_INFO, __VA_ARGS__, 0, 0, 0, 0, 0)
+#else
+#define TRACE_INFO(...)					TRACE_NONE(__VA_ARGS__, 0, 0, 0, 0, 0)
+#endif
+#if TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(...)				TRACE_PUT(TRACE_LEVEL_DEBUG, __VA_ARGS__, 0, 0, 0, 0, 0)
+#define TRACE_BYTES(event, data, len)	schc_trace_bytes(TRACE_LEVEL_DEBUG, event, data, len)
+#else
+#define TRACE_DEBUG(...)				TRACE_NONE(__VA_ARGS__, 0, 0, 0, 0, 0)
+#define TRACE_BYTES(event, data, len)	TRACE_NONE(event, data, len, 0, 0, 0)
+#endif
+
+void schc_trace_put(uint8_t level, schc_trace_event_t event, uint64_t a0, uint64_t a1,
+		uint64_t a2, uint64_t a3);
+void schc_trace_bytes(uint8_t level, schc_trace_event_t event, const uint8_t* data,
+		uint16_t len);
+
+schc_trace_ring_t* schc_trace_ring(void);
+void schc_trace_attach(schc_trace_ring_t* ring);
+uint32_t schc_trace_write(const schc_trace_ring_t* ring, FILE* file);
+int32_t schc_trace_read_header(FILE* file);
+uint8_t schc_trace_read(FILE* file, schc_trace_record_t* record);
+void schc_trace_print(const schc_trace_record_t* record, FILE* out);
+void schc_trace_dump(const schc_trace_ring_t* ring, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
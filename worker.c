@@ -0,0 +1,251 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ * A pool of compression workers for the gateway
+ * The jobs are sharded by device over the workers, each with its own
+ * compressor context, and passed through single producer, single consumer rings
+ *
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for pthread_setaffinity_np()
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#include "worker.h"
+
+#if (WORKER_RING_SIZE & (WORKER_RING_SIZE - 1)) != 0
+#error "WORKER_RING_SIZE must be a power of 2"
+#endif
+
+/* the empty polls a worker spins before it yields the core */
+#define WORKER_SPIN						64
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define cpu_relax()						__builtin_ia32_pause()
+#else
+#define cpu_relax()
+#endif
+
+/*
+ * Add a job to a ring, by the producer
+ *
+ * @return 	1			the job was added
+ * 			0			the ring is full
+ */
+static uint8_t ring_push(struct schc_worker_ring_t* ring, schc_worker_job_t* job) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (tail - head == WORKER_RING_SIZE) {
+		return 0;
+	}
+	ring->jobs[tail & (WORKER_RING_SIZE - 1)] = job;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	return 1;
+}
+
+/*
+ * Take the oldest jobs from a ring, by the consumer
+ *
+ * @return 	the number of jobs taken
+ */
+static uint16_t ring_pop(struct schc_worker_ring_t* ring, schc_worker_job_t* jobs[],
+		uint16_t max_jobs) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	uint16_t i, n = (uint16_t) (((tail - head) > max_jobs) ? max_jobs : (tail - head));
+
+	for (i = 0; i < n; i++) {
+		jobs[i] = ring->jobs[(head + i) & (WORKER_RING_SIZE - 1)];
+	}
+	atomic_store_explicit(&ring->head, head + n, memory_order_release);
+
+	return n;
+}
+
+/*
+ * Compress or decompress jobs with the same operation and direction as a batch
+ */
+static void worker_run_batch(struct schc_worker_t* worker, schc_worker_job_t* jobs[],
+		uint16_t count) {
+	schc_packet_t packets[COMPRESS_BATCH_SIZE];
+	uint16_t i;
+
+	for (i = 0; i < count; i++) {
+		packets[i] = jobs[i]->packet;
+	}
+	if (jobs[0]->op == SCHC_WORKER_COMPRESS) {
+		schc_compress_batch(&worker->ctx, packets, count, jobs[0]->dir);
+	} else {
+		schc_decompress_batch(packets, count, jobs[0]->dir);
+	}
+	for (i = 0; i < count; i++) {
+		jobs[i]->packet = packets[i];
+	}
+}
+
+static void* worker_thread(void* arg) {
+	struct schc_worker_t* worker = (struct schc_worker_t*) arg;
+	schc_worker_job_t* jobs[COMPRESS_BATCH_SIZE];
+	uint16_t i, j, n;
+	uint32_t idle = 0;
+
+	while (atomic_load_explicit(&worker->pool->running, memory_order_relaxed)) {
+		n = ring_pop(&worker->input, jobs, COMPRESS_BATCH_SIZE);
+		if (n == 0) {
+			if (++idle < WORKER_SPIN) {
+				cpu_relax();
+			} else {
+				sched_yield();
+			}
+			continue;
+		}
+		idle = 0;
+
+		/* consecutive jobs of the same kind form a batch */
+		for (i = 0; i < n; i = j) {
+			for (j = i + 1; j < n && jobs[j]->op == jobs[i]->op && jobs[j]->dir == jobs[i]->dir; j++);
+			worker_run_batch(worker, jobs + i, j - i);
+		}
+
+		for (i = 0; i < n; i++) {
+			while (!ring_push(&worker->output, jobs[i])) { // wait for the jobs to be collected
+				if (!atomic_load_explicit(&worker->pool->running, memory_order_relaxed)) {
+					return NULL;
+				}
+				sched_yield();
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Get the worker that handles the packets of a device
+ *
+ * @param 	pool			the pool
+ * @param 	device_id		the id of the device
+ *
+ * @return 	the index of the worker
+ */
+uint8_t schc_worker_index(schc_worker_pool_t* pool, schc_device_id_t device_id) {
+	uint64_t hash = (uint64_t) device_id * 0x9E3779B97F4A7C15ULL;
+	return (uint8_t) ((hash >> 32) % pool->worker_count);
+}
+
+/**
+ * Start a pool of workers
+ * schc_compressor_init() must be called before, as the workers share the rules
+ *
+ * @param 	pool			the pool to start
+ * @param 	worker_count	the number of workers, at most WORKER_THREADS
+ *
+ * @return 	1				the workers are running
+ * 			0				the workers could not be started
+ */
+int8_t schc_worker_pool_start(schc_worker_pool_t* pool, uint8_t worker_count) {
+	uint8_t i;
+
+	if (worker_count == 0 || worker_count > WORKER_THREADS) {
+		return 0;
+	}
+
+	memset(pool, 0, sizeof(schc_worker_pool_t));
+	atomic_store(&pool->running, 1);
+
+	for (i = 0; i < worker_count; i++) {
+		struct schc_worker_t* worker = &pool->workers[i];
+		worker->index = i;
+		worker->pool = pool;
+		schc_compressor_context_init(&worker->ctx);
+
+		if (pthread_create(&worker->thread, NULL, worker_thread, worker) != 0) {
+			DEBUG_PRINTF("schc_worker_pool_start(): could not start worker %d \n", i);
+			schc_worker_pool_stop(pool);
+			return 0;
+		}
+		pool->worker_count++;
+
+#if WORKER_PIN_CORES == 1 && defined(__linux__)
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(i, &cpus);
+		pthread_setaffinity_np(worker->thread, sizeof(cpus), &cpus);
+#endif
+	}
+
+	return 1;
+}
+
+/**
+ * Stop the workers of a pool
+ * The jobs that were not handled yet are not returned
+ *
+ * @param 	pool			the pool to stop
+ */
+void schc_worker_pool_stop(schc_worker_pool_t* pool) {
+	uint8_t i;
+
+	atomic_store(&pool->running, 0);
+	for (i = 0; i < pool->worker_count; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	pool->worker_count = 0;
+}
+
+/**
+ * Queue a job to the worker of its device
+ * Only one thread may submit jobs to a pool.
+ *
+ * @param 	pool			the pool
+ * @param 	job				the job, with the packet and the operation set
+ *
+ * @return 	1				the job was queued
+ * 			0				the queue of the worker is full, collect jobs and retry
+ */
+uint8_t schc_worker_pool_submit(schc_worker_pool_t* pool, schc_worker_job_t* job) {
+	struct schc_worker_t* worker = &pool->workers[schc_worker_index(pool, job->packet.device_id)];
+	return ring_push(&worker->input, job);
+}
+
+/**
+ * Collect the jobs the workers are done with
+ * The jobs of a device are returned in the order they were submitted.
+ * Only one thread may collect jobs from a pool.
+ *
+ * @param 	pool			the pool
+ * @param 	jobs			set to the jobs that are done
+ * @param 	max_jobs		the maximum number of jobs to collect
+ *
+ * @return 	the number of jobs collected
+ */
+uint16_t schc_worker_pool_collect(schc_worker_pool_t* pool, schc_worker_job_t* jobs[],
+		uint16_t max_jobs) {
+	uint16_t n = 0;
+	uint8_t i;
+
+	for (i = 0; i < pool->worker_count && n < max_jobs; i++) {
+		struct schc_worker_t* worker = &pool->workers[(pool->collect_next + i) % pool->worker_count];
+		n += ring_pop(&worker->output, jobs + n, max_jobs - n);
+	}
+	if (pool->worker_count > 0) {
+		pool->collect_next = (pool->collect_next + 1) % pool->worker_count;
+	}
+
+	return n;
+}
+
+#if CLICK
+ELEMENT_PROVIDES(schcWORKER)
+ELEMENT_REQUIRES(schcCOMPRESSOR)
+#endif
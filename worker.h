@@ -0,0 +1,103 @@
+/*
+ * (c) 2018 - 2022  - idlab - UGent - imec
+ *
+ * Bart Moons
+ *
+ * This file is part of the SCHC stack implementation
+ *
+ */
+#ifndef _SCHC_WORKER_H_
+#define _SCHC_WORKER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "schc.h"
+#include "compressor.h"
+
+#ifndef WORKER_THREADS
+#define WORKER_THREADS					8 // the maximum number of workers of a pool
+#endif
+#ifndef WORKER_RING_SIZE
+#define WORKER_RING_SIZE				256 // jobs queued per worker, a power of 2
+#endif
+#ifndef WORKER_PIN_CORES
+#define WORKER_PIN_CORES				0
+#endif
+
+#define WORKER_CACHE_LINE				64
+
+typedef enum {
+	SCHC_WORKER_COMPRESS = 0, SCHC_WORKER_DECOMPRESS = 1
+} schc_worker_op_t;
+
+/*
+ * A packet to compress or decompress
+ * The job is owned by the application until it is returned by
+ * schc_worker_pool_collect(), with the result set in the packet.
+ */
+typedef struct schc_worker_job_t {
+	schc_packet_t packet;
+	schc_worker_op_t op;
+	direction dir;
+	/* for the application */
+	void* arg;
+} schc_worker_job_t;
+
+/*
+ * A single producer, single consumer queue of jobs
+ * head is only written by the consumer and tail by the producer,
+ * each on its own cache line.
+ */
+struct schc_worker_ring_t {
+	_Atomic uint32_t head;
+	uint8_t head_pad[WORKER_CACHE_LINE - sizeof(uint32_t)];
+	_Atomic uint32_t tail;
+	uint8_t tail_pad[WORKER_CACHE_LINE - sizeof(uint32_t)];
+	schc_worker_job_t* jobs[WORKER_RING_SIZE];
+};
+
+struct schc_worker_t {
+	/* the jobs submitted to the worker */
+	struct schc_worker_ring_t input;
+	/* the jobs the worker is done with */
+	struct schc_worker_ring_t output;
+	/* the compressor context, only used by the thread of the worker */
+	schc_compressor_context_t ctx;
+	pthread_t thread;
+	uint8_t index;
+	struct schc_worker_pool_t* pool;
+};
+
+/*
+ * A pool of workers, each running on its own thread
+ * The packets of a device are always handled by the same worker,
+ * in the order they were submitted.
+ * One thread submits the jobs and one thread collects them,
+ * this can be the same thread.
+ */
+typedef struct schc_worker_pool_t {
+	struct schc_worker_t workers[WORKER_THREADS];
+	uint8_t worker_count;
+	/* the worker to collect from first */
+	uint8_t collect_next;
+	_Atomic uint8_t running;
+} schc_worker_pool_t;
+
+int8_t schc_worker_pool_start(schc_worker_pool_t* pool, uint8_t worker_count);
+void schc_worker_pool_stop(schc_worker_pool_t* pool);
+uint8_t schc_worker_pool_submit(schc_worker_pool_t* pool, schc_worker_job_t* job);
+uint16_t schc_worker_pool_collect(schc_worker_pool_t* pool, schc_worker_job_t* jobs[],
+		uint16_t max_jobs);
+uint8_t schc_worker_index(schc_worker_pool_t* pool, schc_device_id_t device_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif